@@ -27,6 +27,32 @@ typedef enum
 	CRON_STATUS_FAILED
 } CronStatus;
 
+/* how the runs of a job are executed */
+typedef enum
+{
+	CRON_EXECUTOR_AUTO = 0,
+	CRON_EXECUTOR_BGWORKER = 1,
+	CRON_EXECUTOR_POOL = 2,
+	CRON_EXECUTOR_LIBPQ = 3
+} CronExecutor;
+
+/* what the targets of a fan-out job stand for */
+typedef enum
+{
+	CRON_FANOUT_COMMAND = 0,
+	CRON_FANOUT_DATABASE = 1,
+	CRON_FANOUT_NODE = 2
+} CronFanoutTarget;
+
+/* whether a user may run a job, see GetRunPermission */
+typedef enum
+{
+	CRON_RUN_PERMITTED = 0,
+	CRON_RUN_INACTIVE = 1,
+	CRON_RUN_NO_JOB = 2,
+	CRON_RUN_DENIED = 3
+} CronRunPermission;
+
 /* job metadata data structure */
 typedef struct CronJob
 {
@@ -40,6 +66,13 @@ typedef struct CronJob
 	char *userName;
 	bool active;
 	Name jobName;
+	char *profile;
+	CronExecutor executor;
+	int maxConcurrency;
+	int batchTargetTime;
+	int batchPause;
+	char *fanoutTargets;
+	CronFanoutTarget fanoutTarget;
 } CronJob;
 
 #define JOBS_TABLE_NAME "job"
@@ -50,10 +83,33 @@ typedef struct CronJob
 #define MODE_ASAP 		"asap"
 #define MODE_NEXT 		"next"
 #define MODE_FIXED 		"fixed"
+#define MODE_DAEMON 	"daemon"
+#define MODE_CONSUMER 	"consumer"
+#define MODE_CHUNKED 	"chunked"
+#define MODE_FANOUT 	"fanout"
 
 #define COMMAND_SQL		"sql"
 #define COMMAND_LINUX	"linux"
 
+#define EXECUTOR_AUTO		"auto"
+#define EXECUTOR_BGWORKER	"bgworker"
+#define EXECUTOR_POOL		"pool"
+#define EXECUTOR_LIBPQ		"libpq"
+
+/* largest number of runs of a job that may be in progress at a time */
+#define MAX_JOB_CONCURRENCY	16
+
+/* the command of a chunked job processes this many rows per transaction */
+#define BATCH_SIZE_PLACEHOLDER		"{batch_size}"
+/* time in ms that a batch of a chunked job should take by default */
+#define DEFAULT_BATCH_TARGET_TIME	500
+
+/* the command of a fan-out job runs once for every target, named by this */
+#define FANOUT_TARGET_PLACEHOLDER	"{target}"
+
+#define FANOUT_TARGET_DATABASE	"database"
+#define FANOUT_TARGET_NODE		"node"
+
 #define DEFAULT_FILED_LEN	16
 #define MAX_STRING_LEN		1024
 
@@ -67,8 +123,12 @@ extern void InitializeJobMetadataCache(void);
 extern void ResetJobMetadataCache(void);
 extern List * LoadCronJobList(void);
 extern CronJob * GetCronJob(int64 jobId);
+extern bool EnsureRunPermission(int64 jobId, Oid userId);
+extern CronRunPermission GetRunPermission(int64 jobId, Oid userId);
+extern bool ParseNodeTarget(const char *node, char **nodeName, int *nodePort);
 
-extern void InsertJobRunDetail(int64 runId, int64 *jobId, char *database, char *username, char *command, char *status);
+extern void InsertJobRunDetail(int64 runId, int64 *jobId, char *database, char *username, char *command, char *status,
+							   int64 parentRunId, char *target);
 extern void UpdateJobRunDetail(int64 runId, int32 *job_pid, char *status, char *return_message, TimestampTz *start_time,
 									TimestampTz *end_time);
 extern void queryCommandFromJobRunDetail(int64 runid, char *value, unsigned int insize);
@@ -0,0 +1,23 @@
+/*-------------------------------------------------------------------------
+ *
+ * lt_job_profile.h
+ * definition of the per-job execution profile
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef LT_JOB_PROFILE_H
+#define LT_JOB_PROFILE_H
+
+
+/* longest profile that can be stored for a job */
+#define JOB_PROFILE_SIZE 1024
+
+/* name of the profile entry that limits the memory of a run */
+#define JOB_PROFILE_MEMORY_LIMIT "memory_limit"
+
+
+extern void ValidateJobProfile(const char *profile);
+extern void ApplyJobProfile(const char *profile);
+extern char * JobProfileConnectionOptions(const char *profile);
+
+#endif
@@ -0,0 +1,42 @@
+/*-------------------------------------------------------------------------
+ *
+ * lt_run_slots.h
+ * definition of the shared arena of background worker run slots
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef LT_RUN_SLOTS_H
+#define LT_RUN_SLOTS_H
+
+#include "postmaster/bgworker.h"
+#include "storage/dsm.h"
+#include "storage/shm_mq.h"
+
+#include "lt_job_profile.h"
+
+
+/* longest command that fits into a run slot, longer ones use their own DSM */
+#define RUN_SLOT_COMMAND_SIZE 8192
+
+/*
+ * CronRunSlot holds the parameters of one background worker run. The
+ * response queue of the run directly follows the slot in the arena.
+ */
+typedef struct CronRunSlot
+{
+	char database[NAMEDATALEN];
+	char userName[NAMEDATALEN];
+	char profile[JOB_PROFILE_SIZE];
+	char command[RUN_SLOT_COMMAND_SIZE];
+} CronRunSlot;
+
+
+extern void InitializeRunSlots(int slotCount);
+extern int AcquireRunSlot(const char *database, const char *userName,
+						  const char *profile, const char *command);
+extern void ReleaseRunSlot(int slotIndex, BackgroundWorkerHandle *handle);
+extern shm_mq_handle * RunSlotResponseQueue(int slotIndex);
+extern void PrepareRunSlotWorker(BackgroundWorker *worker, int slotIndex);
+extern CronRunSlot * AttachRunSlot(dsm_segment **seg, shm_mq **responseq);
+
+#endif
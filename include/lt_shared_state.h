@@ -0,0 +1,80 @@
+/*-------------------------------------------------------------------------
+ *
+ * lt_shared_state.h
+ * definition of the shared memory mirror of the launcher's task states
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef LT_SHARED_STATE_H
+#define LT_SHARED_STATE_H
+
+#include "port/atomics.h"
+#include "utils/timestamp.h"
+
+#include "task_states.h"
+
+
+/*
+ * CronSharedTask is the published state of one task or run instance. Only
+ * the launcher writes it. It makes changeCount odd while it writes and even
+ * again once it is done, so that readers can take a consistent copy
+ * without a lock by retrying when the count was odd or changed meanwhile.
+ */
+typedef struct CronSharedTask
+{
+	pg_atomic_uint32 changeCount;
+	bool inUse;
+	bool isRunInstance;
+	CronTaskState state;
+	int64 jobId;
+	int64 runId;
+	uint32 pendingRunCount;
+	int pid;
+	TimestampTz runStartTime;
+	TimestampTz startDeadline;
+	NameData userName;
+} CronSharedTask;
+
+
+/*
+ * CronRequestType is the kind of a request that a backend sends to the
+ * launcher through the request queue.
+ */
+typedef enum CronRequestType
+{
+	CRON_REQUEST_RUN,
+	CRON_REQUEST_TRIGGER,
+	CRON_REQUEST_CANCEL
+} CronRequestType;
+
+
+/* number of cron.run_job() requests that can wait for the launcher */
+#define RUN_REQUEST_QUEUE_SIZE 256
+
+/* number of slots that coalesce cron.job_trigger() requests per job */
+#define JOB_TRIGGER_SLOTS 1024
+
+/* number of sessions that can be in cron.wait_for_run() at a time */
+#define RUN_WAITER_SLOTS 128
+
+
+/* GUC settings */
+extern int CronSharedTaskSlots;
+
+extern void InitializeSharedStateHooks(void);
+extern void ResetSharedTaskStates(void);
+extern void AcquireSharedTaskSlot(CronTask *task);
+extern void PublishTaskState(CronTask *task);
+extern void ReleaseSharedTaskSlot(CronTask *task);
+extern void EnsureSharedStateLoaded(void);
+extern bool PushRunRequest(int64 jobId, int64 runId);
+extern bool PushJobTrigger(int64 jobId);
+extern bool PushCancelRequest(int64 jobId, int64 runId);
+extern bool PopRunRequest(int64 *jobId, int64 *runId, CronRequestType *type);
+extern int64 RunInProgressJobId(int64 runId);
+extern int RegisterRunWaiter(int64 runId);
+extern bool RunWaiterIsWoken(int waiterIndex);
+extern void ReleaseRunWaiter(int waiterIndex);
+extern void WakeRunWaiters(int64 runId);
+
+#endif
@@ -0,0 +1,51 @@
+/*-------------------------------------------------------------------------
+ *
+ * lt_worker_pool.h
+ * definition of the pool of long-lived executor background workers
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef LT_WORKER_POOL_H
+#define LT_WORKER_POOL_H
+
+#include "postmaster/bgworker.h"
+#include "storage/dsm.h"
+#include "storage/shm_mq.h"
+#include "utils/timestamp.h"
+
+
+/*
+ * CronPoolWorker is the launcher's view of one executor worker. The worker
+ * stays connected to its database as its user and runs the commands sent
+ * over commandq one after another, answering each one on responseq with the
+ * usual protocol messages followed by ReadyForQuery.
+ */
+typedef struct CronPoolWorker
+{
+	char database[NAMEDATALEN];
+	char userName[NAMEDATALEN];
+	dsm_segment *seg;
+	shm_mq_handle *commandq;
+	shm_mq_handle *responseq;
+	BackgroundWorkerHandle handle;
+	bool isBusy;
+	int runCount;
+	TimestampTz idleSince;
+} CronPoolWorker;
+
+
+/* GUC settings */
+extern bool CronUseWorkerPool;
+extern int CronPoolWorkerMaxRuns;
+extern int CronPoolWorkerIdleTimeout;
+
+extern CronPoolWorker * AcquirePoolWorker(const char *database, const char *userName,
+										  char **errorMessage);
+extern bool SendPoolWorkerCommand(CronPoolWorker *worker, int64 jobId,
+								  const char *profile, const char *command);
+extern void ReleasePoolWorker(CronPoolWorker *worker, bool reusable);
+extern void RecycleIdlePoolWorkers(TimestampTz currentTime);
+
+extern void CronPoolWorkerMain(Datum arg);
+
+#endif
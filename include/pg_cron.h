@@ -16,4 +16,10 @@
 extern char *CronTableDatabaseName;
 extern bool CronLogRun;
 
+extern void ExecuteSqlString(const char *sql);
+extern void BeginRunTransaction(const char *command);
+extern void EndRunTransaction(const char *command);
+extern void DropRequestedRun(int64 jobId, int64 runId, char *userName,
+							 char *message);
+
 #endif
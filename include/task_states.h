@@ -13,9 +13,11 @@
 
 
 #include "job_metadata.h"
+#include "lib/ilist.h"
 #include "libpq-fe.h"
 #include "postmaster/bgworker.h"
 #include "storage/dsm.h"
+#include "storage/shm_mq.h"
 #include "utils/timestamp.h"
 
 
@@ -30,15 +32,39 @@ typedef enum
 	CRON_TASK_DONE = 6,
 	CRON_TASK_ERROR = 7,
 	CRON_TASK_BGW_START = 8,
-	CRON_TASK_BGW_RUNNING = 9
+	CRON_TASK_BGW_RUNNING = 9,
+	CRON_TASK_CANCELING = 10,
+	CRON_TASK_PREPARING = 11,
+	CRON_TASK_BATCHED = 12,
+	CRON_TASK_BGW_STARTING = 13
 } CronTaskState;
 
+/*
+ * Tasks are kept in a queue per group of states, so that the launcher only
+ * goes through the tasks that have work to do. Idle tasks are waiting without
+ * pending runs.
+ */
+typedef enum
+{
+	CRON_TASK_QUEUE_IDLE = 0,
+	CRON_TASK_QUEUE_READY = 1,
+	CRON_TASK_QUEUE_STARTING = 2,
+	CRON_TASK_QUEUE_RUNNING = 3,
+	CRON_TASK_QUEUE_FINISHED = 4
+} CronTaskQueue;
+
+#define CRON_TASK_QUEUE_COUNT 5
+
 typedef enum
 {
 	CRON_MODE_NEXT = 0,
 	CRON_MODE_ASAP = 1,
 	CRON_MODE_FIXED = 2,
-	CRON_MODE_SINGLE = 3
+	CRON_MODE_SINGLE = 3,
+	CRON_MODE_DAEMON = 4,
+	CRON_MODE_CONSUMER = 5,
+	CRON_MODE_CHUNKED = 6,
+	CRON_MODE_FANOUT = 7
 } CronModeState;
 
 typedef enum
@@ -47,59 +73,131 @@ typedef enum
 	CRON_COMMAND_TYPE_LINUX = 1,
 } CronCommandType;
 
+/* longest message of a background worker run kept for the run details */
+#define BGW_RETURN_MESSAGE_SIZE 512
+
 struct BackgroundWorkerHandle
 {
 	int slot;
 	uint64 generation;
 };
 
-typedef struct CronTask
+/*
+ * CronTaskRun holds what a task needs for the run that it executes. It is
+ * reset once the run is over, whereas what outlives a run, like a connection
+ * kept open for the next one, belongs to the task.
+ */
+typedef struct CronTaskRun
 {
-	int64 jobId;
 	int64 runId;
-	CronTaskState state;
-	uint pendingRunCount;
-	PGconn *connection;
 	PostgresPollingStatusType pollingStatus;
 	TimestampTz startDeadline;
 	bool isSocketReady;
-	bool isActive;
 	char *errorMessage;
 	bool freeErrorMessage;
 	dsm_segment *seg;
 	BackgroundWorkerHandle handle;
-	int mode;
-	int commandtype;
-} CronTask;
+	int64 batchLeaderJobId;
+	int64 *batchJobIds;
+	int batchSize;
+	int batchResultIndex;
+	/* the command of the batch leader failed, applied once the batch is over */
+	bool batchLeaderFailed;
+	struct CronPoolWorker *poolWorker;
+	int runSlot;
+	shm_mq_handle *responseq;
+	bool bgwHasResult;
+	bool bgwFailed;
+	char bgwMessage[BGW_RETURN_MESSAGE_SIZE];
+	int64 rowsProcessed;
+	int64 rowsReported;
+	TimestampTz lastProgressTime;
+	CronExecutor executor;
+	/* set by cron.cancel_run() to stop the run */
+	bool cancelRequested;
+	/* the mode of the job when the run started, and when that was */
+	int runMode;
+	TimestampTz runStartTime;
+#ifdef LIBPQ_HAS_ASYNC_CANCEL
+	PGcancelConn *cancelConn;
+	/* whether the cancel connection waits to read or to write */
+	PostgresPollingStatusType cancelPollingStatus;
+#endif
+	/* the command, database and node of the run if not the ones of the job */
+	char *command;
+	char *database;
+	char *nodeName;
+	int nodePort;
+	/* the run of a fan-out job and the target that this run processes, or 0 */
+	int64 parentRunId;
+	char *target;
+} CronTaskRun;
 
-typedef struct CronFixedTask
+typedef struct CronTask
 {
-	int64 runId;
 	int64 jobId;
 	CronTaskState state;
 	uint pendingRunCount;
 	PGconn *connection;
-	PostgresPollingStatusType pollingStatus;
-	TimestampTz startDeadline;
-	bool isSocketReady;
 	bool isActive;
-	char *errorMessage;
-	bool freeErrorMessage;
-	dsm_segment *seg;
-	BackgroundWorkerHandle handle;
 	int mode;
 	int commandtype;
-} CronFixedTask;
+	/* what the last run was started with, allocated in TopMemoryContext */
+	char *commandKey;
+	bool isPrepared;
+	/* when the connection kept open after the last run became idle */
+	TimestampTz connectionIdleSince;
+	/* whether the connection is kept open, and its link in that list */
+	bool isConnectionKept;
+	dlist_node keptNode;
+	/* the run in progress, or the last one if the job went away meanwhile */
+	CronTaskRun run;
+	/* set for an additional run of the job, which holds no schedule state */
+	bool isRunInstance;
+	/* links the run instances of the job */
+	dlist_node runNode;
+	/* the state queue of the task and its link in that queue */
+	CronTaskQueue queue;
+	dlist_node queueNode;
+	/* the slot that shows the task in cron.running_jobs(), or -1 */
+	int sharedSlot;
+	/* restart backoff of a daemon job in ms, and when it may restart */
+	int daemonBackoff;
+	TimestampTz daemonRestartTime;
+	/* the targets that the last run of a fan-out job found and that still wait */
+	List *fanoutTargets;
+	int64 fanoutRunId;
+	/* the runs over the targets of that run that succeeded and failed */
+	int fanoutSucceeded;
+	int fanoutFailed;
+} CronTask;
 
 extern void InitializeTaskStateHash(void);
 extern void RefreshTaskHash(void);
 extern List * CurrentTaskList(void);
 extern void InitializeCronTask(CronTask *task, int64 jobId);
+extern void InitializeCronTaskRun(CronTaskRun *run);
 extern void RemoveTask(int64 jobId);
+extern CronTask * FindCronTask(int64 jobId);
+extern void EnqueueTask(CronTask *task);
+extern void RequeueTask(CronTask *task);
+extern void DequeueTask(CronTask *task);
+extern List * QueuedTaskList(CronTaskQueue queue);
+extern List * ActiveTaskList(void);
+extern void AddKeptConnection(CronTask *task, TimestampTz idleSince);
+extern void TakeKeptConnection(CronTask *task);
+extern void CloseKeptConnection(CronTask *task);
+extern CronTask * OldestKeptConnection(void);
+extern int KeptConnectionTotal(void);
 
-extern void InitializeFixedTaskStateHash(void);
-extern void RefreshFixedTaskHash(CronTask *task);
-extern List * CurrentFixedTaskList(void);
-extern void RemoveFixedTask(int64 runId);
+extern void InitializeRunInstanceHash(void);
+extern CronTask * StartRunInstance(CronTask *task);
+extern dlist_head * JobRunInstances(int64 jobId);
+extern int JobRunInstanceCount(int64 jobId);
+extern int RunInstanceCount(void);
+extern void RemoveRunInstance(CronTask *run);
+extern void AddRequestedRun(int64 jobId, int64 runId, char *userName);
+extern int64 TakeRequestedRunId(int64 jobId);
+extern void DropRequestedRuns(int64 jobId);
 
 #endif
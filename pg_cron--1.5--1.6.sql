@@ -0,0 +1,133 @@
+/* pg_cron--1.5--1.6.sql */
+ALTER TABLE cron.lt_job_ext ADD COLUMN profile text;
+ALTER TABLE cron.lt_job_ext ADD COLUMN executor text;
+ALTER TABLE cron.lt_job_ext ADD COLUMN max_concurrency int;
+
+CREATE OR REPLACE VIEW cron.lt_job AS
+select cron.job.jobid, cron.job.jobname, command, schedule, nodename, nodeport, database, cron.job.username, active,
+       mode, timezone, profile, coalesce(executor, 'auto') as executor, max_concurrency
+       from cron.job, cron.lt_job_ext where cron.job.jobid = cron.lt_job_ext.jobid and cron.job.active = true;
+
+CREATE FUNCTION cron.alter_job_profile(job_id bigint, profile text)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$cron_alter_job_profile$$;
+COMMENT ON FUNCTION cron.alter_job_profile(bigint,text)
+    IS 'set the execution profile of a pg_cron job';
+
+CREATE FUNCTION cron.alter_job_executor(job_id bigint, executor text)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$cron_alter_job_executor$$;
+COMMENT ON FUNCTION cron.alter_job_executor(bigint,text)
+    IS 'set how the runs of a pg_cron job are executed';
+
+CREATE FUNCTION cron.alter_job_max_concurrency(job_id bigint, max_concurrency int)
+    RETURNS void
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$cron_alter_job_max_concurrency$$;
+COMMENT ON FUNCTION cron.alter_job_max_concurrency(bigint,int)
+    IS 'set how many runs of a pg_cron job may be in progress at a time';
+
+CREATE FUNCTION cron.running_jobs(OUT jobid bigint, OUT runid bigint, OUT username text,
+                                  OUT state text, OUT queued_runs int, OUT run_instance boolean,
+                                  OUT pid int, OUT started_at timestamptz,
+                                  OUT start_deadline timestamptz)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$cron_running_jobs$$;
+COMMENT ON FUNCTION cron.running_jobs()
+    IS 'show the pg_cron jobs that are running or due to run';
+
+CREATE FUNCTION cron.run_job(job_id bigint)
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$cron_run_job$$;
+COMMENT ON FUNCTION cron.run_job(bigint)
+    IS 'start a run of a pg_cron job now and return its run ID';
+
+CREATE FUNCTION cron.job_trigger()
+    RETURNS trigger
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$cron_job_trigger$$;
+COMMENT ON FUNCTION cron.job_trigger()
+    IS 'run the pg_cron job given as trigger argument once the change commits';
+
+CREATE FUNCTION cron.cancel_run(run_id bigint)
+    RETURNS boolean
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$cron_cancel_run$$;
+COMMENT ON FUNCTION cron.cancel_run(bigint)
+    IS 'stop a run of a pg_cron job that is in progress';
+
+CREATE FUNCTION cron.wait_for_run(run_id bigint, timeout_ms int DEFAULT NULL,
+                                  OUT status text, OUT return_message text,
+                                  OUT duration interval)
+    RETURNS record
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$cron_wait_for_run$$;
+COMMENT ON FUNCTION cron.wait_for_run(bigint,int)
+    IS 'wait until a run of a pg_cron job ended and return its outcome';
+
+CREATE FUNCTION cron.schedule_queue_consumer(job_name name, schedule text,
+                                             queue_table regclass, handler regproc,
+                                             batch_size int DEFAULT 100,
+                                             max_consumers int DEFAULT 1)
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$cron_schedule_queue_consumer$$;
+COMMENT ON FUNCTION cron.schedule_queue_consumer(name,text,regclass,regproc,int,int)
+    IS 'schedule a pg_cron job that drains a queue table in batches';
+
+ALTER TABLE cron.lt_job_ext ADD COLUMN batch_target_ms int;
+ALTER TABLE cron.lt_job_ext ADD COLUMN batch_pause_ms int;
+
+CREATE FUNCTION cron.schedule_chunked(job_name name, schedule text, command text,
+                                      batch_target_ms int DEFAULT 500,
+                                      batch_pause_ms int DEFAULT 0)
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$cron_schedule_chunked$$;
+COMMENT ON FUNCTION cron.schedule_chunked(name,text,text,int,int)
+    IS 'schedule a pg_cron job that runs a DML command in batches until no rows are left';
+
+ALTER TABLE cron.lt_job_ext ADD COLUMN fanout_targets text;
+ALTER TABLE cron.job_run_details ADD COLUMN parent_runid bigint;
+
+CREATE FUNCTION cron.schedule_fanout(job_name name, schedule text, command text,
+                                     targets text, max_parallel int DEFAULT 4)
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$cron_schedule_fanout$$;
+COMMENT ON FUNCTION cron.schedule_fanout(name,text,text,text,int)
+    IS 'schedule a pg_cron job that runs a command for every row of a targets query';
+
+CREATE FUNCTION cron.schedule_partition_fanout(job_name name, schedule text, command text,
+                                               parent_table regclass,
+                                               max_parallel int DEFAULT 4)
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$cron_schedule_partition_fanout$$;
+COMMENT ON FUNCTION cron.schedule_partition_fanout(name,text,text,regclass,int)
+    IS 'schedule a pg_cron job that runs a command for every partition of a table';
+
+ALTER TABLE cron.lt_job_ext ADD COLUMN fanout_target text;
+
+CREATE FUNCTION cron.schedule_in_databases(job_name name, schedule text, command text,
+                                           database_pattern text DEFAULT '%',
+                                           max_parallel int DEFAULT 4)
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$cron_schedule_in_databases$$;
+COMMENT ON FUNCTION cron.schedule_in_databases(name,text,text,text,int)
+    IS 'schedule a pg_cron job that runs a command in every database matching a pattern';
+
+ALTER TABLE cron.job_run_details ADD COLUMN target text;
+
+CREATE FUNCTION cron.schedule_on_nodes(job_name name, schedule text, command text,
+                                       nodes text[], max_parallel int DEFAULT 4)
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$cron_schedule_on_nodes$$;
+COMMENT ON FUNCTION cron.schedule_on_nodes(name,text,text,text[],int)
+    IS 'schedule a pg_cron job that runs a command on every node of a list';
@@ -1,6 +1,6 @@
 CREATE EXTENSION pg_cron VERSION '1.0';
 SELECT extversion FROM pg_extension WHERE extname='pg_cron';
-ALTER EXTENSION pg_cron UPDATE TO '1.5';
+ALTER EXTENSION pg_cron UPDATE TO '1.6';
 SELECT extversion FROM pg_extension WHERE extname='pg_cron';
 
 -- Vacuum every day at 10:00am (GMT)
@@ -94,6 +94,144 @@ SELECT cron.schedule('test3', '* * * * * *', 'select3', 'single', '8', 'sql');
 SELECT cron.schedule('test4', '* * * * * *', 'select4', 'fixed', '8', 'sql');
 SELECT cron.schedule('test5', '* * * * * *', 'echo12345', 'next', '8', 'linux');
 SELECT jobid, jobname, schedule, command FROM cron.job ORDER BY jobid;
+
+-- Look up the jobs used below by name
+SELECT jobid AS test1_jobid FROM cron.job WHERE jobname = 'test1' \gset
+SELECT jobid AS test2_jobid FROM cron.job WHERE jobname = 'test2' \gset
+
+-- A role that does not own the jobs and is no superuser
+CREATE ROLE cron_test_user;
+GRANT USAGE ON SCHEMA cron TO cron_test_user;
+
+-- Give a job an execution profile
+SELECT cron.alter_job_profile(:test1_jobid, 'work_mem=64MB, statement_timeout=5min, memory_limit=1GB');
+SELECT jobname, profile FROM cron.lt_job WHERE jobid = :test1_jobid;
+SELECT cron.alter_job_profile(:test1_jobid, 'shared_buffers=1GB');
+SELECT cron.alter_job_profile(:test1_jobid, 'memory_limit=0');
+
+-- job IDs start at 1, so there is no job 0
+SELECT cron.alter_job_profile(0, 'work_mem=64MB');
+
+-- Remove the profile again
+SELECT cron.alter_job_profile(:test1_jobid, '');
+SELECT jobname, profile FROM cron.lt_job WHERE jobid = :test1_jobid;
+
+-- Always run a job over libpq
+SELECT cron.alter_job_executor(:test2_jobid, 'libpq');
+SELECT jobname, executor FROM cron.lt_job WHERE jobid IN (:test1_jobid, :test2_jobid) ORDER BY jobid;
+SELECT cron.alter_job_executor(:test2_jobid, 'thread');
+SET ROLE cron_test_user;
+SELECT cron.alter_job_executor(:test2_jobid, 'bgworker');
+RESET ROLE;
+
+-- Let runs of a job overlap
+SELECT cron.alter_job_max_concurrency(:test1_jobid, 3);
+SELECT jobname, max_concurrency FROM cron.lt_job WHERE jobid = :test1_jobid;
+SELECT cron.alter_job_max_concurrency(:test1_jobid, 0);
+SELECT cron.alter_job_max_concurrency(:test1_jobid, NULL);
+SELECT jobname, max_concurrency IS NULL AS default_concurrency FROM cron.lt_job WHERE jobid = :test1_jobid;
+
+-- no such job is running
+SELECT jobid, state FROM cron.running_jobs() WHERE jobid = 0;
+
+-- cannot run a job that does not exist
+SELECT cron.run_job(0);
+
+-- there is no run to cancel
+SELECT cron.cancel_run(0);
+
+-- waiting for a run that does not exist times out
+SELECT * FROM cron.wait_for_run(0, 10);
+
+-- a trigger cannot run a job that does not exist
+CREATE TABLE job_trigger_test (a int);
+CREATE TRIGGER job_trigger_test AFTER INSERT ON job_trigger_test
+    FOR EACH STATEMENT EXECUTE PROCEDURE cron.job_trigger(0);
+INSERT INTO job_trigger_test VALUES (1);
+DROP TABLE job_trigger_test;
+
+-- run a job right away and wait for the run to end
+CREATE TABLE run_test (id int);
+SELECT cron.schedule('run-test', '0 0 1 1 *', 'INSERT INTO run_test VALUES (1)') AS run_test_jobid \gset
+SELECT cron.alter_job_executor(:run_test_jobid, 'bgworker');
+SELECT cron.run_job(:run_test_jobid) AS run_test_runid \gset
+SELECT status FROM cron.wait_for_run(:run_test_runid, 30000);
+
+-- a run that ended is neither in progress nor can it be canceled
+SELECT count(*) FROM cron.running_jobs() WHERE runid = :run_test_runid;
+SELECT cron.cancel_run(:run_test_runid);
+
+-- run it twice in the worker pool, where the second run reuses the worker
+SELECT cron.alter_job_executor(:run_test_jobid, 'pool');
+SELECT cron.run_job(:run_test_jobid) AS run_test_runid \gset
+SELECT status FROM cron.wait_for_run(:run_test_runid, 30000);
+SELECT cron.run_job(:run_test_jobid) AS run_test_runid \gset
+SELECT status FROM cron.wait_for_run(:run_test_runid, 30000);
+SELECT count(*) FROM run_test;
+SELECT cron.unschedule('run-test');
+DROP TABLE run_test;
+
+-- daemon jobs only run sql commands
+SELECT cron.schedule('daemon-test', '* * * * * *', 'echo 1', 'daemon', '8', 'linux');
+
+-- consumer and fan-out jobs have schedule functions of their own
+SELECT cron.schedule('consumer-test', '* * * * * *', 'SELECT 1', 'consumer');
+SELECT cron.schedule('fanout-test', '0 4 * * *', 'VACUUM {target}', 'fanout', '8', 'sql');
+
+-- only superusers can schedule jobs that run in background workers
+SET ROLE cron_test_user;
+SELECT cron.schedule('daemon-test', '* * * * * *', 'SELECT 1', 'daemon');
+SELECT cron.schedule_chunked('chunked-test', '0 3 * * *', 'DELETE FROM chunked_test WHERE ctid IN (SELECT ctid FROM chunked_test LIMIT {batch_size})');
+RESET ROLE;
+
+-- drain a queue table with consumer jobs
+CREATE TABLE consumer_queue (id bigint);
+CREATE FUNCTION consume_items(items consumer_queue[]) RETURNS void LANGUAGE sql AS 'SELECT 1';
+SELECT cron.schedule_queue_consumer('consumer-test', '* * * * * *', 'consumer_queue', 'consume_items', 0);
+SELECT cron.schedule_queue_consumer('consumer-test', '* * * * * *', 'consumer_queue', 'consume_items', 10, 2) > 0 AS scheduled;
+SELECT mode, max_concurrency FROM cron.lt_job WHERE jobname = 'consumer-test';
+SELECT cron.unschedule('consumer-test');
+DROP FUNCTION consume_items(consumer_queue[]);
+DROP TABLE consumer_queue;
+
+-- purge a table in batches
+CREATE TABLE chunked_test AS SELECT generate_series(1, 1000) AS id;
+SELECT cron.schedule_chunked('chunked-test', '0 3 * * *', 'DELETE FROM chunked_test');
+SELECT cron.schedule_chunked('chunked-test', '0 3 * * *', 'DELETE FROM chunked_test WHERE ctid IN (SELECT ctid FROM chunked_test LIMIT {batch_size})', 200, 50) > 0 AS scheduled;
+SELECT mode FROM cron.lt_job WHERE jobname = 'chunked-test';
+SELECT cron.run_job(jobid) AS chunked_test_runid FROM cron.job WHERE jobname = 'chunked-test' \gset
+SELECT status FROM cron.wait_for_run(:chunked_test_runid, 30000);
+SELECT count(*) FROM chunked_test;
+SELECT cron.unschedule('chunked-test');
+DROP TABLE chunked_test;
+
+-- run a command for every partition of a table
+CREATE TABLE fanout_test (id int);
+SELECT cron.schedule_partition_fanout('fanout-test', '0 4 * * *', 'VACUUM fanout_test', 'fanout_test');
+SELECT cron.schedule_fanout('fanout-test', '0 4 * * *', 'VACUUM {target}', 'SELECT 1', 0);
+SELECT cron.schedule_partition_fanout('fanout-test', '0 4 * * *', 'VACUUM {target}', 'fanout_test', 2) > 0 AS scheduled;
+SELECT mode, max_concurrency FROM cron.lt_job WHERE jobname = 'fanout-test';
+SELECT cron.unschedule('fanout-test');
+DROP TABLE fanout_test;
+
+-- run a command in every database
+SELECT cron.schedule_in_databases('databases-test', '0 2 * * *', 'VACUUM ANALYZE', '%', 17);
+SELECT cron.schedule_in_databases('databases-test', '0 2 * * *', 'VACUUM ANALYZE') > 0 AS scheduled;
+SELECT mode, max_concurrency FROM cron.lt_job WHERE jobname = 'databases-test';
+SELECT cron.unschedule('databases-test');
+
+-- run a command on several nodes
+SET ROLE cron_test_user;
+SELECT cron.schedule_on_nodes('nodes-test', '0 2 * * *', 'SELECT 1', ARRAY['10.0.0.1:5432']);
+RESET ROLE;
+SELECT cron.schedule_on_nodes('nodes-test', '0 2 * * *', 'SELECT 1', ARRAY['localhost:0']);
+SELECT cron.schedule_on_nodes('nodes-test', '0 2 * * *', 'SELECT 1', ARRAY['localhost', 'localhost:5433'], 2) > 0 AS scheduled;
+SELECT mode, max_concurrency FROM cron.lt_job WHERE jobname = 'nodes-test';
+SELECT cron.unschedule('nodes-test');
+
+REVOKE USAGE ON SCHEMA cron FROM cron_test_user;
+DROP ROLE cron_test_user;
+
 SELECT pg_sleep(3);
 
 DROP EXTENSION pg_cron;
@@ -17,6 +17,8 @@
 #include "pg_cron.h"
 #include "job_metadata.h"
 #include "cron_job.h"
+#include "lt_job_profile.h"
+#include "lt_shared_state.h"
 
 #include "access/genam.h"
 #include "access/hash.h"
@@ -31,10 +33,14 @@
 #include "commands/extension.h"
 #include "commands/sequence.h"
 #include "commands/trigger.h"
+#include "funcapi.h"
 #include "postmaster/postmaster.h"
 #include "pgstat.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
 #include "storage/lock.h"
 #include "utils/acl.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
 #include "utils/inval.h"
@@ -44,6 +50,7 @@
 #include "utils/relcache.h"
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
 #if (PG_VERSION_NUM >= 100000)
 #include "utils/varlena.h"
 #endif
@@ -75,6 +82,11 @@ static void InvalidateJobCacheCallback(Datum argument, Oid relationId);
 static void InvalidateJobCache(void);
 static Oid CronJobRelationId(void);
 static bool is_number(char *arg);
+static bool ModeRunsInOwnWorker(char *mode);
+static void EnsureGenericScheduleMode(char *mode);
+static int64 DrawRunId(void);
+static bool ReadRunResult(int64 runId, Datum *values, bool *isNulls);
+static void ReleaseRunWaiterCallback(int code, Datum arg);
 
 static CronJob * TupleToCronJob(TupleDesc tupleDescriptor, HeapTuple heapTuple);
 static bool PgCronHasBeenLoaded(void);
@@ -83,6 +95,12 @@ static bool JobRunDetailsTableExists(void);
 static bool JobLtExtTableExists(void);
 static void insertCronExt(int64 jobid, char *jobname, char *mode, char *tmzone, char *cmdtype);
 static void deleteCronExt(int64 jobid, char *jobname);
+static void LoadCronJobOptions(void);
+static void UpdateCronExtColumn(int64 jobId, char *columnName, Oid columnType,
+								char *value);
+static int64 ScheduleFanoutJob(Name jobName, char *schedule, char *command,
+							   char *targets, char *fanoutTarget,
+							   int32 maxParallel);
 
 /* SQL-callable functions */
 PG_FUNCTION_INFO_V1(cron_schedule);
@@ -93,6 +111,18 @@ PG_FUNCTION_INFO_V1(cron_job_cache_invalidate);
 PG_FUNCTION_INFO_V1(cron_schedule_named_mode);
 PG_FUNCTION_INFO_V1(cron_schedule_named_mode_zone);
 PG_FUNCTION_INFO_V1(cron_schedule_named_mode_zone_cmdtype);
+PG_FUNCTION_INFO_V1(cron_schedule_queue_consumer);
+PG_FUNCTION_INFO_V1(cron_schedule_chunked);
+PG_FUNCTION_INFO_V1(cron_schedule_fanout);
+PG_FUNCTION_INFO_V1(cron_schedule_partition_fanout);
+PG_FUNCTION_INFO_V1(cron_schedule_in_databases);
+PG_FUNCTION_INFO_V1(cron_schedule_on_nodes);
+PG_FUNCTION_INFO_V1(cron_alter_job_profile);
+PG_FUNCTION_INFO_V1(cron_alter_job_executor);
+PG_FUNCTION_INFO_V1(cron_alter_job_max_concurrency);
+PG_FUNCTION_INFO_V1(cron_run_job);
+PG_FUNCTION_INFO_V1(cron_cancel_run);
+PG_FUNCTION_INFO_V1(cron_wait_for_run);
 
 
 /* global variables */
@@ -227,55 +257,976 @@ cron_schedule_named_mode(PG_FUNCTION_ARGS)
 	char *command = text_to_cstring(commandText);
 	char *mode = text_to_cstring(modeText);
 
-	int64 jobId = ScheduleCronJob(jobName, schedule, command, mode, DEFAULT_TIME_ZONE, COMMAND_SQL);
+	int64 jobId = 0;
+
+	EnsureGenericScheduleMode(mode);
+
+	jobId = ScheduleCronJob(jobName, schedule, command, mode, DEFAULT_TIME_ZONE, COMMAND_SQL);
+
+	PG_RETURN_INT64(jobId);
+}
+
+/*
+ * cron_schedule_named_mode_zone schedules a zone cron job
+ */
+Datum
+cron_schedule_named_mode_zone(PG_FUNCTION_ARGS)
+{
+	Name jobName = PG_GETARG_NAME(0);
+	text *scheduleText = PG_GETARG_TEXT_P(1);
+	text *commandText = PG_GETARG_TEXT_P(2);
+	text *modeText = PG_GETARG_TEXT_P(3);
+	text *zoneText = PG_GETARG_TEXT_P(4);
+
+	char *schedule = text_to_cstring(scheduleText);
+	char *command = text_to_cstring(commandText);
+	char *mode = text_to_cstring(modeText);
+	char *tmzone = text_to_cstring(zoneText);
+
+	int64 jobId = 0;
+
+	EnsureGenericScheduleMode(mode);
+
+	jobId = ScheduleCronJob(jobName, schedule, command, mode, tmzone, COMMAND_SQL);
+
+	PG_RETURN_INT64(jobId);
+}
+
+/*
+ * cron_schedule_named_mode_zone schedules a commandtype cron job
+ */
+Datum
+cron_schedule_named_mode_zone_cmdtype(PG_FUNCTION_ARGS)
+{
+	Name jobName = PG_GETARG_NAME(0);
+	text *scheduleText = PG_GETARG_TEXT_P(1);
+	text *commandText = PG_GETARG_TEXT_P(2);
+	text *modeText = PG_GETARG_TEXT_P(3);
+	text *zoneText = PG_GETARG_TEXT_P(4);
+	text *cmdtypeText = PG_GETARG_TEXT_P(5);
+
+	char *schedule = text_to_cstring(scheduleText);
+	char *command = text_to_cstring(commandText);
+	char *mode = text_to_cstring(modeText);
+	char *tmzone = text_to_cstring(zoneText);
+	char *cmdtype = text_to_cstring(cmdtypeText);
+
+	int64 jobId = 0;
+
+	EnsureGenericScheduleMode(mode);
+
+	jobId = ScheduleCronJob(jobName, schedule, command, mode, tmzone, cmdtype);
+
+	PG_RETURN_INT64(jobId);
+}
+
+/*
+ * cron_schedule_queue_consumer schedules a consumer job that drains a queue
+ * table. Each iteration of a run deletes a batch of rows, skipping the ones
+ * that other consumers locked, and passes them to the handler as an array.
+ * The schedule wakes up one consumer while none is running, and runs that
+ * find a full batch ask for another consumer, up to max_consumers.
+ */
+Datum
+cron_schedule_queue_consumer(PG_FUNCTION_ARGS)
+{
+	Name jobName = PG_GETARG_NAME(0);
+	text *scheduleText = PG_GETARG_TEXT_P(1);
+	Oid queueTableId = PG_GETARG_OID(2);
+	Oid handlerId = PG_GETARG_OID(3);
+	int32 batchSize = PG_GETARG_INT32(4);
+	int32 maxConsumers = PG_GETARG_INT32(5);
+
+	char *schedule = text_to_cstring(scheduleText);
+	char *queueTableName = NULL;
+	char *handlerName = NULL;
+	char *namespaceName = NULL;
+	char maxConsumersString[12];
+	StringInfoData command;
+	int64 jobId = 0;
+
+	if (batchSize < 1)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("invalid batch_size: %d, it must be at least 1", batchSize)));
+	}
+
+	if (maxConsumers < 1 || maxConsumers > MAX_JOB_CONCURRENCY)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("invalid max_consumers: %d, the range is 1 to %d",
+							   maxConsumers, MAX_JOB_CONCURRENCY)));
+	}
+
+	if (get_rel_relkind(queueTableId) != RELKIND_RELATION)
+	{
+		ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+						errmsg("queue \"%s\" is not a table", get_rel_name(queueTableId))));
+	}
+
+	namespaceName = get_namespace_name(get_rel_namespace(queueTableId));
+	queueTableName = quote_qualified_identifier(namespaceName, get_rel_name(queueTableId));
+
+	namespaceName = get_namespace_name(get_func_namespace(handlerId));
+	handlerName = quote_qualified_identifier(namespaceName, get_func_name(handlerId));
+
+	/*
+	 * The consumer worker reads the number of rows in the batch and whether
+	 * the batch was full from the first two columns of the result.
+	 */
+	initStringInfo(&command);
+	appendStringInfo(&command,
+		"WITH batch AS (DELETE FROM %s AS queue WHERE ctid IN "
+		"(SELECT ctid FROM %s LIMIT %d FOR UPDATE SKIP LOCKED) RETURNING queue AS item) "
+		"SELECT b.consumed, b.consumed >= %d AS more, "
+		"CASE WHEN b.consumed > 0 THEN %s(b.items) END "
+		"FROM (SELECT count(*) AS consumed, array_agg(item) AS items FROM batch) b",
+		queueTableName, queueTableName, batchSize, batchSize, handlerName);
+
+	jobId = ScheduleCronJob(jobName, schedule, command.data, MODE_CONSUMER,
+							DEFAULT_TIME_ZONE, COMMAND_SQL);
+
+	snprintf(maxConsumersString, sizeof(maxConsumersString), "%d", maxConsumers);
+	UpdateCronExtColumn(jobId, "max_concurrency", INT4OID, maxConsumersString);
+
+	PG_RETURN_INT64(jobId);
+}
+
+/*
+ * cron_schedule_chunked schedules a chunked job, which executes a DML command
+ * in batches of {batch_size} rows, each in a transaction of its own, until a
+ * batch affects no rows. The batch size adapts so that a batch takes about
+ * batch_target_ms, and runs pause for batch_pause_ms between batches.
+ */
+Datum
+cron_schedule_chunked(PG_FUNCTION_ARGS)
+{
+	Name jobName = PG_GETARG_NAME(0);
+	text *scheduleText = PG_GETARG_TEXT_P(1);
+	text *commandText = PG_GETARG_TEXT_P(2);
+	int32 batchTargetTime = PG_GETARG_INT32(3);
+	int32 batchPause = PG_GETARG_INT32(4);
+
+	char *schedule = text_to_cstring(scheduleText);
+	char *command = text_to_cstring(commandText);
+	char batchTargetTimeString[12];
+	char batchPauseString[12];
+	int64 jobId = 0;
+
+	if (batchTargetTime < 1)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("invalid batch_target_ms: %d, it must be at least 1",
+							   batchTargetTime)));
+	}
+
+	if (batchPause < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("invalid batch_pause_ms: %d, it must not be negative",
+							   batchPause)));
+	}
+
+	jobId = ScheduleCronJob(jobName, schedule, command, MODE_CHUNKED,
+							DEFAULT_TIME_ZONE, COMMAND_SQL);
+
+	snprintf(batchTargetTimeString, sizeof(batchTargetTimeString), "%d", batchTargetTime);
+	UpdateCronExtColumn(jobId, "batch_target_ms", INT4OID, batchTargetTimeString);
+
+	snprintf(batchPauseString, sizeof(batchPauseString), "%d", batchPause);
+	UpdateCronExtColumn(jobId, "batch_pause_ms", INT4OID, batchPauseString);
+
+	PG_RETURN_INT64(jobId);
+}
+
+/*
+ * cron_schedule_fanout schedules a fan-out job. Each run executes the targets
+ * query, which returns one target per row in its first column, and then runs
+ * the command once for every target, with {target} replaced by the target,
+ * at most max_parallel at a time.
+ */
+Datum
+cron_schedule_fanout(PG_FUNCTION_ARGS)
+{
+	Name jobName = PG_GETARG_NAME(0);
+	text *scheduleText = PG_GETARG_TEXT_P(1);
+	text *commandText = PG_GETARG_TEXT_P(2);
+	text *targetsText = PG_GETARG_TEXT_P(3);
+	int32 maxParallel = PG_GETARG_INT32(4);
+
+	char *schedule = text_to_cstring(scheduleText);
+	char *command = text_to_cstring(commandText);
+	char *targets = text_to_cstring(targetsText);
+
+	int64 jobId = ScheduleFanoutJob(jobName, schedule, command, targets, NULL,
+									maxParallel);
+
+	PG_RETURN_INT64(jobId);
+}
+
+/*
+ * cron_schedule_partition_fanout schedules a fan-out job over the leaf
+ * partitions of a table, or over the table itself if it has none. The
+ * partitions are looked up at the start of each run, so partitions that were
+ * added or dropped since the job was scheduled are taken into account.
+ */
+Datum
+cron_schedule_partition_fanout(PG_FUNCTION_ARGS)
+{
+	Name jobName = PG_GETARG_NAME(0);
+	text *scheduleText = PG_GETARG_TEXT_P(1);
+	text *commandText = PG_GETARG_TEXT_P(2);
+	Oid parentTableId = PG_GETARG_OID(3);
+	int32 maxParallel = PG_GETARG_INT32(4);
+
+	char *schedule = text_to_cstring(scheduleText);
+	char *command = text_to_cstring(commandText);
+	StringInfoData targets;
+	int64 jobId = 0;
+
+	if (get_rel_name(parentTableId) == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_TABLE),
+						errmsg("relation with OID %u does not exist", parentTableId)));
+	}
+
+	/* the targets are the quoted names of the leaves of the inheritance tree */
+	initStringInfo(&targets);
+	appendStringInfo(&targets,
+		"WITH RECURSIVE tree(relid) AS (SELECT %u::pg_catalog.oid "
+		"UNION ALL SELECT i.inhrelid FROM pg_catalog.pg_inherits i "
+		"JOIN tree t ON i.inhparent = t.relid) "
+		"SELECT tree.relid::pg_catalog.regclass::text FROM tree "
+		"WHERE NOT EXISTS (SELECT 1 FROM pg_catalog.pg_inherits i "
+		"WHERE i.inhparent = tree.relid) ORDER BY 1",
+		parentTableId);
+
+	jobId = ScheduleFanoutJob(jobName, schedule, command, targets.data, NULL,
+							  maxParallel);
+
+	PG_RETURN_INT64(jobId);
+}
+
+/*
+ * cron_schedule_in_databases schedules a fan-out job that runs the command in
+ * every database whose name matches the LIKE pattern, except templates and
+ * databases that do not allow connections. The databases are looked up at
+ * the start of each run, and each database gets a run of its own.
+ */
+Datum
+cron_schedule_in_databases(PG_FUNCTION_ARGS)
+{
+	Name jobName = PG_GETARG_NAME(0);
+	text *scheduleText = PG_GETARG_TEXT_P(1);
+	text *commandText = PG_GETARG_TEXT_P(2);
+	text *patternText = PG_GETARG_TEXT_P(3);
+	int32 maxParallel = PG_GETARG_INT32(4);
+
+	char *schedule = text_to_cstring(scheduleText);
+	char *command = text_to_cstring(commandText);
+	char *pattern = text_to_cstring(patternText);
+	StringInfoData targets;
+	int64 jobId = 0;
+
+	initStringInfo(&targets);
+	appendStringInfo(&targets,
+		"SELECT datname FROM pg_catalog.pg_database "
+		"WHERE datallowconn AND NOT datistemplate AND datname LIKE %s ORDER BY 1",
+		quote_literal_cstr(pattern));
+
+	jobId = ScheduleFanoutJob(jobName, schedule, command, targets.data,
+							  FANOUT_TARGET_DATABASE, maxParallel);
+
+	PG_RETURN_INT64(jobId);
+}
+
+/*
+ * cron_schedule_on_nodes schedules a fan-out job that runs the command on
+ * every node in the given list, each given as host or host:port. Nodes
+ * without a port use the port of the job. Each node gets a run of its own,
+ * which other nodes run over libpq. Only superusers can schedule such jobs.
+ */
+Datum
+cron_schedule_on_nodes(PG_FUNCTION_ARGS)
+{
+	Name jobName = PG_GETARG_NAME(0);
+	text *scheduleText = PG_GETARG_TEXT_P(1);
+	text *commandText = PG_GETARG_TEXT_P(2);
+	ArrayType *nodeArray = PG_GETARG_ARRAYTYPE_P(3);
+	int32 maxParallel = PG_GETARG_INT32(4);
+
+	char *schedule = text_to_cstring(scheduleText);
+	char *command = text_to_cstring(commandText);
+	Datum *nodeDatums = NULL;
+	bool *nodeNulls = NULL;
+	int nodeCount = 0;
+	int nodeIndex = 0;
+	StringInfoData targets;
+	int64 jobId = 0;
+
+	/* connections to arbitrary hosts would be made with the launcher's identity */
+	if (!superuser())
+	{
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("must be superuser to schedule jobs on nodes")));
+	}
+
+	deconstruct_array(nodeArray, TEXTOID, -1, false, 'i',
+					  &nodeDatums, &nodeNulls, &nodeCount);
+
+	if (nodeCount == 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("a job needs at least one node to run on")));
+	}
+
+	/* the targets query returns the nodes in the order in which they were given */
+	initStringInfo(&targets);
+	appendStringInfoString(&targets, "SELECT pg_catalog.unnest(ARRAY[");
+
+	for (nodeIndex = 0; nodeIndex < nodeCount; nodeIndex++)
+	{
+		char *node = NULL;
+		char *nodeName = NULL;
+		int nodePort = 0;
+
+		if (nodeNulls[nodeIndex])
+		{
+			ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+							errmsg("nodes must not be NULL")));
+		}
+
+		node = TextDatumGetCString(nodeDatums[nodeIndex]);
+		if (!ParseNodeTarget(node, &nodeName, &nodePort))
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("invalid node: \"%s\", a node is given as host or "
+								   "host:port", node)));
+		}
+
+		appendStringInfo(&targets, "%s%s", nodeIndex > 0 ? ", " : "",
+						 quote_literal_cstr(node));
+	}
+
+	appendStringInfoString(&targets, "]::text[])");
+
+	jobId = ScheduleFanoutJob(jobName, schedule, command, targets.data,
+							  FANOUT_TARGET_NODE, maxParallel);
+
+	PG_RETURN_INT64(jobId);
+}
+
+/*
+ * ParseNodeTarget splits a node of a fan-out job, given as host or
+ * host:port. The port is left as it is if the node has none. Returns false if
+ * the host is empty or the port is not a number from 1 to 65535.
+ */
+bool
+ParseNodeTarget(const char *node, char **nodeName, int *nodePort)
+{
+	const char *colon = strrchr(node, ':');
+	char *portEnd = NULL;
+	long port = 0;
+
+	if (colon == NULL)
+	{
+		if (node[0] == '\0')
+			return false;
+
+		*nodeName = pstrdup(node);
+		return true;
+	}
+
+	port = strtol(colon + 1, &portEnd, 10);
+	if (colon == node || colon[1] == '\0' || *portEnd != '\0' ||
+		port < 1 || port > 65535)
+	{
+		return false;
+	}
+
+	*nodeName = pnstrdup(node, colon - node);
+	*nodePort = (int) port;
+
+	return true;
+}
+
+/*
+ * ScheduleFanoutJob schedules a fan-out job with the given targets query and
+ * number of targets that are processed at a time. The targets are substituted
+ * into the command, or they are the databases or nodes that the command runs
+ * on, as given by fanoutTarget.
+ */
+static int64
+ScheduleFanoutJob(Name jobName, char *schedule, char *command, char *targets,
+				  char *fanoutTarget, int32 maxParallel)
+{
+	char maxParallelString[12];
+	int64 jobId = 0;
+
+	if (fanoutTarget == NULL && strstr(command, FANOUT_TARGET_PLACEHOLDER) == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("the command of a fan-out job must contain %s",
+							   FANOUT_TARGET_PLACEHOLDER)));
+	}
+
+	if (maxParallel < 1 || maxParallel > MAX_JOB_CONCURRENCY)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("invalid max_parallel: %d, the range is 1 to %d",
+							   maxParallel, MAX_JOB_CONCURRENCY)));
+	}
+
+	jobId = ScheduleCronJob(jobName, schedule, command, MODE_FANOUT,
+							DEFAULT_TIME_ZONE, COMMAND_SQL);
+
+	UpdateCronExtColumn(jobId, "fanout_targets", TEXTOID, targets);
+	UpdateCronExtColumn(jobId, "fanout_target", TEXTOID, fanoutTarget);
+
+	/* the targets of a run are processed by the run instances of the job */
+	snprintf(maxParallelString, sizeof(maxParallelString), "%d", maxParallel);
+	UpdateCronExtColumn(jobId, "max_concurrency", INT4OID, maxParallelString);
+
+	return jobId;
+}
+
+/*
+ * cron_alter_job_profile sets the execution profile of a job owned by the
+ * current user. An empty profile removes the profile of the job.
+ */
+Datum
+cron_alter_job_profile(PG_FUNCTION_ARGS)
+{
+	int64 jobId = PG_GETARG_INT64(0);
+	text *profileText = PG_GETARG_TEXT_P(1);
+	char *profile = text_to_cstring(profileText);
+
+	ValidateJobProfile(profile);
+
+	UpdateCronExtColumn(jobId, "profile", TEXTOID, profile[0] != '\0' ? profile : NULL);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * cron_alter_job_executor sets how the runs of a job owned by the current
+ * user are executed. Only superusers can move runs into background workers.
+ */
+Datum
+cron_alter_job_executor(PG_FUNCTION_ARGS)
+{
+	int64 jobId = PG_GETARG_INT64(0);
+	text *executorText = PG_GETARG_TEXT_P(1);
+	char *executor = text_to_cstring(executorText);
+
+	if (strcmp(EXECUTOR_AUTO, executor) && strcmp(EXECUTOR_BGWORKER, executor) &&
+		strcmp(EXECUTOR_POOL, executor) && strcmp(EXECUTOR_LIBPQ, executor))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("invalid executor: %s, the range is 'auto', 'bgworker', 'pool' or 'libpq'", executor)));
+	}
+
+	/* runs in a worker of the server itself take its resources */
+	if ((!strcmp(EXECUTOR_BGWORKER, executor) || !strcmp(EXECUTOR_POOL, executor)) &&
+		!superuser())
+	{
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("must be superuser to run jobs in background workers")));
+	}
+
+	UpdateCronExtColumn(jobId, "executor", TEXTOID, executor);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * cron_alter_job_max_concurrency sets how many runs of a job owned by the
+ * current user may be in progress at the same time. NULL restores the default
+ * of the mode of the job.
+ */
+Datum
+cron_alter_job_max_concurrency(PG_FUNCTION_ARGS)
+{
+	int64 jobId = 0;
+	char maxConcurrencyString[12];
+	char *value = NULL;
+
+	if (PG_ARGISNULL(0))
+	{
+		ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						errmsg("job_id can not be NULL")));
+	}
+
+	jobId = PG_GETARG_INT64(0);
+
+	if (!PG_ARGISNULL(1))
+	{
+		int32 maxConcurrency = PG_GETARG_INT32(1);
+
+		if (maxConcurrency < 1 || maxConcurrency > MAX_JOB_CONCURRENCY)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("invalid max_concurrency: %d, the range is 1 to %d",
+								   maxConcurrency, MAX_JOB_CONCURRENCY)));
+		}
+
+		snprintf(maxConcurrencyString, sizeof(maxConcurrencyString), "%d",
+				 maxConcurrency);
+		value = maxConcurrencyString;
+	}
+
+	UpdateCronExtColumn(jobId, "max_concurrency", INT4OID, value);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * cron_run_job asks the scheduler to start a run of a job owned by the current
+ * user right away and returns the run ID of that run. The run is subject to
+ * the concurrency of the job like any other run. The request is not undone
+ * if the calling transaction aborts.
+ */
+Datum
+cron_run_job(PG_FUNCTION_ARGS)
+{
+	int64 jobId = PG_GETARG_INT64(0);
+	int64 runId = 0;
+
+	if (!EnsureRunPermission(jobId, GetUserId()))
+	{
+		ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						errmsg("job " INT64_FORMAT " is not active", jobId)));
+	}
+
+	runId = DrawRunId();
+
+	if (!PushRunRequest(jobId, runId))
+	{
+		ereport(ERROR, (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+						errmsg("too many cron.run_job() requests are waiting for "
+							   "the scheduler")));
+	}
+
+	PG_RETURN_INT64(runId);
+}
+
+
+/*
+ * cron_cancel_run asks the scheduler to stop a run that is in progress, of a
+ * job owned by the current user, and returns whether the run was found. The
+ * run ends as failed with "run canceled", and the job stays scheduled.
+ */
+Datum
+cron_cancel_run(PG_FUNCTION_ARGS)
+{
+	int64 runId = PG_GETARG_INT64(0);
+	int64 jobId = 0;
+
+	EnsureSharedStateLoaded();
+
+	jobId = RunInProgressJobId(runId);
+	if (jobId == 0)
+	{
+		PG_RETURN_BOOL(false);
+	}
+
+	(void) EnsureRunPermission(jobId, GetUserId());
+
+	if (!PushCancelRequest(jobId, runId))
+	{
+		ereport(ERROR, (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+						errmsg("too many cron.cancel_run() requests are waiting for "
+							   "the scheduler")));
+	}
+
+	PG_RETURN_BOOL(true);
+}
+
+
+/*
+ * cron_wait_for_run waits until a run ended or the timeout in milliseconds
+ * passed, and returns the status, message and duration of the run as they
+ * are in cron.job_run_details. The launcher sets the latch of the session
+ * when the run ends, so cron.job_run_details is only read before and after
+ * waiting. A NULL timeout waits as long as it takes.
+ */
+Datum
+cron_wait_for_run(PG_FUNCTION_ARGS)
+{
+	int64 runId = 0;
+	int timeoutMs = -1;
+	TimestampTz deadline = 0;
+	int waiterIndex = -1;
+	bool isFinished = false;
+	TupleDesc tupleDescriptor = NULL;
+	Datum values[3];
+	bool isNulls[3];
+	HeapTuple resultTuple = NULL;
+
+	if (PG_ARGISNULL(0))
+	{
+		ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						errmsg("run_id can not be NULL")));
+	}
+
+	runId = PG_GETARG_INT64(0);
+
+	if (!PG_ARGISNULL(1))
+	{
+		timeoutMs = PG_GETARG_INT32(1);
+
+		if (timeoutMs < 0)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("invalid timeout_ms: %d, the timeout cannot be "
+								   "negative", timeoutMs)));
+		}
+
+		deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), timeoutMs);
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	tupleDescriptor = BlessTupleDesc(tupleDescriptor);
+
+	waiterIndex = RegisterRunWaiter(runId);
+
+	PG_ENSURE_ERROR_CLEANUP(ReleaseRunWaiterCallback, Int32GetDatum(waiterIndex));
+	{
+		/* the run may have ended before the waiter was registered */
+		isFinished = ReadRunResult(runId, values, isNulls);
+
+		while (!isFinished && !RunWaiterIsWoken(waiterIndex))
+		{
+			int waitFlags = WL_LATCH_SET | WL_POSTMASTER_DEATH;
+			long waitMs = -1;
+			int rc = 0;
+
+			if (timeoutMs >= 0)
+			{
+				TimestampTz currentTime = GetCurrentTimestamp();
+
+				if (currentTime >= deadline)
+				{
+					break;
+				}
+
+				waitMs = (long) ((deadline - currentTime + 999) / 1000);
+				waitFlags |= WL_TIMEOUT;
+			}
+
+#if (PG_VERSION_NUM >= 100000)
+			rc = WaitLatch(MyLatch, waitFlags, waitMs, PG_WAIT_EXTENSION);
+#else
+			rc = WaitLatch(MyLatch, waitFlags, waitMs);
+#endif
+
+			ResetLatch(MyLatch);
+
+			if (rc & WL_POSTMASTER_DEATH)
+			{
+				proc_exit(1);
+			}
+
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+	PG_END_ENSURE_ERROR_CLEANUP(ReleaseRunWaiterCallback, Int32GetDatum(waiterIndex));
+
+	ReleaseRunWaiter(waiterIndex);
+
+	if (!isFinished)
+	{
+		(void) ReadRunResult(runId, values, isNulls);
+	}
+
+	resultTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(resultTuple));
+}
+
+
+/*
+ * ReleaseRunWaiterCallback frees the waiter slot of a session that stops
+ * waiting because of an error or because it exits.
+ */
+static void
+ReleaseRunWaiterCallback(int code, Datum arg)
+{
+	ReleaseRunWaiter(DatumGetInt32(arg));
+}
+
+
+/*
+ * ReadRunResult fills in the status, return message and duration of a run
+ * from cron.job_run_details, as far as they are known, and returns whether
+ * the run ended. Rows of runs of other users are not visible.
+ */
+static bool
+ReadRunResult(int64 runId, Datum *values, bool *isNulls)
+{
+	MemoryContext callerContext = CurrentMemoryContext;
+	Oid argTypes[1] = { INT8OID };
+	Datum argValues[1];
+	char *status = NULL;
+	char *returnMessage = NULL;
+	TimestampTz startTime = 0;
+	TimestampTz endTime = 0;
+	bool hasStartTime = false;
+	bool hasEndTime = false;
+
+	argValues[0] = Int64GetDatum(runId);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "SPI_connect failed");
+	}
+
+	/* not read-only, so that each call sees the latest committed state */
+	if (SPI_execute_with_args("select status, return_message, start_time, end_time "
+							  "from cron.job_run_details where runid = $1",
+							  1, argTypes, argValues, NULL, false, 1) != SPI_OK_SELECT)
+	{
+		elog(ERROR, "SPI_exec failed: reading run " INT64_FORMAT, runId);
+	}
+
+	if (SPI_processed > 0)
+	{
+		HeapTuple row = SPI_tuptable->vals[0];
+		TupleDesc rowDescriptor = SPI_tuptable->tupdesc;
+		char *value = NULL;
+		Datum timeDatum = 0;
+		bool isNull = false;
+
+		value = SPI_getvalue(row, rowDescriptor, 1);
+		if (value != NULL)
+			status = MemoryContextStrdup(callerContext, value);
+
+		value = SPI_getvalue(row, rowDescriptor, 2);
+		if (value != NULL)
+			returnMessage = MemoryContextStrdup(callerContext, value);
+
+		timeDatum = SPI_getbinval(row, rowDescriptor, 3, &isNull);
+		if (!isNull)
+		{
+			startTime = DatumGetTimestampTz(timeDatum);
+			hasStartTime = true;
+		}
+
+		timeDatum = SPI_getbinval(row, rowDescriptor, 4, &isNull);
+		if (!isNull)
+		{
+			endTime = DatumGetTimestampTz(timeDatum);
+			hasEndTime = true;
+		}
+	}
+
+	SPI_finish();
+
+	memset(isNulls, true, sizeof(bool) * 3);
+
+	if (status != NULL)
+	{
+		values[0] = CStringGetTextDatum(status);
+		isNulls[0] = false;
+	}
 
-	PG_RETURN_INT64(jobId);
+	if (returnMessage != NULL)
+	{
+		values[1] = CStringGetTextDatum(returnMessage);
+		isNulls[1] = false;
+	}
+
+	if (hasStartTime)
+	{
+		/* a run in progress reports how long it has been running */
+		if (!hasEndTime)
+			endTime = GetCurrentTimestamp();
+
+		values[2] = DirectFunctionCall2(timestamp_mi, TimestampTzGetDatum(endTime),
+										TimestampTzGetDatum(startTime));
+		isNulls[2] = false;
+	}
+
+	return status != NULL &&
+		   (strcmp(status, GetCronStatus(CRON_STATUS_SUCCEEDED)) == 0 ||
+			strcmp(status, GetCronStatus(CRON_STATUS_FAILED)) == 0);
 }
 
+
 /*
- * cron_schedule_named_mode_zone schedules a zone cron job
+ * EnsureRunPermission throws an error if the job does not exist or if the
+ * given user is neither its owner nor a superuser, and returns whether the
+ * job is active.
  */
-Datum
-cron_schedule_named_mode_zone(PG_FUNCTION_ARGS)
+bool
+EnsureRunPermission(int64 jobId, Oid userId)
 {
-	Name jobName = PG_GETARG_NAME(0);
-	text *scheduleText = PG_GETARG_TEXT_P(1);
-	text *commandText = PG_GETARG_TEXT_P(2);
-	text *modeText = PG_GETARG_TEXT_P(3);
-	text *zoneText = PG_GETARG_TEXT_P(4);
+	CronRunPermission permission = GetRunPermission(jobId, userId);
 
-	char *schedule = text_to_cstring(scheduleText);
-	char *command = text_to_cstring(commandText);
-	char *mode = text_to_cstring(modeText);
-	char *tmzone = text_to_cstring(zoneText);
+	if (permission == CRON_RUN_NO_JOB)
+	{
+		ereport(ERROR, (errmsg("could not find valid entry for job "
+							   INT64_FORMAT, jobId)));
+	}
+	else if (permission == CRON_RUN_DENIED)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("permission denied to run job " INT64_FORMAT,
+							   jobId)));
+	}
 
-	int64 jobId = ScheduleCronJob(jobName, schedule, command, mode, tmzone, COMMAND_SQL);
+	return permission == CRON_RUN_PERMITTED;
+}
 
-	PG_RETURN_INT64(jobId);
+/*
+ * GetRunPermission returns whether the job exists, whether the given user is
+ * its owner or a superuser, and whether the job is active, in that order.
+ */
+CronRunPermission
+GetRunPermission(int64 jobId, Oid userId)
+{
+	Oid cronSchemaId = InvalidOid;
+	Oid cronJobIndexId = InvalidOid;
+
+	Relation cronJobsTable = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 1;
+	bool indexOK = true;
+	HeapTuple heapTuple = NULL;
+	bool isNull = false;
+	Datum ownerNameDatum = 0;
+	Datum activeDatum = 0;
+	CronRunPermission permission = CRON_RUN_PERMITTED;
+
+	char *userName = GetUserNameFromId(userId, false);
+
+	cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+	cronJobIndexId = get_relname_relid(JOB_ID_INDEX_NAME, cronSchemaId);
+
+	cronJobsTable = table_open(CronJobRelationId(), AccessShareLock);
+	tupleDescriptor = RelationGetDescr(cronJobsTable);
+
+	ScanKeyInit(&scanKey[0], Anum_cron_job_jobid,
+				BTEqualStrategyNumber, F_INT8EQ, Int64GetDatum(jobId));
+
+	scanDescriptor = systable_beginscan(cronJobsTable,
+										cronJobIndexId, indexOK,
+										NULL, scanKeyCount, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (!HeapTupleIsValid(heapTuple))
+	{
+		permission = CRON_RUN_NO_JOB;
+	}
+	else
+	{
+		ownerNameDatum = heap_getattr(heapTuple, Anum_cron_job_username,
+									  tupleDescriptor, &isNull);
+		activeDatum = heap_getattr(heapTuple, Anum_cron_job_active,
+								   tupleDescriptor, &isNull);
+
+		if (!superuser_arg(userId) &&
+			pg_strcasecmp(userName, TextDatumGetCString(ownerNameDatum)) != 0)
+		{
+			permission = CRON_RUN_DENIED;
+		}
+		else if (!isNull && !DatumGetBool(activeDatum))
+		{
+			permission = CRON_RUN_INACTIVE;
+		}
+	}
+
+	systable_endscan(scanDescriptor);
+	table_close(cronJobsTable, AccessShareLock);
+
+	return permission;
 }
 
 /*
- * cron_schedule_named_mode_zone schedules a commandtype cron job
+ * UpdateCronExtColumn sets a column of the cron.lt_job_ext row of a job owned
+ * by the current user to the text value converted to the type of the column,
+ * or sets it to NULL if value is NULL.
  */
-Datum
-cron_schedule_named_mode_zone_cmdtype(PG_FUNCTION_ARGS)
+static void
+UpdateCronExtColumn(int64 jobId, char *columnName, Oid columnType, char *value)
 {
-	Name jobName = PG_GETARG_NAME(0);
-	text *scheduleText = PG_GETARG_TEXT_P(1);
-	text *commandText = PG_GETARG_TEXT_P(2);
-	text *modeText = PG_GETARG_TEXT_P(3);
-	text *zoneText = PG_GETARG_TEXT_P(4);
-	text *cmdtypeText = PG_GETARG_TEXT_P(5);
+	StringInfoData querybuf;
+	Oid argTypes[3];
+	Datum argValues[3];
+	char argNulls[3] = {' ', ' ', ' '};
+	uint64 updatedRows = 0;
 
-	char *schedule = text_to_cstring(scheduleText);
-	char *command = text_to_cstring(commandText);
-	char *mode = text_to_cstring(modeText);
-	char *tmzone = text_to_cstring(zoneText);
-	char *cmdtype = text_to_cstring(cmdtypeText);
+	Oid savedUserId = InvalidOid;
+	int savedSecurityContext = 0;
 
-	int64 jobId = ScheduleCronJob(jobName, schedule, command, mode, tmzone, cmdtype);
+	Oid userId = GetUserId();
+	char *userName = GetUserNameFromId(userId, false);
 
-	PG_RETURN_INT64(jobId);
+	if (!JobLtExtTableExists())
+	{
+		ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						errmsg("pg_cron extension is not up to date")));
+	}
+
+	initStringInfo(&querybuf);
+	appendStringInfo(&querybuf,
+		"update %s set %s = $1::%s where jobid = $2 and username = $3",
+		quote_qualified_identifier(CRON_SCHEMA_NAME, LT_JOB_EXT),
+		quote_identifier(columnName), format_type_be(columnType));
+
+	argTypes[0] = TEXTOID;
+	if (value != NULL)
+	{
+		argValues[0] = CStringGetTextDatum(value);
+	}
+	else
+	{
+		argValues[0] = (Datum) 0;
+		argNulls[0] = 'n';
+	}
+
+	argTypes[1] = INT8OID;
+	argValues[1] = Int64GetDatum(jobId);
+
+	argTypes[2] = TEXTOID;
+	argValues[2] = CStringGetTextDatum(userName);
+
+	GetUserIdAndSecContext(&savedUserId, &savedSecurityContext);
+	SetUserIdAndSecContext(CronExtensionOwner(), SECURITY_LOCAL_USERID_CHANGE);
+
+	/* Open SPI context. */
+	if (SPI_connect() != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "SPI_connect failed");
+	}
+
+	if (SPI_execute_with_args(querybuf.data, 3, argTypes, argValues, argNulls,
+							  false, 0) != SPI_OK_UPDATE)
+	{
+		elog(ERROR, "SPI_exec failed: %s", querybuf.data);
+	}
+
+	updatedRows = SPI_processed;
+
+	pfree(querybuf.data);
+
+	SPI_finish();
+
+	SetUserIdAndSecContext(savedUserId, savedSecurityContext);
+
+	if (updatedRows == 0)
+	{
+		ereport(ERROR, (errmsg("could not find valid entry for job "
+							   INT64_FORMAT, jobId)));
+	}
+
+	InvalidateJobCache();
 }
 
 
@@ -306,10 +1257,12 @@ ScheduleCronJob(Name jobName, char *schedule, char *command, char *mode, char *t
 	char *userName = GetUserNameFromId(userId, false);
 
 	if (strcmp(MODE_SINGLE, mode) && strcmp(MODE_TIMING, mode) && strcmp(MODE_ASAP, mode)
-		 && strcmp(MODE_NEXT, mode) && strcmp(MODE_FIXED, mode))
+		 && strcmp(MODE_NEXT, mode) && strcmp(MODE_FIXED, mode) && strcmp(MODE_DAEMON, mode)
+		 && strcmp(MODE_CONSUMER, mode) && strcmp(MODE_CHUNKED, mode) && strcmp(MODE_FANOUT, mode))
 	{
 		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-						errmsg("invalid mode: %s, the range is 'single', 'asap', 'next' or 'fixed'", mode)));
+						errmsg("invalid mode: %s, the range is 'single', 'asap', 'next', 'fixed', "
+							   "'daemon', 'consumer', 'chunked' or 'fanout'", mode)));
 	}
 
 	if (!is_number(tmzone) || 12 < atoi(tmzone) || -12 > atoi(tmzone))
@@ -324,6 +1277,26 @@ ScheduleCronJob(Name jobName, char *schedule, char *command, char *mode, char *t
 						errmsg("invalid commandtype: %s, the range is 'sql' or 'linux'", cmdtype)));
 	}
 
+	if (ModeRunsInOwnWorker(mode) && strcmp(COMMAND_SQL, cmdtype))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("%s mode only runs sql commands", mode)));
+	}
+
+	/* like the bgworker executor, these runs take resources of the server */
+	if (ModeRunsInOwnWorker(mode) && !superuser())
+	{
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("must be superuser to run jobs in background workers")));
+	}
+
+	if (!strcmp(MODE_CHUNKED, mode) && strstr(command, BATCH_SIZE_PLACEHOLDER) == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("the command of a chunked job must contain %s",
+							   BATCH_SIZE_PLACEHOLDER)));
+	}
+
 	/* pg_cron linux command execution requires superuser
 	 * lightdb add 2022/4/20 for S202204117426
 	 */
@@ -468,10 +1441,69 @@ is_number(char *arg)
 }
 
 /*
- * NextRunId draws a new run ID from cron.runid_seq.
+ * ModeRunsInOwnWorker returns whether the runs of jobs in the given mode always
+ * execute in a background worker of their own.
+ */
+static bool
+ModeRunsInOwnWorker(char *mode)
+{
+	return !strcmp(MODE_DAEMON, mode) || !strcmp(MODE_CONSUMER, mode) ||
+		   !strcmp(MODE_CHUNKED, mode) || !strcmp(MODE_FANOUT, mode);
+}
+
+/*
+ * EnsureGenericScheduleMode throws an error for the modes whose command is
+ * not given by the user, and which therefore can only be scheduled with their
+ * own schedule functions.
+ */
+static void
+EnsureGenericScheduleMode(char *mode)
+{
+	if (!strcmp(MODE_CONSUMER, mode))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("consumer jobs cannot be scheduled with cron.schedule()"),
+						errhint("Use cron.schedule_queue_consumer() instead.")));
+	}
+
+	if (!strcmp(MODE_FANOUT, mode))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("fanout jobs cannot be scheduled with cron.schedule()"),
+						errhint("Use cron.schedule_fanout(), cron.schedule_partition_fanout(), "
+								"cron.schedule_in_databases() or cron.schedule_on_nodes() "
+								"instead.")));
+	}
+}
+
+/*
+ * NextRunId draws a new run ID from cron.runid_seq in a transaction of its
+ * own.
  */
 int64
 NextRunId(void)
+{
+	int64 runId = 0;
+	MemoryContext originalContext = CurrentMemoryContext;
+
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	runId = DrawRunId();
+
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	MemoryContextSwitchTo(originalContext);
+
+	return runId;
+}
+
+/*
+ * DrawRunId draws a new run ID from cron.runid_seq in the current
+ * transaction, or returns 0 if the job_run_details table does not exist.
+ */
+static int64
+DrawRunId(void)
 {
 	text *sequenceName = NULL;
 	Oid sequenceId = InvalidOid;
@@ -481,19 +1513,10 @@ NextRunId(void)
 	Oid savedUserId = InvalidOid;
 	int savedSecurityContext = 0;
 	Datum jobIdDatum = 0;
-	int64 jobId = 0;
 	bool failOK = true;
-	MemoryContext originalContext = CurrentMemoryContext;
-
-	StartTransactionCommand();
-	PushActiveSnapshot(GetTransactionSnapshot());
 
 	if (!JobRunDetailsTableExists())
 	{
-		PopActiveSnapshot();
-		CommitTransactionCommand();
-		MemoryContextSwitchTo(originalContext);
-
 		/* if the job_run_details table is not yet created, the run ID is not used */
 		return 0;
 	}
@@ -513,13 +1536,7 @@ NextRunId(void)
 
 	SetUserIdAndSecContext(savedUserId, savedSecurityContext);
 
-	jobId = DatumGetInt64(jobIdDatum);
-
-	PopActiveSnapshot();
-	CommitTransactionCommand();
-	MemoryContextSwitchTo(originalContext);
-
-	return jobId;
+	return DatumGetInt64(jobIdDatum);
 }
 
 /*
@@ -838,6 +1855,8 @@ LoadCronJobList(void)
 	systable_endscan(scanDescriptor);
 	table_close(cronJobTable, AccessShareLock);
 
+	LoadCronJobOptions();
+
 	PopActiveSnapshot();
 	CommitTransactionCommand();
 	MemoryContextSwitchTo(originalContext);
@@ -847,6 +1866,106 @@ LoadCronJobList(void)
 }
 
 
+/*
+ * LoadCronJobOptions sets the execution profiles, executors, maximum
+ * concurrency, batch timing and fan-out targets of the jobs in the
+ * CronJobHash from cron.lt_job_ext, using a single query for all jobs.
+ */
+static void
+LoadCronJobOptions(void)
+{
+	Oid cronSchemaId = get_namespace_oid(CRON_SCHEMA_NAME, false);
+	Oid jobLtExtTableOid = get_relname_relid(LT_JOB_EXT, cronSchemaId);
+	StringInfoData querybuf;
+	uint64 rowIndex = 0;
+
+	/* these options were added in pg_cron 1.6 */
+	if (jobLtExtTableOid == InvalidOid ||
+		get_attnum(jobLtExtTableOid, "fanout_target") == InvalidAttrNumber)
+	{
+		return;
+	}
+
+	initStringInfo(&querybuf);
+
+	/* Open SPI context. */
+	if (SPI_connect() != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "SPI_connect failed");
+	}
+
+	appendStringInfo(&querybuf,
+		"select jobid, profile, executor, max_concurrency, batch_target_ms, "
+		"batch_pause_ms, fanout_targets, fanout_target from %s "
+		"where profile is not null or executor is not null "
+		"or max_concurrency is not null or batch_target_ms is not null "
+		"or batch_pause_ms is not null or fanout_targets is not null",
+		quote_qualified_identifier(CRON_SCHEMA_NAME, LT_JOB_EXT));
+
+	if (SPI_execute(querybuf.data, true, 0) != SPI_OK_SELECT)
+	{
+		elog(ERROR, "SPI_exec failed: %s", querybuf.data);
+	}
+
+	for (rowIndex = 0; rowIndex < SPI_processed; rowIndex++)
+	{
+		HeapTuple row = SPI_tuptable->vals[rowIndex];
+		TupleDesc rowDescriptor = SPI_tuptable->tupdesc;
+		bool isNull = false;
+		int64 jobId = DatumGetInt64(SPI_getbinval(row, rowDescriptor, 1, &isNull));
+		char *profile = SPI_getvalue(row, rowDescriptor, 2);
+		char *executor = SPI_getvalue(row, rowDescriptor, 3);
+		bool isMaxConcurrencyNull = false;
+		Datum maxConcurrency = SPI_getbinval(row, rowDescriptor, 4, &isMaxConcurrencyNull);
+		bool isBatchTargetTimeNull = false;
+		Datum batchTargetTime = SPI_getbinval(row, rowDescriptor, 5, &isBatchTargetTimeNull);
+		bool isBatchPauseNull = false;
+		Datum batchPause = SPI_getbinval(row, rowDescriptor, 6, &isBatchPauseNull);
+		char *fanoutTargets = SPI_getvalue(row, rowDescriptor, 7);
+		char *fanoutTarget = SPI_getvalue(row, rowDescriptor, 8);
+		CronJob *job = GetCronJob(jobId);
+
+		if (job == NULL)
+			continue;
+
+		if (profile != NULL)
+			job->profile = MemoryContextStrdup(CronJobContext, profile);
+
+		if (executor == NULL || !strcmp(executor, EXECUTOR_AUTO))
+			job->executor = CRON_EXECUTOR_AUTO;
+		else if (!strcmp(executor, EXECUTOR_BGWORKER))
+			job->executor = CRON_EXECUTOR_BGWORKER;
+		else if (!strcmp(executor, EXECUTOR_POOL))
+			job->executor = CRON_EXECUTOR_POOL;
+		else
+			job->executor = CRON_EXECUTOR_LIBPQ;
+
+		if (!isMaxConcurrencyNull)
+			job->maxConcurrency = DatumGetInt32(maxConcurrency);
+
+		if (!isBatchTargetTimeNull)
+			job->batchTargetTime = DatumGetInt32(batchTargetTime);
+
+		if (!isBatchPauseNull)
+			job->batchPause = DatumGetInt32(batchPause);
+
+		if (fanoutTargets != NULL)
+			job->fanoutTargets = MemoryContextStrdup(CronJobContext, fanoutTargets);
+
+		if (fanoutTarget == NULL)
+			job->fanoutTarget = CRON_FANOUT_COMMAND;
+		else if (!strcmp(fanoutTarget, FANOUT_TARGET_DATABASE))
+			job->fanoutTarget = CRON_FANOUT_DATABASE;
+		else
+			job->fanoutTarget = CRON_FANOUT_NODE;
+	}
+
+	pfree(querybuf.data);
+
+	SPI_finish();
+}
+
+
 /*
  * TupleToCronJob takes a heap tuple and converts it into a CronJob
  * struct.
@@ -886,6 +2005,15 @@ TupleToCronJob(TupleDesc tupleDescriptor, HeapTuple heapTuple)
 	job->userName = TextDatumGetCString(userName);
 	job->database = TextDatumGetCString(database);
 
+	/* set by LoadCronJobOptions if the job has any of these options */
+	job->profile = "";
+	job->executor = CRON_EXECUTOR_AUTO;
+	job->maxConcurrency = 0;
+	job->batchTargetTime = 0;
+	job->batchPause = 0;
+	job->fanoutTargets = NULL;
+	job->fanoutTarget = CRON_FANOUT_COMMAND;
+
 	if (HeapTupleHeaderGetNatts(heapTuple->t_data) >= Anum_cron_job_active)
 	{
 		Datum active = heap_getattr(heapTuple, Anum_cron_job_active,
@@ -971,12 +2099,14 @@ PgCronHasBeenLoaded(void)
 }
 
 void
-InsertJobRunDetail(int64 runId, int64 *jobId, char *database, char *username, char *command, char *status)
+InsertJobRunDetail(int64 runId, int64 *jobId, char *database, char *username, char *command, char *status,
+				   int64 parentRunId, char *target)
 {
 	StringInfoData querybuf;
-	const int argCount = 6;
-	Oid argTypes[6];
-	Datum argValues[6];
+	int argCount = 6;
+	Oid argTypes[8];
+	Datum argValues[8];
+	char argNulls[8] = {' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '};
 	MemoryContext originalContext = CurrentMemoryContext;
 
 	SetCurrentStatementStartTimestamp();
@@ -998,9 +2128,20 @@ InsertJobRunDetail(int64 runId, int64 *jobId, char *database, char *username, ch
 		elog(ERROR, "SPI_connect failed");
 
 
-	appendStringInfo(&querybuf,
-		"insert into %s.%s (jobid, runid, database, username, command, status) values ($1,$2,$3,$4,$5,$6)",
-		CRON_SCHEMA_NAME, JOB_RUN_DETAILS_TABLE_NAME);
+	/* only runs of fan-out jobs, which came with pg_cron 1.6, have a parent */
+	if (parentRunId != 0)
+	{
+		appendStringInfo(&querybuf,
+			"insert into %s.%s (jobid, runid, database, username, command, status, parent_runid, "
+			"target) values ($1,$2,$3,$4,$5,$6,$7,$8)",
+			CRON_SCHEMA_NAME, JOB_RUN_DETAILS_TABLE_NAME);
+	}
+	else
+	{
+		appendStringInfo(&querybuf,
+			"insert into %s.%s (jobid, runid, database, username, command, status) values ($1,$2,$3,$4,$5,$6)",
+			CRON_SCHEMA_NAME, JOB_RUN_DETAILS_TABLE_NAME);
+	}
 
 	/* jobId */
 	argTypes[0] = INT8OID;
@@ -1010,26 +2151,39 @@ InsertJobRunDetail(int64 runId, int64 *jobId, char *database, char *username, ch
 	argTypes[1] = INT8OID;
 	argValues[1] = Int64GetDatum(runId);
 
-	/* database */
+	/* database, username and command are not known for a run of a removed job */
 	argTypes[2] = TEXTOID;
-	argValues[2] = CStringGetTextDatum(database);
+	argValues[2] = database != NULL ? CStringGetTextDatum(database) : (Datum) 0;
+	argNulls[2] = database != NULL ? ' ' : 'n';
 
-	/* username */
 	argTypes[3] = TEXTOID;
-	argValues[3] = CStringGetTextDatum(username);
+	argValues[3] = username != NULL ? CStringGetTextDatum(username) : (Datum) 0;
+	argNulls[3] = username != NULL ? ' ' : 'n';
 
-	/* command */
 	argTypes[4] = TEXTOID;
-	argValues[4] = CStringGetTextDatum(command);
+	argValues[4] = command != NULL ? CStringGetTextDatum(command) : (Datum) 0;
+	argNulls[4] = command != NULL ? ' ' : 'n';
 
 	/* status */
 	argTypes[5] = TEXTOID;
 	argValues[5] = CStringGetTextDatum(status);
 
+	if (parentRunId != 0)
+	{
+		/* parent_runid */
+		argTypes[6] = INT8OID;
+		argValues[6] = Int64GetDatum(parentRunId);
+
+		/* target */
+		argTypes[7] = TEXTOID;
+		argValues[7] = CStringGetTextDatum(target);
+		argCount = 8;
+	}
+
 	pgstat_report_activity(STATE_RUNNING, querybuf.data);
 
 	if(SPI_execute_with_args(querybuf.data,
-		argCount, argTypes, argValues, NULL, false, 1) != SPI_OK_INSERT)
+		argCount, argTypes, argValues, argNulls, false, 1) != SPI_OK_INSERT)
 		elog(ERROR, "SPI_exec failed: %s", querybuf.data);
 
 	pfree(querybuf.data);
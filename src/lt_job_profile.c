@@ -0,0 +1,380 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/lt_job_profile.c
+ *
+ * Per-job execution profiles.
+ *
+ * A profile is a comma-separated list of name=value entries that is stored
+ * with a job, for instance 'work_mem=256MB, statement_timeout=10min'. It can
+ * set a few planner and resource settings and limit the memory of the
+ * process that runs the job. Background workers apply the profile before
+ * executing the command, libpq connections pass the settings as connection
+ * options.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include <ctype.h>
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+
+#include "lib/stringinfo.h"
+#include "nodes/pg_list.h"
+#include "utils/guc.h"
+
+#include "lt_job_profile.h"
+
+
+/*
+ * JobProfileEntry is a single name=value entry of a profile, with the name
+ * in its canonical spelling.
+ */
+typedef struct JobProfileEntry
+{
+	const char *name;
+	char *value;
+} JobProfileEntry;
+
+
+/* settings that a profile can change, all of them user-settable */
+static const char *const JobProfileSettings[] = {
+	"work_mem",
+	"maintenance_work_mem",
+	"max_parallel_workers_per_gather",
+	"statement_timeout",
+	"lock_timeout",
+	NULL
+};
+
+
+static List * ParseJobProfile(const char *profile, int elevel);
+static const char * JobProfileEntryName(const char *name);
+static char * TrimSpaces(char *string);
+static int ParseMemoryLimit(const char *value, int elevel);
+static void SetMemoryLimit(int limitKb);
+
+
+/*
+ * ValidateJobProfile throws an error if a profile cannot be stored for a job,
+ * because it is malformed, names an unsupported setting or has an invalid
+ * value.
+ */
+void
+ValidateJobProfile(const char *profile)
+{
+	List *entryList = NIL;
+	ListCell *entryCell = NULL;
+
+	if (strlen(profile) >= JOB_PROFILE_SIZE)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("invalid profile length, the maximum length is %d",
+							   JOB_PROFILE_SIZE - 1)));
+	}
+
+	entryList = ParseJobProfile(profile, ERROR);
+
+	foreach(entryCell, entryList)
+	{
+		JobProfileEntry *entry = (JobProfileEntry *) lfirst(entryCell);
+
+		if (strcmp(entry->name, JOB_PROFILE_MEMORY_LIMIT) == 0)
+		{
+			(void) ParseMemoryLimit(entry->value, ERROR);
+			continue;
+		}
+
+		/* only checks the value */
+		(void) set_config_option(entry->name, entry->value, PGC_USERSET,
+								 PGC_S_SESSION, GUC_ACTION_SET, false, ERROR,
+								 false);
+	}
+}
+
+
+/*
+ * ApplyJobProfile sets up the session of a background worker according to the
+ * profile of the job it is about to run. Settings that the profile does not
+ * mention are reset, so that a pool worker does not carry them over from the
+ * previous run. Must be called outside of a transaction, since an aborted run
+ * would otherwise undo the settings.
+ */
+void
+ApplyJobProfile(const char *profile)
+{
+	List *entryList = NIL;
+	ListCell *entryCell = NULL;
+	int settingIndex = 0;
+	int limitKb = 0;
+
+	for (settingIndex = 0; JobProfileSettings[settingIndex] != NULL; settingIndex++)
+	{
+		(void) set_config_option(JobProfileSettings[settingIndex], NULL, PGC_USERSET,
+								 PGC_S_SESSION, GUC_ACTION_SET, true, ERROR,
+								 false);
+	}
+
+	entryList = ParseJobProfile(profile, ERROR);
+
+	foreach(entryCell, entryList)
+	{
+		JobProfileEntry *entry = (JobProfileEntry *) lfirst(entryCell);
+
+		if (strcmp(entry->name, JOB_PROFILE_MEMORY_LIMIT) == 0)
+		{
+			limitKb = ParseMemoryLimit(entry->value, ERROR);
+			continue;
+		}
+
+		(void) set_config_option(entry->name, entry->value, PGC_USERSET,
+								 PGC_S_SESSION, GUC_ACTION_SET, true, ERROR,
+								 false);
+	}
+
+	SetMemoryLimit(limitKb);
+}
+
+
+/*
+ * JobProfileConnectionOptions returns the value of the options connection
+ * parameter that applies the settings of a profile to a libpq session, or an
+ * empty string if the profile has none. The memory limit of a profile cannot
+ * be imposed on a remote backend and is left out. Called by the launcher, so
+ * an entry that is not understood is skipped with a warning.
+ */
+char *
+JobProfileConnectionOptions(const char *profile)
+{
+	StringInfoData options;
+	List *entryList = ParseJobProfile(profile, WARNING);
+	ListCell *entryCell = NULL;
+
+	initStringInfo(&options);
+
+	foreach(entryCell, entryList)
+	{
+		JobProfileEntry *entry = (JobProfileEntry *) lfirst(entryCell);
+		const char *valueChar = NULL;
+
+		if (strcmp(entry->name, JOB_PROFILE_MEMORY_LIMIT) == 0)
+			continue;
+
+		if (options.len > 0)
+			appendStringInfoChar(&options, ' ');
+
+		appendStringInfo(&options, "-c %s=", entry->name);
+
+		/* libpq splits options at whitespace unless it is escaped */
+		for (valueChar = entry->value; *valueChar != '\0'; valueChar++)
+		{
+			if (isspace((unsigned char) *valueChar) || *valueChar == '\\')
+				appendStringInfoChar(&options, '\\');
+
+			appendStringInfoChar(&options, *valueChar);
+		}
+	}
+
+	list_free_deep(entryList);
+
+	return options.data;
+}
+
+
+/*
+ * ParseJobProfile splits a profile into its entries. Malformed entries and
+ * unsupported settings are reported at the given level and skipped if that
+ * does not throw an error.
+ */
+static List *
+ParseJobProfile(const char *profile, int elevel)
+{
+	List *entryList = NIL;
+	char *profileCopy = pstrdup(profile);
+	char *item = NULL;
+	char *nextItem = NULL;
+
+	for (item = profileCopy; item != NULL; item = nextItem)
+	{
+		JobProfileEntry *entry = NULL;
+		char *separator = NULL;
+		const char *name = NULL;
+		char *value = NULL;
+
+		nextItem = strchr(item, ',');
+		if (nextItem != NULL)
+			*nextItem++ = '\0';
+
+		item = TrimSpaces(item);
+		if (item[0] == '\0')
+			continue;
+
+		separator = strchr(item, '=');
+		if (separator == NULL)
+		{
+			ereport(elevel, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							 errmsg("invalid profile entry: \"%s\"", item),
+							 errhint("Profile entries have the form name=value.")));
+			continue;
+		}
+
+		*separator = '\0';
+		value = TrimSpaces(separator + 1);
+
+		name = JobProfileEntryName(TrimSpaces(item));
+		if (name == NULL)
+		{
+			ereport(elevel, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							 errmsg("profile setting \"%s\" is not supported",
+									TrimSpaces(item)),
+							 errhint("Supported settings are work_mem, maintenance_work_mem, "
+									 "max_parallel_workers_per_gather, statement_timeout, "
+									 "lock_timeout and memory_limit.")));
+			continue;
+		}
+
+		if (value[0] == '\0')
+		{
+			ereport(elevel, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							 errmsg("profile setting \"%s\" has no value", name)));
+			continue;
+		}
+
+		entry = palloc0(sizeof(JobProfileEntry));
+		entry->name = name;
+		entry->value = pstrdup(value);
+
+		entryList = lappend(entryList, entry);
+	}
+
+	pfree(profileCopy);
+
+	return entryList;
+}
+
+
+/*
+ * JobProfileEntryName returns the canonical name of a profile setting, or
+ * NULL if a profile cannot change it.
+ */
+static const char *
+JobProfileEntryName(const char *name)
+{
+	int settingIndex = 0;
+
+	if (pg_strcasecmp(name, JOB_PROFILE_MEMORY_LIMIT) == 0)
+		return JOB_PROFILE_MEMORY_LIMIT;
+
+	for (settingIndex = 0; JobProfileSettings[settingIndex] != NULL; settingIndex++)
+	{
+		if (pg_strcasecmp(name, JobProfileSettings[settingIndex]) == 0)
+			return JobProfileSettings[settingIndex];
+	}
+
+	return NULL;
+}
+
+
+/*
+ * TrimSpaces removes leading and trailing whitespace from a string in place.
+ */
+static char *
+TrimSpaces(char *string)
+{
+	char *end = NULL;
+
+	while (isspace((unsigned char) *string))
+		string++;
+
+	end = string + strlen(string);
+	while (end > string && isspace((unsigned char) end[-1]))
+		end--;
+
+	*end = '\0';
+
+	return string;
+}
+
+
+/*
+ * ParseMemoryLimit returns the memory limit of a profile in kilobytes, or 0 if
+ * the value is invalid and the error level does not throw.
+ */
+static int
+ParseMemoryLimit(const char *value, int elevel)
+{
+	int limitKb = 0;
+	const char *hintmsg = NULL;
+
+	if (!parse_int(value, &limitKb, GUC_UNIT_KB, &hintmsg) || limitKb <= 0)
+	{
+		ereport(elevel, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("invalid value for profile setting \"%s\": \"%s\"",
+								JOB_PROFILE_MEMORY_LIMIT, value),
+						 hintmsg ? errhint("%s", _(hintmsg)) : 0));
+		return 0;
+	}
+
+	return limitKb;
+}
+
+
+/*
+ * SetMemoryLimit limits the private memory of the current process, such that
+ * allocations beyond the limit fail with an out of memory error instead of
+ * starving the server. Shared memory does not count against the limit. A
+ * limit of 0 restores the limit the process started with.
+ */
+static void
+SetMemoryLimit(int limitKb)
+{
+#ifndef WIN32
+	static struct rlimit originalLimit;
+	static bool originalLimitKnown = false;
+	static int currentLimitKb = 0;
+	struct rlimit limit;
+
+	if (limitKb == currentLimitKb)
+		return;
+
+	if (!originalLimitKnown)
+	{
+		if (getrlimit(RLIMIT_DATA, &originalLimit) != 0)
+		{
+			ereport(WARNING, (errmsg("could not get memory limit: %m")));
+			return;
+		}
+
+		originalLimitKnown = true;
+	}
+
+	limit = originalLimit;
+
+	if (limitKb > 0)
+	{
+		rlim_t limitBytes = (rlim_t) limitKb * 1024;
+
+		if (limit.rlim_max == RLIM_INFINITY || limitBytes < limit.rlim_max)
+			limit.rlim_cur = limitBytes;
+		else
+			limit.rlim_cur = limit.rlim_max;
+	}
+
+	if (setrlimit(RLIMIT_DATA, &limit) != 0)
+	{
+		ereport(WARNING, (errmsg("could not set memory limit: %m")));
+		return;
+	}
+
+	currentLimitKb = limitKb;
+#else
+	if (limitKb > 0)
+	{
+		ereport(WARNING, (errmsg("profile setting \"%s\" is not supported on this platform",
+								 JOB_PROFILE_MEMORY_LIMIT)));
+	}
+#endif
+}
@@ -0,0 +1,206 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/lt_job_trigger.c
+ *
+ * Runs of jobs that are triggered by changes to a table.
+ *
+ * cron.job_trigger(job_id) is a trigger function that can be attached to a
+ * table to run a job whenever the table changes, instead of having the job
+ * poll the table on a short schedule. The jobs that fired in a transaction
+ * are handed to the launcher through the shared memory request queue when
+ * the transaction commits, so that the run sees the changes, and nothing
+ * happens when it aborts. Triggers of a job that fire while a run of it is
+ * still waiting to start are coalesced into that run.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "access/xact.h"
+#include "commands/trigger.h"
+#include "nodes/pg_list.h"
+#include "utils/builtins.h"
+#if (PG_VERSION_NUM < 100000)
+#include "utils/int8.h"
+#endif
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+#include "job_metadata.h"
+#include "lt_shared_state.h"
+
+
+static void JobTriggerXactCallback(XactEvent event, void *arg);
+
+PG_FUNCTION_INFO_V1(cron_job_trigger);
+
+
+/* the jobs that fired in the current transaction, allocated in TopTransactionContext */
+static List *TriggeredJobIds = NIL;
+/* the jobs that fired in the current transaction but cannot run */
+static List *SkippedJobIds = NIL;
+static bool XactCallbackRegistered = false;
+
+
+/*
+ * cron_job_trigger remembers that the job given as the trigger argument is to
+ * run once the current transaction commits. The job has to be owned by the
+ * owner of the table, or the owner of the table has to be a superuser.
+ * Otherwise, or when the job is gone, a warning is raised instead of an
+ * error, since a stale trigger should not break writes to the table.
+ */
+Datum
+cron_job_trigger(PG_FUNCTION_ARGS)
+{
+	TriggerData *triggerData = (TriggerData *) fcinfo->context;
+	Trigger *trigger = NULL;
+	int64 jobId = 0;
+	int64 *triggeredJobId = NULL;
+	ListCell *jobIdCell = NULL;
+	MemoryContext oldContext = NULL;
+	CronRunPermission permission = CRON_RUN_PERMITTED;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+	{
+		ereport(ERROR, (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+						errmsg("must be called as trigger")));
+	}
+
+	if (!TRIGGER_FIRED_AFTER(triggerData->tg_event))
+	{
+		ereport(ERROR, (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+						errmsg("cron.job_trigger() must be fired AFTER the change")));
+	}
+
+	trigger = triggerData->tg_trigger;
+	if (trigger->tgnargs != 1)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("cron.job_trigger() takes the job ID as its only argument")));
+	}
+
+	jobId = DatumGetInt64(DirectFunctionCall1(int8in,
+											  CStringGetDatum(trigger->tgargs[0])));
+
+	/* a job runs once per transaction, however often it fired */
+	foreach(jobIdCell, TriggeredJobIds)
+	{
+		if (*((int64 *) lfirst(jobIdCell)) == jobId)
+		{
+			return PointerGetDatum(NULL);
+		}
+	}
+
+	/* and a job that cannot run is only looked up once per transaction */
+	foreach(jobIdCell, SkippedJobIds)
+	{
+		if (*((int64 *) lfirst(jobIdCell)) == jobId)
+		{
+			return PointerGetDatum(NULL);
+		}
+	}
+
+	EnsureSharedStateLoaded();
+
+	/* the change itself goes ahead, whatever happened to the job */
+	permission = GetRunPermission(jobId, triggerData->tg_relation->rd_rel->relowner);
+	switch (permission)
+	{
+		case CRON_RUN_PERMITTED:
+		{
+			break;
+		}
+
+		case CRON_RUN_NO_JOB:
+		{
+			ereport(WARNING, (errmsg("cron job " INT64_FORMAT " of trigger \"%s\" "
+									 "does not exist", jobId, trigger->tgname)));
+			break;
+		}
+
+		case CRON_RUN_DENIED:
+		{
+			ereport(WARNING, (errmsg("owner of table \"%s\" may not run cron job "
+									 INT64_FORMAT,
+									 RelationGetRelationName(triggerData->tg_relation),
+									 jobId)));
+			break;
+		}
+
+		case CRON_RUN_INACTIVE:
+		{
+			/* inactive jobs are not triggered */
+			ereport(DEBUG1, (errmsg("cron job " INT64_FORMAT " is not active", jobId)));
+			break;
+		}
+	}
+
+	oldContext = MemoryContextSwitchTo(TopTransactionContext);
+
+	triggeredJobId = palloc(sizeof(int64));
+	*triggeredJobId = jobId;
+
+	if (permission == CRON_RUN_PERMITTED)
+		TriggeredJobIds = lappend(TriggeredJobIds, triggeredJobId);
+	else
+		SkippedJobIds = lappend(SkippedJobIds, triggeredJobId);
+
+	MemoryContextSwitchTo(oldContext);
+
+	if (!XactCallbackRegistered)
+	{
+		RegisterXactCallback(JobTriggerXactCallback, NULL);
+		XactCallbackRegistered = true;
+	}
+
+	return PointerGetDatum(NULL);
+}
+
+
+/*
+ * JobTriggerXactCallback hands the jobs that fired to the launcher when the
+ * transaction commits and forgets them otherwise. Triggers that fired in a
+ * subtransaction that aborted still count.
+ */
+static void
+JobTriggerXactCallback(XactEvent event, void *arg)
+{
+	ListCell *jobIdCell = NULL;
+
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		{
+			foreach(jobIdCell, TriggeredJobIds)
+			{
+				int64 jobId = *((int64 *) lfirst(jobIdCell));
+
+				if (!PushJobTrigger(jobId))
+				{
+					ereport(WARNING, (errmsg("could not trigger cron job " INT64_FORMAT
+											 ", too many requests are waiting for "
+											 "the scheduler", jobId)));
+				}
+			}
+
+			TriggeredJobIds = NIL;
+			SkippedJobIds = NIL;
+			break;
+		}
+
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PREPARE:
+		{
+			TriggeredJobIds = NIL;
+			SkippedJobIds = NIL;
+			break;
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+}
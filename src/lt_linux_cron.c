@@ -57,7 +57,7 @@ ManageLinuxCronTask(CronTask *task)
 		snprintf(worker.bgw_type, BGW_MAXLEN, "cron_linux");
 		sprintf(worker.bgw_library_name, "pg_cron");
 		sprintf(worker.bgw_function_name, "RunLinuxTask");
-		worker.bgw_main_arg = Int64GetDatum(task->runId);
+		worker.bgw_main_arg = Int64GetDatum(task->run.runId);
 		/* set bgw_notify_pid so that we can use WaitForBackgroundWorkerStartup */
 		worker.bgw_notify_pid = MyProcPid;
 
@@ -68,8 +68,8 @@ ManageLinuxCronTask(CronTask *task)
 			task->state = CRON_TASK_ERROR;
 		}
 
-		task->handle = *handle;
-		status = WaitForBackgroundWorkerStartup(&task->handle, &pid);
+		task->run.handle = *handle;
+		status = WaitForBackgroundWorkerStartup(&task->run.handle, &pid);
 		if (status != BGWH_STARTED && status != BGWH_STOPPED)
 		{
 			elog(LOG, "WaitForBackgroundWorkerStartup failed, status %d", status);
@@ -82,7 +82,7 @@ ManageLinuxCronTask(CronTask *task)
 			cronstate = CRON_STATUS_FAILED;
 
 		if (CronLogRun)
-			UpdateJobRunDetail(task->runId, &pid, GetCronStatus(cronstate), retMsg, &start_time, NULL);
+			UpdateJobRunDetail(task->run.runId, &pid, GetCronStatus(cronstate), retMsg, &start_time, NULL);
 	}
 }
 
@@ -0,0 +1,261 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/lt_run_slots.c
+ *
+ * A shared arena of run slots for background worker runs.
+ *
+ * Instead of creating a DSM segment per run, the launcher creates a single
+ * segment at startup that holds a fixed number of run slots, each with the
+ * parameters of the run and its response queue. A worker is told the index
+ * of its slot, and the slot is reused for another run once the worker has
+ * exited. Runs whose command does not fit into a slot, or that find all
+ * slots taken, still get a DSM segment of their own.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "storage/proc.h"
+#include "utils/memutils.h"
+
+#include "lt_run_slots.h"
+
+
+#define RUN_SLOT_QUEUE_SIZE ((Size) 65536)
+#define RUN_SLOT_SIZE (MAXALIGN(sizeof(CronRunSlot)) + RUN_SLOT_QUEUE_SIZE)
+
+
+/*
+ * RunSlotState is the launcher's bookkeeping for a slot. A slot whose worker
+ * could not be confirmed to have exited stays reserved until it has.
+ */
+typedef struct RunSlotState
+{
+	bool inUse;
+	bool waitForWorker;
+	BackgroundWorkerHandle handle;
+	shm_mq_handle *responseq;
+} RunSlotState;
+
+
+static char * RunSlotAddress(char *arenaAddress, int slotIndex);
+static shm_mq * RunSlotQueue(char *slotAddress);
+
+
+/* the arena segment and slot states of the launcher */
+static dsm_segment *RunSlotSegment = NULL;
+static RunSlotState *RunSlotStates = NULL;
+static int RunSlotCount = 0;
+
+
+/*
+ * InitializeRunSlots creates the arena with the given number of run slots.
+ * If the segment cannot be created, every run uses its own DSM segment.
+ */
+void
+InitializeRunSlots(int slotCount)
+{
+	if (slotCount <= 0)
+	{
+		return;
+	}
+
+	RunSlotSegment = dsm_create(RUN_SLOT_SIZE * slotCount, DSM_CREATE_NULL_IF_MAXSEGMENTS);
+	if (RunSlotSegment == NULL)
+	{
+		ereport(WARNING,
+				(errmsg("could not create the pg_cron run slot arena, "
+						"background worker runs use their own DSM segment")));
+		return;
+	}
+
+	/* keep the arena for the lifetime of the launcher */
+	dsm_pin_mapping(RunSlotSegment);
+
+	RunSlotStates = MemoryContextAllocZero(TopMemoryContext,
+										   sizeof(RunSlotState) * slotCount);
+	RunSlotCount = slotCount;
+}
+
+
+/*
+ * AcquireRunSlot fills a free run slot with the parameters of a run and sets
+ * up its response queue. Returns the index of the slot, or -1 if the command
+ * or profile is too long or no slot is free.
+ */
+int
+AcquireRunSlot(const char *database, const char *userName, const char *profile,
+			   const char *command)
+{
+	int slotIndex = 0;
+
+	if (RunSlotSegment == NULL || strlen(command) >= RUN_SLOT_COMMAND_SIZE ||
+		strlen(profile) >= JOB_PROFILE_SIZE)
+	{
+		return -1;
+	}
+
+	for (slotIndex = 0; slotIndex < RunSlotCount; slotIndex++)
+	{
+		RunSlotState *state = &RunSlotStates[slotIndex];
+		char *slotAddress = NULL;
+		CronRunSlot *slot = NULL;
+		shm_mq *mq = NULL;
+		MemoryContext oldcontext;
+
+		if (state->inUse && state->waitForWorker)
+		{
+			pid_t pid;
+
+			/* reclaim the slot once the worker that used it is gone */
+			if (GetBackgroundWorkerPid(&state->handle, &pid) == BGWH_STOPPED)
+			{
+				state->inUse = false;
+				state->waitForWorker = false;
+			}
+		}
+
+		if (state->inUse)
+		{
+			continue;
+		}
+
+		slotAddress = RunSlotAddress(dsm_segment_address(RunSlotSegment), slotIndex);
+		slot = (CronRunSlot *) slotAddress;
+
+		strlcpy(slot->database, database, NAMEDATALEN);
+		strlcpy(slot->userName, userName, NAMEDATALEN);
+		strlcpy(slot->profile, profile, JOB_PROFILE_SIZE);
+		strlcpy(slot->command, command, RUN_SLOT_COMMAND_SIZE);
+
+		/* a queue cannot be attached twice, so each run gets a fresh one */
+		mq = shm_mq_create(RunSlotQueue(slotAddress), RUN_SLOT_QUEUE_SIZE);
+		shm_mq_set_receiver(mq, MyProc);
+
+		oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+		state->responseq = shm_mq_attach(mq, RunSlotSegment, NULL);
+		MemoryContextSwitchTo(oldcontext);
+
+		state->inUse = true;
+		state->waitForWorker = false;
+
+		return slotIndex;
+	}
+
+	return -1;
+}
+
+
+/*
+ * ReleaseRunSlot returns a run slot to the arena. If the handle of the worker
+ * that used the slot is given and the worker may still be running, the slot
+ * is only reused after the worker exited.
+ */
+void
+ReleaseRunSlot(int slotIndex, BackgroundWorkerHandle *handle)
+{
+	RunSlotState *state = &RunSlotStates[slotIndex];
+
+	Assert(slotIndex >= 0 && slotIndex < RunSlotCount);
+
+	if (state->responseq != NULL)
+	{
+#if PG_VERSION_NUM >= 110000
+		shm_mq_detach(state->responseq);
+#else
+		shm_mq_detach(shm_mq_get_queue(state->responseq));
+		pfree(state->responseq);
+#endif
+		state->responseq = NULL;
+	}
+
+	if (handle != NULL)
+	{
+		pid_t pid;
+
+		if (GetBackgroundWorkerPid(handle, &pid) != BGWH_STOPPED)
+		{
+			state->handle = *handle;
+			state->waitForWorker = true;
+			return;
+		}
+	}
+
+	state->inUse = false;
+	state->waitForWorker = false;
+}
+
+
+/*
+ * RunSlotResponseQueue returns the launcher's handle on the response queue of
+ * a run slot.
+ */
+shm_mq_handle *
+RunSlotResponseQueue(int slotIndex)
+{
+	Assert(slotIndex >= 0 && slotIndex < RunSlotCount);
+
+	return RunSlotStates[slotIndex].responseq;
+}
+
+
+/*
+ * PrepareRunSlotWorker tells a background worker where to find its run slot.
+ */
+void
+PrepareRunSlotWorker(BackgroundWorker *worker, int slotIndex)
+{
+	dsm_handle arenaHandle = dsm_segment_handle(RunSlotSegment);
+
+	sprintf(worker->bgw_function_name, "CronRunSlotWorker");
+	worker->bgw_main_arg = Int32GetDatum(slotIndex);
+	memcpy(worker->bgw_extra, &arenaHandle, sizeof(dsm_handle));
+}
+
+
+/*
+ * AttachRunSlot is called by a background worker started with
+ * PrepareRunSlotWorker to map the arena and find its run slot.
+ */
+CronRunSlot *
+AttachRunSlot(dsm_segment **seg, shm_mq **responseq)
+{
+	dsm_handle arenaHandle;
+	int slotIndex = DatumGetInt32(MyBgworkerEntry->bgw_main_arg);
+	char *slotAddress = NULL;
+
+	memcpy(&arenaHandle, MyBgworkerEntry->bgw_extra, sizeof(dsm_handle));
+
+	*seg = dsm_attach(arenaHandle);
+	if (*seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("unable to map dynamic shared memory segment")));
+
+	slotAddress = RunSlotAddress(dsm_segment_address(*seg), slotIndex);
+	*responseq = RunSlotQueue(slotAddress);
+
+	return (CronRunSlot *) slotAddress;
+}
+
+
+/*
+ * RunSlotAddress returns the start of a run slot in the arena.
+ */
+static char *
+RunSlotAddress(char *arenaAddress, int slotIndex)
+{
+	return arenaAddress + RUN_SLOT_SIZE * slotIndex;
+}
+
+
+/*
+ * RunSlotQueue returns the response queue that follows a run slot.
+ */
+static shm_mq *
+RunSlotQueue(char *slotAddress)
+{
+	return (shm_mq *) (slotAddress + MAXALIGN(sizeof(CronRunSlot)));
+}
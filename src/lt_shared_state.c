@@ -0,0 +1,941 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/lt_shared_state.c
+ *
+ * A shared memory mirror of the states of the launcher's tasks.
+ *
+ * The launcher publishes the state of every task and run instance in a slot
+ * of a shared array whenever the task is filed under a state queue, so that
+ * cron.running_jobs() can show what is going on without asking the launcher
+ * or reading any table. The launcher never takes a lock for this: each slot
+ * is a seqlock, and readers retry until they copied a slot that was not
+ * written in the meantime.
+ *
+ * The same memory holds the queue through which cron.run_job() asks the
+ * launcher to start a run. Any backend can add a request, only the launcher
+ * takes them out, and neither takes a lock: a backend claims a position by
+ * advancing the tail and marks the request as complete through the sequence
+ * number of its entry, which the launcher advances again once it read it.
+ *
+ * cron.job_trigger() uses the same queue, but only adds a request for a job
+ * if the job has none in the queue yet, which it keeps track of through a
+ * slot that holds the ID of the job that was last triggered. cron.cancel_run()
+ * uses it to ask the launcher to stop a run.
+ *
+ * Sessions in cron.wait_for_run() claim a waiter slot holding the run ID and
+ * their latch, which the launcher sets when the run ends.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "libpq-fe.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/tuplestore.h"
+
+#include "job_metadata.h"
+#include "lt_shared_state.h"
+
+
+/* number of columns returned by cron.running_jobs() */
+#define RUNNING_JOBS_COLUMNS 9
+
+
+/*
+ * CronRunRequest is an entry of the cron.run_job() queue. Its sequence is
+ * one past its position once the request is complete, and is advanced by
+ * the size of the queue when the launcher took it out.
+ */
+typedef struct CronRunRequest
+{
+	pg_atomic_uint32 sequence;
+	int64 jobId;
+	int64 runId;
+	CronRequestType type;
+} CronRunRequest;
+
+
+/*
+ * CronRunWaiter is a session that waits for a run to end. A free slot has
+ * run ID 0, and RUN_WAITER_CLAIMED while a session sets it up. The launcher
+ * stores the ID of the run that ended rather than a flag, since the slot may
+ * be taken over by a session waiting for another run in the meantime.
+ */
+typedef struct CronRunWaiter
+{
+	pg_atomic_uint64 runId;
+	Latch *latch;
+	pg_atomic_uint64 wokenRunId;
+} CronRunWaiter;
+
+#define RUN_WAITER_CLAIMED PG_UINT64_MAX
+
+
+/*
+ * CronSharedState is the shared array of task slots, together with the
+ * queue of cron.run_job() requests, the sessions that wait for runs and the
+ * latch that wakes the launcher.
+ */
+typedef struct CronSharedState
+{
+	Latch *launcherLatch;
+	pg_atomic_uint32 requestTail;
+	uint32 requestHead;
+	CronRunRequest requests[RUN_REQUEST_QUEUE_SIZE];
+	pg_atomic_uint64 triggeredJobs[JOB_TRIGGER_SLOTS];
+	pg_atomic_uint32 waiterCount;
+	CronRunWaiter waiters[RUN_WAITER_SLOTS];
+	int slotCount;
+	CronSharedTask slots[FLEXIBLE_ARRAY_MEMBER];
+} CronSharedState;
+
+
+static Size SharedTaskStateSize(void);
+#if PG_VERSION_NUM >= 150000
+static void CronSharedStateRequest(void);
+#endif
+static void CronSharedStateStartup(void);
+static void ClearLauncherLatch(int code, Datum arg);
+static bool PushRequest(int64 jobId, int64 runId, CronRequestType type);
+static void BeginSharedTaskWrite(CronSharedTask *slot);
+static void EndSharedTaskWrite(CronSharedTask *slot);
+static void ReadSharedTask(CronSharedTask *slot, CronSharedTask *copy);
+static int TaskBackendPid(CronTask *task);
+static const char * TaskStateName(CronTaskState state);
+
+PG_FUNCTION_INFO_V1(cron_running_jobs);
+
+
+/* GUC settings */
+int CronSharedTaskSlots = 4096;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+static CronSharedState *SharedState = NULL;
+
+/* the slots that the launcher can hand out */
+static int *FreeSlots = NULL;
+static int FreeSlotCount = 0;
+static bool SlotsExhaustedReported = false;
+
+
+/*
+ * InitializeSharedStateHooks reserves the shared memory for the task slots.
+ * Called from _PG_init.
+ */
+void
+InitializeSharedStateHooks(void)
+{
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = CronSharedStateRequest;
+#else
+	RequestAddinShmemSpace(SharedTaskStateSize());
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = CronSharedStateStartup;
+}
+
+
+/*
+ * SharedTaskStateSize returns the size of the shared task slots.
+ */
+static Size
+SharedTaskStateSize(void)
+{
+	return add_size(offsetof(CronSharedState, slots),
+					mul_size(CronSharedTaskSlots, sizeof(CronSharedTask)));
+}
+
+
+#if PG_VERSION_NUM >= 150000
+/*
+ * CronSharedStateRequest requests the shared memory for the task slots.
+ */
+static void
+CronSharedStateRequest(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(SharedTaskStateSize());
+}
+#endif
+
+
+/*
+ * CronSharedStateStartup creates or attaches to the shared task slots.
+ */
+static void
+CronSharedStateStartup(void)
+{
+	bool found = false;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	SharedState = ShmemInitStruct("pg_cron task states", SharedTaskStateSize(), &found);
+	if (!found)
+	{
+		int slotIndex = 0;
+		int requestIndex = 0;
+
+		SharedState->launcherLatch = NULL;
+		pg_atomic_init_u32(&SharedState->requestTail, 0);
+		SharedState->requestHead = 0;
+
+		for (requestIndex = 0; requestIndex < RUN_REQUEST_QUEUE_SIZE; requestIndex++)
+		{
+			pg_atomic_init_u32(&SharedState->requests[requestIndex].sequence,
+							   requestIndex);
+		}
+
+		for (requestIndex = 0; requestIndex < JOB_TRIGGER_SLOTS; requestIndex++)
+		{
+			pg_atomic_init_u64(&SharedState->triggeredJobs[requestIndex], 0);
+		}
+
+		pg_atomic_init_u32(&SharedState->waiterCount, 0);
+
+		for (requestIndex = 0; requestIndex < RUN_WAITER_SLOTS; requestIndex++)
+		{
+			CronRunWaiter *waiter = &SharedState->waiters[requestIndex];
+
+			pg_atomic_init_u64(&waiter->runId, 0);
+			waiter->latch = NULL;
+			pg_atomic_init_u64(&waiter->wokenRunId, 0);
+		}
+
+		SharedState->slotCount = CronSharedTaskSlots;
+
+		for (slotIndex = 0; slotIndex < SharedState->slotCount; slotIndex++)
+		{
+			CronSharedTask *slot = &SharedState->slots[slotIndex];
+
+			memset(slot, 0, sizeof(CronSharedTask));
+			pg_atomic_init_u32(&slot->changeCount, 0);
+		}
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+
+/*
+ * ResetSharedTaskStates clears the slots that a previous launcher may have
+ * left behind, makes all of them available to the launcher and lets
+ * cron.run_job() wake the launcher up.
+ */
+void
+ResetSharedTaskStates(void)
+{
+	int slotIndex = 0;
+
+	if (SharedState == NULL)
+	{
+		return;
+	}
+
+	FreeSlots = MemoryContextAlloc(TopMemoryContext,
+								   sizeof(int) * (SharedState->slotCount + 1));
+	FreeSlotCount = 0;
+
+	/* hand out the lowest slots first, so that readers have less to skip */
+	for (slotIndex = SharedState->slotCount - 1; slotIndex >= 0; slotIndex--)
+	{
+		CronSharedTask *slot = &SharedState->slots[slotIndex];
+
+		if (pg_atomic_read_u32(&slot->changeCount) % 2 != 0)
+		{
+			/* the previous launcher exited while writing the slot */
+			pg_atomic_fetch_add_u32(&slot->changeCount, 1);
+		}
+
+		BeginSharedTaskWrite(slot);
+		slot->inUse = false;
+		EndSharedTaskWrite(slot);
+
+		FreeSlots[FreeSlotCount++] = slotIndex;
+	}
+
+	SharedState->launcherLatch = MyLatch;
+	on_shmem_exit(ClearLauncherLatch, 0);
+}
+
+
+/*
+ * ClearLauncherLatch stops cron.run_job() from setting the latch of the
+ * launcher once it exits.
+ */
+static void
+ClearLauncherLatch(int code, Datum arg)
+{
+	SharedState->launcherLatch = NULL;
+}
+
+
+/*
+ * AcquireSharedTaskSlot gives a new task a slot and publishes its state. If
+ * all slots are taken, the task is not shown in cron.running_jobs().
+ */
+void
+AcquireSharedTaskSlot(CronTask *task)
+{
+	task->sharedSlot = -1;
+
+	if (FreeSlots == NULL)
+	{
+		return;
+	}
+
+	if (FreeSlotCount == 0)
+	{
+		if (!SlotsExhaustedReported)
+		{
+			ereport(WARNING, (errmsg("not all pg_cron jobs are shown in cron.running_jobs()"),
+							  errhint("Consider increasing cron.shared_task_slots.")));
+			SlotsExhaustedReported = true;
+		}
+
+		return;
+	}
+
+	task->sharedSlot = FreeSlots[--FreeSlotCount];
+
+	PublishTaskState(task);
+}
+
+
+/*
+ * PublishTaskState copies the state of a task into its slot, unless nothing
+ * that is shown changed.
+ */
+void
+PublishTaskState(CronTask *task)
+{
+	CronSharedTask *slot = NULL;
+	bool isWaiting = task->state == CRON_TASK_WAITING;
+	bool runStarted = false;
+	uint32 queuedRunCount = task->pendingRunCount;
+	int pid = 0;
+
+	if (task->sharedSlot < 0)
+	{
+		return;
+	}
+
+	/* the launcher is the only writer, so it reads its slots directly */
+	slot = &SharedState->slots[task->sharedSlot];
+	runStarted = !isWaiting && (!slot->inUse || slot->state == CRON_TASK_WAITING);
+
+	if (!isWaiting)
+	{
+		/* the run in progress is not queued */
+		if (queuedRunCount > 0)
+			queuedRunCount--;
+
+		pid = slot->pid;
+		if (runStarted || pid == 0)
+			pid = TaskBackendPid(task);
+	}
+
+	if (slot->inUse && !runStarted && slot->state == task->state &&
+		slot->runId == task->run.runId && slot->pendingRunCount == queuedRunCount &&
+		slot->startDeadline == task->run.startDeadline && slot->pid == pid)
+	{
+		return;
+	}
+
+	BeginSharedTaskWrite(slot);
+
+	if (!slot->inUse || runStarted)
+	{
+		CronJob *cronJob = GetCronJob(task->jobId);
+
+		if (cronJob != NULL)
+			namestrcpy(&slot->userName, cronJob->userName);
+
+		slot->runStartTime = runStarted ? GetCurrentTimestamp() : 0;
+	}
+
+	slot->inUse = true;
+	slot->isRunInstance = task->isRunInstance;
+	slot->state = task->state;
+	slot->jobId = task->jobId;
+	slot->runId = task->run.runId;
+	slot->pendingRunCount = queuedRunCount;
+	slot->pid = pid;
+	slot->startDeadline = task->run.startDeadline;
+
+	EndSharedTaskWrite(slot);
+}
+
+
+/*
+ * ReleaseSharedTaskSlot clears the slot of a task that is removed and makes
+ * it available for another task.
+ */
+void
+ReleaseSharedTaskSlot(CronTask *task)
+{
+	CronSharedTask *slot = NULL;
+
+	if (task->sharedSlot < 0)
+	{
+		return;
+	}
+
+	slot = &SharedState->slots[task->sharedSlot];
+
+	BeginSharedTaskWrite(slot);
+	slot->inUse = false;
+	EndSharedTaskWrite(slot);
+
+	FreeSlots[FreeSlotCount++] = task->sharedSlot;
+	task->sharedSlot = -1;
+}
+
+
+/*
+ * EnsureSharedStateLoaded throws an error if the launcher cannot be reached
+ * through shared memory, because pg_cron was not preloaded.
+ */
+void
+EnsureSharedStateLoaded(void)
+{
+	if (SharedState == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						errmsg("pg_cron is not loaded"),
+						errhint("Add pg_cron to shared_preload_libraries.")));
+	}
+}
+
+
+/*
+ * PushRunRequest asks the launcher to start a run of a job with the given
+ * run ID and wakes it up. Returns false if the queue is full.
+ */
+bool
+PushRunRequest(int64 jobId, int64 runId)
+{
+	EnsureSharedStateLoaded();
+
+	return PushRequest(jobId, runId, CRON_REQUEST_RUN);
+}
+
+
+/*
+ * PushJobTrigger asks the launcher to run a job once more, unless a request
+ * for the job is in the queue already. Does not throw errors, since it is
+ * called at commit. Returns false if the request could not be added.
+ */
+bool
+PushJobTrigger(int64 jobId)
+{
+	pg_atomic_uint64 *triggeredJob = NULL;
+	uint64 expectedJobId = 0;
+
+	if (SharedState == NULL)
+	{
+		return false;
+	}
+
+	triggeredJob = &SharedState->triggeredJobs[(uint64) jobId % JOB_TRIGGER_SLOTS];
+
+	if (!pg_atomic_compare_exchange_u64(triggeredJob, &expectedJobId, (uint64) jobId) &&
+		expectedJobId == (uint64) jobId)
+	{
+		/* the launcher did not take out the last request yet */
+		return true;
+	}
+
+	if (!PushRequest(jobId, 0, CRON_REQUEST_TRIGGER))
+	{
+		/* let the next trigger try again */
+		expectedJobId = (uint64) jobId;
+		(void) pg_atomic_compare_exchange_u64(triggeredJob, &expectedJobId, 0);
+
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * PushCancelRequest asks the launcher to stop a run of a job and wakes it up.
+ * Returns false if the queue is full.
+ */
+bool
+PushCancelRequest(int64 jobId, int64 runId)
+{
+	EnsureSharedStateLoaded();
+
+	return PushRequest(jobId, runId, CRON_REQUEST_CANCEL);
+}
+
+
+/*
+ * PushRequest adds a request to the queue and wakes up the launcher.
+ */
+static bool
+PushRequest(int64 jobId, int64 runId, CronRequestType type)
+{
+	Latch *launcherLatch = NULL;
+	uint32 position = 0;
+
+	position = pg_atomic_read_u32(&SharedState->requestTail);
+
+	for (;;)
+	{
+		CronRunRequest *request =
+			&SharedState->requests[position % RUN_REQUEST_QUEUE_SIZE];
+		int32 lag = (int32) (pg_atomic_read_u32(&request->sequence) - position);
+
+		if (lag == 0)
+		{
+			/* on failure, position is set to the current tail */
+			if (pg_atomic_compare_exchange_u32(&SharedState->requestTail,
+											   &position, position + 1))
+			{
+				request->jobId = jobId;
+				request->runId = runId;
+				request->type = type;
+
+				pg_write_barrier();
+				pg_atomic_write_u32(&request->sequence, position + 1);
+				break;
+			}
+		}
+		else if (lag < 0)
+		{
+			/* the launcher did not take out the request a lap ago yet */
+			return false;
+		}
+		else
+		{
+			position = pg_atomic_read_u32(&SharedState->requestTail);
+		}
+	}
+
+	launcherLatch = SharedState->launcherLatch;
+	if (launcherLatch != NULL)
+	{
+		SetLatch(launcherLatch);
+	}
+
+	return true;
+}
+
+
+/*
+ * PopRunRequest takes the oldest complete request out of the cron.run_job()
+ * queue. Returns false if there is none. Only called by the launcher.
+ */
+bool
+PopRunRequest(int64 *jobId, int64 *runId, CronRequestType *type)
+{
+	uint32 position = 0;
+	CronRunRequest *request = NULL;
+
+	if (SharedState == NULL)
+	{
+		return false;
+	}
+
+	position = SharedState->requestHead;
+	request = &SharedState->requests[position % RUN_REQUEST_QUEUE_SIZE];
+
+	if (pg_atomic_read_u32(&request->sequence) != position + 1)
+	{
+		return false;
+	}
+
+	pg_read_barrier();
+
+	*jobId = request->jobId;
+	*runId = request->runId;
+	*type = request->type;
+
+	/* hand the entry back to the backends only after reading it */
+	pg_memory_barrier();
+	pg_atomic_write_u32(&request->sequence, position + RUN_REQUEST_QUEUE_SIZE);
+
+	SharedState->requestHead = position + 1;
+
+	if (*type == CRON_REQUEST_TRIGGER)
+	{
+		pg_atomic_uint64 *triggeredJob =
+			&SharedState->triggeredJobs[(uint64) *jobId % JOB_TRIGGER_SLOTS];
+		uint64 expectedJobId = (uint64) *jobId;
+
+		/* triggers from now on need a new run */
+		(void) pg_atomic_compare_exchange_u64(triggeredJob, &expectedJobId, 0);
+	}
+
+	return true;
+}
+
+
+/*
+ * RunInProgressJobId returns the job ID of the run with the given run ID if
+ * the run is in progress, or 0 if it is not.
+ */
+int64
+RunInProgressJobId(int64 runId)
+{
+	int slotIndex = 0;
+
+	if (SharedState == NULL || runId == 0)
+	{
+		return 0;
+	}
+
+	for (slotIndex = 0; slotIndex < SharedState->slotCount; slotIndex++)
+	{
+		CronSharedTask copy;
+
+		ReadSharedTask(&SharedState->slots[slotIndex], &copy);
+
+		if (copy.inUse && copy.state != CRON_TASK_WAITING && copy.runId == runId)
+		{
+			return copy.jobId;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * RegisterRunWaiter claims a waiter slot for the current session, whose latch
+ * the launcher sets once the given run ended, and returns its index.
+ */
+int
+RegisterRunWaiter(int64 runId)
+{
+	int waiterIndex = 0;
+
+	EnsureSharedStateLoaded();
+
+	for (waiterIndex = 0; waiterIndex < RUN_WAITER_SLOTS; waiterIndex++)
+	{
+		CronRunWaiter *waiter = &SharedState->waiters[waiterIndex];
+		uint64 freeRunId = 0;
+
+		if (!pg_atomic_compare_exchange_u64(&waiter->runId, &freeRunId,
+											RUN_WAITER_CLAIMED))
+		{
+			continue;
+		}
+
+		waiter->latch = MyLatch;
+		pg_atomic_write_u64(&waiter->wokenRunId, 0);
+		pg_atomic_fetch_add_u32(&SharedState->waiterCount, 1);
+
+		/*
+		 * The launcher only looks at the slot once it has the run ID. The
+		 * exchange is a full barrier, so a run that ends without the
+		 * launcher seeing the slot ended before the caller checks its
+		 * status.
+		 */
+		(void) pg_atomic_exchange_u64(&waiter->runId, (uint64) runId);
+
+		return waiterIndex;
+	}
+
+	ereport(ERROR, (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+					errmsg("too many sessions are waiting for pg_cron runs"),
+					errdetail("At most %d sessions can wait at a time.",
+							  RUN_WAITER_SLOTS)));
+
+	return -1;
+}
+
+
+/*
+ * RunWaiterIsWoken returns whether the run that the waiter waits for ended.
+ */
+bool
+RunWaiterIsWoken(int waiterIndex)
+{
+	CronRunWaiter *waiter = &SharedState->waiters[waiterIndex];
+
+	return pg_atomic_read_u64(&waiter->wokenRunId) ==
+		   pg_atomic_read_u64(&waiter->runId);
+}
+
+
+/*
+ * ReleaseRunWaiter frees a waiter slot.
+ */
+void
+ReleaseRunWaiter(int waiterIndex)
+{
+	CronRunWaiter *waiter = &SharedState->waiters[waiterIndex];
+
+	pg_atomic_write_u64(&waiter->runId, 0);
+	pg_atomic_fetch_sub_u32(&SharedState->waiterCount, 1);
+}
+
+
+/*
+ * WakeRunWaiters sets the latches of the sessions that wait for a run that
+ * ended. Only called by the launcher.
+ */
+void
+WakeRunWaiters(int64 runId)
+{
+	int waiterIndex = 0;
+
+	if (SharedState == NULL || runId == 0 ||
+		pg_atomic_read_u32(&SharedState->waiterCount) == 0)
+	{
+		return;
+	}
+
+	for (waiterIndex = 0; waiterIndex < RUN_WAITER_SLOTS; waiterIndex++)
+	{
+		CronRunWaiter *waiter = &SharedState->waiters[waiterIndex];
+
+		if (pg_atomic_read_u64(&waiter->runId) != (uint64) runId)
+		{
+			continue;
+		}
+
+		pg_read_barrier();
+
+		/*
+		 * If the waiter left and another session took the slot since the run
+		 * ID was read, the new waiter does not take the run ID for its own
+		 * and at worst sees its latch set once too often.
+		 */
+		pg_atomic_write_u64(&waiter->wokenRunId, (uint64) runId);
+		pg_memory_barrier();
+		SetLatch(waiter->latch);
+	}
+}
+
+
+/*
+ * BeginSharedTaskWrite makes the change count of a slot odd before it is
+ * written. The atomic increment is a full memory barrier.
+ */
+static void
+BeginSharedTaskWrite(CronSharedTask *slot)
+{
+	pg_atomic_fetch_add_u32(&slot->changeCount, 1);
+}
+
+
+/*
+ * EndSharedTaskWrite makes the change count of a slot even again once all
+ * of its fields are written.
+ */
+static void
+EndSharedTaskWrite(CronSharedTask *slot)
+{
+	pg_atomic_fetch_add_u32(&slot->changeCount, 1);
+}
+
+
+/*
+ * ReadSharedTask takes a consistent copy of a slot, retrying as long as the
+ * launcher is writing it.
+ */
+static void
+ReadSharedTask(CronSharedTask *slot, CronSharedTask *copy)
+{
+	for (;;)
+	{
+		uint32 changeCount = pg_atomic_read_u32(&slot->changeCount);
+
+		if (changeCount % 2 == 0)
+		{
+			pg_read_barrier();
+
+			copy->inUse = slot->inUse;
+			copy->isRunInstance = slot->isRunInstance;
+			copy->state = slot->state;
+			copy->jobId = slot->jobId;
+			copy->runId = slot->runId;
+			copy->pendingRunCount = slot->pendingRunCount;
+			copy->pid = slot->pid;
+			copy->runStartTime = slot->runStartTime;
+			copy->startDeadline = slot->startDeadline;
+			copy->userName = slot->userName;
+
+			pg_read_barrier();
+
+			if (pg_atomic_read_u32(&slot->changeCount) == changeCount)
+			{
+				return;
+			}
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+
+/*
+ * TaskBackendPid returns the process ID of the backend or background worker
+ * that executes the current run of a task, or 0 if there is none yet.
+ */
+static int
+TaskBackendPid(CronTask *task)
+{
+	pid_t pid = 0;
+
+	if (task->connection != NULL && PQstatus(task->connection) == CONNECTION_OK)
+	{
+		return PQbackendPID(task->connection);
+	}
+
+	if (task->state == CRON_TASK_BGW_RUNNING &&
+		GetBackgroundWorkerPid(&task->run.handle, &pid) == BGWH_STARTED)
+	{
+		return (int) pid;
+	}
+
+	return 0;
+}
+
+
+/*
+ * TaskStateName returns how a task state is shown in cron.running_jobs().
+ */
+static const char *
+TaskStateName(CronTaskState state)
+{
+	switch (state)
+	{
+		case CRON_TASK_WAITING:
+			return "pending";
+		case CRON_TASK_START:
+		case CRON_TASK_BGW_START:
+		case CRON_TASK_BGW_STARTING:
+			return "starting";
+		case CRON_TASK_CONNECTING:
+			return "connecting";
+		case CRON_TASK_SENDING:
+			return "sending";
+		case CRON_TASK_PREPARING:
+			return "preparing";
+		case CRON_TASK_RUNNING:
+		case CRON_TASK_RECEIVING:
+		case CRON_TASK_BGW_RUNNING:
+			return "running";
+		case CRON_TASK_BATCHED:
+			return "batched";
+		case CRON_TASK_CANCELING:
+			return "canceling";
+		case CRON_TASK_DONE:
+			return "done";
+		case CRON_TASK_ERROR:
+			return "failed";
+	}
+
+	return "unknown";
+}
+
+
+/*
+ * cron_running_jobs returns the jobs that have a run in progress or runs
+ * that are due to start, as published by the launcher. Users other than
+ * superusers only see their own jobs.
+ */
+Datum
+cron_running_jobs(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *resultInfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext oldContext = NULL;
+	bool isSuperuser = superuser();
+	char *userName = GetUserNameFromId(GetUserId(), false);
+	int slotIndex = 0;
+
+	if (resultInfo == NULL || !IsA(resultInfo, ReturnSetInfo) ||
+		!(resultInfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("set-valued function called in context that cannot "
+							   "accept a set")));
+	}
+
+	oldContext = MemoryContextSwitchTo(resultInfo->econtext->ecxt_per_query_memory);
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	resultInfo->returnMode = SFRM_Materialize;
+	resultInfo->setResult = tupleStore;
+	resultInfo->setDesc = tupleDescriptor;
+
+	MemoryContextSwitchTo(oldContext);
+
+	if (SharedState == NULL)
+	{
+		return (Datum) 0;
+	}
+
+	for (slotIndex = 0; slotIndex < SharedState->slotCount; slotIndex++)
+	{
+		CronSharedTask copy;
+		Datum values[RUNNING_JOBS_COLUMNS];
+		bool isNulls[RUNNING_JOBS_COLUMNS];
+
+		ReadSharedTask(&SharedState->slots[slotIndex], &copy);
+
+		if (!copy.inUse ||
+			(copy.state == CRON_TASK_WAITING && copy.pendingRunCount == 0))
+		{
+			continue;
+		}
+
+		if (!isSuperuser && strcmp(NameStr(copy.userName), userName) != 0)
+		{
+			continue;
+		}
+
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = Int64GetDatum(copy.jobId);
+		values[1] = Int64GetDatum(copy.runId);
+		isNulls[1] = copy.state == CRON_TASK_WAITING;
+		values[2] = CStringGetTextDatum(NameStr(copy.userName));
+		values[3] = CStringGetTextDatum(TaskStateName(copy.state));
+		values[4] = Int32GetDatum((int32) copy.pendingRunCount);
+		values[5] = BoolGetDatum(copy.isRunInstance);
+		values[6] = Int32GetDatum(copy.pid);
+		isNulls[6] = copy.pid == 0;
+		values[7] = TimestampTzGetDatum(copy.runStartTime);
+		isNulls[7] = copy.runStartTime == 0;
+		values[8] = TimestampTzGetDatum(copy.startDeadline);
+		isNulls[8] = copy.startDeadline == 0;
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+	}
+
+	return (Datum) 0;
+}
@@ -2,7 +2,15 @@
  *
  * src/lt_task_states.c
  *
- * Logic for storing and manipulating cron fixed interval mode task states.
+ * Logic for storing and manipulating the additional run instances of jobs.
+ *
+ * The task of a job holds its schedule state and its own run. Runs of the
+ * job that overlap with that run, up to the maximum concurrency of the job,
+ * each get a run instance of their own, which is a CronTask that goes
+ * through the same state machine and is linked into the list of the job.
+ *
+ * The run IDs that cron.run_job() handed out for runs that did not start yet
+ * are kept per job as well, and taken by the next runs of the job.
  *
  * lightdb add 2022/3/26 for S202203046035
  *
@@ -18,132 +26,272 @@
 #include "task_states.h"
 
 #include "access/hash.h"
+#include "lib/ilist.h"
 #include "utils/hsearch.h"
 #include "utils/memutils.h"
 
 
+/*
+ * CronJobRunInstances indexes the run instances of a job, so that the runs
+ * of one job can be found without going through all run instances.
+ */
+typedef struct CronJobRunInstances
+{
+	int64 jobId;
+	int runCount;
+	dlist_head runs;
+	dlist_head requestedRuns;
+} CronJobRunInstances;
+
+
+/*
+ * CronRequestedRun is a run ID handed out by cron.run_job().
+ */
+typedef struct CronRequestedRun
+{
+	int64 runId;
+	/* the owner of the job, who can see the run if it is dropped */
+	char userName[NAMEDATALEN];
+	dlist_node node;
+} CronRequestedRun;
+
+
 /* forward declarations */
-static HTAB * CreateCronFixedTaskHash(void);
-static CronFixedTask * GetCronFixedTask(int64 runId, CronTask *task);
+static HTAB * CreateCronJobRunInstancesHash(void);
+static CronJobRunInstances * GetJobRunInstances(int64 jobId);
 
 /* global variables */
-static MemoryContext CronFixedTaskContext = NULL;
-static HTAB *CronFixedTaskHash = NULL;
+static MemoryContext CronRunInstanceContext = NULL;
+static HTAB *CronJobRunInstancesHash = NULL;
+static int CronRunInstanceCount = 0;
 
 
 /*
- * InitializeFixedTaskStateHash initializes the hash for storing fixed interval mode task states.
+ * InitializeRunInstanceHash initializes the hash for storing run instances.
  */
 void
-InitializeFixedTaskStateHash(void)
+InitializeRunInstanceHash(void)
 {
-	CronFixedTaskContext = AllocSetContextCreate(CurrentMemoryContext,
-											"pg_cron fixed task context",
+	CronRunInstanceContext = AllocSetContextCreate(CurrentMemoryContext,
+											"pg_cron run instance context",
 											ALLOCSET_DEFAULT_MINSIZE,
 											(ALLOCSET_DEFAULT_INITSIZE * 8),
 											ALLOCSET_DEFAULT_MAXSIZE);
 
-	CronFixedTaskHash = CreateCronFixedTaskHash();
+	CronJobRunInstancesHash = CreateCronJobRunInstancesHash();
 }
 
 /*
- * CreateCronFixedTaskHash creates the hash for storing cron fixed interval mode task states.
+ * CreateCronJobRunInstancesHash creates the hash for looking up the run
+ * instances of a job.
  */
 static HTAB *
-CreateCronFixedTaskHash(void)
+CreateCronJobRunInstancesHash(void)
 {
-	HTAB *taskHash = NULL;
+	HTAB *jobRunsHash = NULL;
 	HASHCTL info;
 	int hashFlags = 0;
 
 	memset(&info, 0, sizeof(info));
 	info.keysize = sizeof(int64);
-	info.entrysize = sizeof(CronFixedTask);
+	info.entrysize = sizeof(CronJobRunInstances);
 	info.hash = tag_hash;
-	info.hcxt = CronFixedTaskContext;
+	info.hcxt = CronRunInstanceContext;
 	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
 
-	taskHash = hash_create("pg_cron fixed interval tasks", (32 * 16), &info, hashFlags);
+	jobRunsHash = hash_create("pg_cron run instances per job", 32, &info, hashFlags);
 
-	return taskHash;
+	return jobRunsHash;
 }
 
 /*
- * RefreshFixedTaskHash reloads the cron fixed tasks from the cron task list.
+ * GetJobRunInstances returns the entry of a job in the run instances hash,
+ * creating it if the job has none yet.
  */
-void
-RefreshFixedTaskHash(CronTask *task)
+static CronJobRunInstances *
+GetJobRunInstances(int64 jobId)
 {
-	int64 runId = 0;
+	CronJobRunInstances *jobRuns = NULL;
+	bool isPresent = false;
 
-	if (NULL == task)
+	jobRuns = hash_search(CronJobRunInstancesHash, &jobId, HASH_ENTER, &isPresent);
+	if (!isPresent)
 	{
-		elog(INFO, "RefreshFixedTaskHash task parameter is NULL");
-		return;
+		jobRuns->runCount = 0;
+		dlist_init(&jobRuns->runs);
+		dlist_init(&jobRuns->requestedRuns);
 	}
 
-	runId = NextRunId();
-	GetCronFixedTask(runId, task);
+	return jobRuns;
 }
 
 /*
- * GetCronFixedTask gets the current fixed interval mode task with the given run ID.
+ * StartRunInstance creates a run instance that takes one pending run of the
+ * given task, and links it into the list of the job. The instance starts out
+ * waiting and picks up the mode, command type and state of the job.
  */
-static CronFixedTask *
-GetCronFixedTask(int64 runId, CronTask *task)
+CronTask *
+StartRunInstance(CronTask *task)
 {
-	CronFixedTask *_curTask = NULL;
-	int64 hashKey = runId;
+	CronJobRunInstances *jobRuns = NULL;
+	CronTask *run = NULL;
+
+	run = MemoryContextAllocZero(CronRunInstanceContext, sizeof(CronTask));
+	InitializeCronTask(run, task->jobId);
+
+	run->isRunInstance = true;
+	run->isActive = task->isActive;
+	run->mode = task->mode;
+	run->commandtype = task->commandtype;
+	run->pendingRunCount = 1;
+	EnqueueTask(run);
+
+	jobRuns = GetJobRunInstances(task->jobId);
+	dlist_push_tail(&jobRuns->runs, &run->runNode);
+	jobRuns->runCount++;
+	CronRunInstanceCount++;
+
+	return run;
+}
+
+/*
+ * JobRunInstances returns the list of run instances of a job, or NULL if the
+ * job never had any. The list links the runNode of the instances.
+ */
+dlist_head *
+JobRunInstances(int64 jobId)
+{
+	CronJobRunInstances *jobRuns = NULL;
 	bool isPresent = false;
-	int offsetlen = 0;
 
-	_curTask = hash_search(CronFixedTaskHash, &hashKey, HASH_ENTER, &isPresent);
-	if (_curTask && !isPresent)
-	{
-		if (NULL == task)
-		{
-			elog(INFO, "GetCronFixedTask task parameter is NULL");
-			return NULL;
-		}
-		
-		offsetlen = sizeof(task->jobId) + sizeof(task->runId);
-		task->runId = runId;
-		_curTask->runId = task->runId;
-		_curTask->jobId = task->jobId;
-		memcpy((char*)_curTask + offsetlen, (char*)task + offsetlen, sizeof(CronTask) - offsetlen);
-	}
+	jobRuns = hash_search(CronJobRunInstancesHash, &jobId, HASH_FIND, &isPresent);
+	if (!isPresent)
+		return NULL;
 
-	return _curTask;
+	return &jobRuns->runs;
 }
 
 /*
- * CurrentFixedTaskList extracts the current list of tasks from the
- * cron fixed interval task hash.
+ * JobRunInstanceCount returns the number of run instances of a job.
  */
-List *
-CurrentFixedTaskList(void)
+int
+JobRunInstanceCount(int64 jobId)
 {
-	List *taskList = NIL;
-	CronTask *task = NULL;
-	HASH_SEQ_STATUS status;
+	CronJobRunInstances *jobRuns = NULL;
+	bool isPresent = false;
 
-	hash_seq_init(&status, CronFixedTaskHash);
+	jobRuns = hash_search(CronJobRunInstancesHash, &jobId, HASH_FIND, &isPresent);
+	if (!isPresent)
+		return 0;
 
-	while ((task = hash_seq_search(&status)) != NULL)
-	{
-		taskList = lappend(taskList, task);
-	}
+	return jobRuns->runCount;
+}
 
-	return taskList;
+/*
+ * RunInstanceCount returns the number of run instances of all jobs.
+ */
+int
+RunInstanceCount(void)
+{
+	return CronRunInstanceCount;
 }
 
 /*
- * RemoveFixedTask remove the task for the given run ID.
+ * RemoveRunInstance unlinks a finished run instance from the list of its job
+ * and frees it.
  */
 void
-RemoveFixedTask(int64 runId)
+RemoveRunInstance(CronTask *run)
 {
-	bool isPresent = false;
+	CronJobRunInstances *jobRuns = NULL;
 
-	hash_search(CronFixedTaskHash, &runId, HASH_REMOVE, &isPresent);
+	Assert(run->isRunInstance);
+
+	/* the per-job entry is kept, so that lists being walked stay valid */
+	jobRuns = hash_search(CronJobRunInstancesHash, &run->jobId, HASH_FIND, NULL);
+	if (jobRuns != NULL)
+		jobRuns->runCount--;
+
+	dlist_delete(&run->runNode);
+	DequeueTask(run);
+	CronRunInstanceCount--;
+
+	if (run->commandKey != NULL)
+		pfree(run->commandKey);
+
+	pfree(run);
+}
+
+/*
+ * AddRequestedRun remembers a run ID that cron.run_job() handed out for the
+ * next run of a job.
+ */
+void
+AddRequestedRun(int64 jobId, int64 runId, char *userName)
+{
+	CronJobRunInstances *jobRuns = GetJobRunInstances(jobId);
+	CronRequestedRun *requestedRun = NULL;
+
+	requestedRun = MemoryContextAllocZero(CronRunInstanceContext,
+										  sizeof(CronRequestedRun));
+	requestedRun->runId = runId;
+	if (userName != NULL)
+		strlcpy(requestedRun->userName, userName, NAMEDATALEN);
+
+	dlist_push_tail(&jobRuns->requestedRuns, &requestedRun->node);
+}
+
+/*
+ * TakeRequestedRunId returns the oldest run ID that cron.run_job() handed out
+ * for a job, or 0 if there is none.
+ */
+int64
+TakeRequestedRunId(int64 jobId)
+{
+	CronJobRunInstances *jobRuns = NULL;
+	CronRequestedRun *requestedRun = NULL;
+	int64 runId = 0;
+
+	jobRuns = hash_search(CronJobRunInstancesHash, &jobId, HASH_FIND, NULL);
+	if (jobRuns == NULL || dlist_is_empty(&jobRuns->requestedRuns))
+		return 0;
+
+	requestedRun = dlist_container(CronRequestedRun, node,
+								   dlist_pop_head_node(&jobRuns->requestedRuns));
+	runId = requestedRun->runId;
+	pfree(requestedRun);
+
+	return runId;
+}
+
+/*
+ * DropRequestedRuns gives up the run IDs handed out for a job that is
+ * removed, so that sessions waiting for them learn that they failed.
+ */
+void
+DropRequestedRuns(int64 jobId)
+{
+	CronJobRunInstances *jobRuns = NULL;
+
+	jobRuns = hash_search(CronJobRunInstancesHash, &jobId, HASH_FIND, NULL);
+	if (jobRuns == NULL)
+		return;
+
+	while (!dlist_is_empty(&jobRuns->requestedRuns))
+	{
+		CronRequestedRun *requestedRun =
+			dlist_container(CronRequestedRun, node,
+							dlist_pop_head_node(&jobRuns->requestedRuns));
+
+		ereport(LOG, (errmsg("run " INT64_FORMAT " requested for cron job "
+							 INT64_FORMAT " was dropped with the job",
+							 requestedRun->runId, jobId)));
+
+		DropRequestedRun(jobId, requestedRun->runId,
+						 requestedRun->userName[0] != '\0' ?
+						 requestedRun->userName : NULL,
+						 "job removed before the run started");
+
+		pfree(requestedRun);
+	}
 }
@@ -0,0 +1,769 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/lt_worker_pool.c
+ *
+ * A pool of long-lived background workers that execute cron jobs.
+ *
+ * Starting a background worker per run costs a postmaster fork and a full
+ * backend initialization. Pool workers are started once per database and
+ * user and then receive one command after another over a shm_mq, so that
+ * starting a job only costs sending a message. A worker is recycled after
+ * a number of runs, after being idle for a while, or after a run that was
+ * canceled or lost its worker.
+ *
+ * Between runs, a pool worker resets its session like DISCARD ALL does, so
+ * that settings, roles, temporary tables, prepared statements, listeners and
+ * advisory locks of one job do not leak into the next one.
+ *
+ * Since pool workers run the same jobs over and over, they keep a plan per
+ * job for commands consisting of a single plannable statement. The plan is
+ * kept in the plan cache, so DDL on the objects it uses invalidates it as
+ * usual, and it is replaced when the command or the profile of the job
+ * changes.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+
+#include "access/hash.h"
+#include "access/xact.h"
+#include "catalog/namespace.h"
+#include "commands/async.h"
+#include "commands/prepare.h"
+#include "commands/sequence.h"
+#include "libpq/pqformat.h"
+#include "libpq/pqmq.h"
+#include "libpq/pqsignal.h"
+#include "nodes/parsenodes.h"
+#include "nodes/pg_list.h"
+#include "parser/analyze.h"
+#include "storage/ipc.h"
+#include "storage/lock.h"
+#include "storage/proc.h"
+#include "storage/shm_toc.h"
+#include "tcop/dest.h"
+#include "tcop/pquery.h"
+#include "tcop/tcopprot.h"
+#include "tcop/utility.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/plancache.h"
+#include "utils/portal.h"
+#include "utils/ps_status.h"
+#include "utils/snapmgr.h"
+#include "utils/timeout.h"
+
+#include "pg_cron.h"
+#include "lt_job_profile.h"
+#include "lt_worker_pool.h"
+
+
+/* Table-of-contents constants for the DSM segment of a pool worker. */
+#define PG_CRON_POOL_MAGIC			0x51028081
+#define PG_CRON_POOL_KEY_DATABASE	0
+#define PG_CRON_POOL_KEY_USERNAME	1
+#define PG_CRON_POOL_KEY_COMMANDQ	2
+#define PG_CRON_POOL_KEY_RESPONSEQ	3
+#define PG_CRON_POOL_NKEYS			4
+
+#define POOL_QUEUE_SIZE ((Size) 65536)
+
+
+/*
+ * CronCachedPlan is an entry in the plan cache of a pool worker. The plan of
+ * a job is only used as long as the command of the job has the same hash and
+ * the job is run with the same profile, whose settings affect planning.
+ */
+typedef struct CronCachedPlan
+{
+	int64 jobId;
+	uint32 commandHash;
+	uint32 profileHash;
+	CachedPlanSource *plansource;
+} CronCachedPlan;
+
+
+static CronPoolWorker * StartPoolWorker(const char *database, const char *userName,
+										char **errorMessage);
+static void StopPoolWorker(CronPoolWorker *worker);
+static bool PoolWorkerIsAlive(CronPoolWorker *worker);
+static void ResetPoolWorkerSession(void);
+static void ExecutePoolWorkerCommand(int64 jobId, const char *profile,
+									 const char *command);
+#if PG_VERSION_NUM >= 100000
+static CachedPlanSource * GetJobPlanSource(int64 jobId, const char *profile,
+										   const char *command);
+static bool IsCacheableStatement(RawStmt *parsetree);
+#endif
+
+
+/* GUC settings */
+bool CronUseWorkerPool = false;
+int CronPoolWorkerMaxRuns = 1000;
+int CronPoolWorkerIdleTimeout = 60000;
+
+/* pool workers of the launcher, allocated in TopMemoryContext */
+static List *PoolWorkerList = NIL;
+
+/* plans of the jobs run by a pool worker, keyed by job ID */
+static HTAB *CachedPlanHash = NULL;
+
+
+/*
+ * AcquirePoolWorker returns an idle pool worker that is connected to the given
+ * database as the given user, starting a new one if there is none. Returns
+ * NULL and sets errorMessage if no worker could be started.
+ */
+CronPoolWorker *
+AcquirePoolWorker(const char *database, const char *userName, char **errorMessage)
+{
+	ListCell *workerCell = NULL;
+	CronPoolWorker *worker = NULL;
+
+	foreach(workerCell, PoolWorkerList)
+	{
+		CronPoolWorker *candidate = (CronPoolWorker *) lfirst(workerCell);
+
+		if (candidate->isBusy ||
+			strcmp(candidate->database, database) != 0 ||
+			strcmp(candidate->userName, userName) != 0)
+		{
+			continue;
+		}
+
+		if (!PoolWorkerIsAlive(candidate))
+		{
+			/* exited on its own, e.g. after being terminated */
+			continue;
+		}
+
+		worker = candidate;
+		break;
+	}
+
+	if (worker == NULL)
+	{
+		worker = StartPoolWorker(database, userName, errorMessage);
+	}
+
+	if (worker == NULL)
+	{
+		CronPoolWorker *idleWorker = NULL;
+
+		/*
+		 * Idle workers for other databases or users hold on to background
+		 * worker slots, give up one of them and try again.
+		 */
+		foreach(workerCell, PoolWorkerList)
+		{
+			CronPoolWorker *candidate = (CronPoolWorker *) lfirst(workerCell);
+
+			if (!candidate->isBusy)
+			{
+				idleWorker = candidate;
+				break;
+			}
+		}
+
+		if (idleWorker == NULL)
+			return NULL;
+
+		StopPoolWorker(idleWorker);
+
+		worker = StartPoolWorker(database, userName, errorMessage);
+		if (worker == NULL)
+			return NULL;
+	}
+
+	worker->isBusy = true;
+
+	return worker;
+}
+
+
+/*
+ * SendPoolWorkerCommand hands the command of a job to an idle pool worker.
+ * The message consists of the job ID followed by the profile and the command
+ * of the job. Returns false if the worker went away in the meantime.
+ */
+bool
+SendPoolWorkerCommand(CronPoolWorker *worker, int64 jobId, const char *profile,
+					  const char *command)
+{
+	shm_mq_result res;
+	Size profileLength = strlen(profile) + 1;
+	Size commandLength = strlen(command) + 1;
+	Size messageLength = sizeof(int64) + profileLength + commandLength;
+	char *message = palloc(messageLength);
+
+	memcpy(message, &jobId, sizeof(int64));
+	memcpy(message + sizeof(int64), profile, profileLength);
+	memcpy(message + sizeof(int64) + profileLength, command, commandLength);
+
+#if PG_VERSION_NUM >= 150000
+	res = shm_mq_send(worker->commandq, messageLength, message, false, true);
+#else
+	res = shm_mq_send(worker->commandq, messageLength, message, false);
+#endif
+
+	pfree(message);
+
+	return res == SHM_MQ_SUCCESS;
+}
+
+
+/*
+ * ReleasePoolWorker returns a worker to the pool after a run. Workers that
+ * are not reusable, because the run was canceled or the worker went away, and
+ * workers that reached cron.pool_worker_max_runs are stopped.
+ */
+void
+ReleasePoolWorker(CronPoolWorker *worker, bool reusable)
+{
+	worker->runCount++;
+	worker->isBusy = false;
+	worker->idleSince = GetCurrentTimestamp();
+
+	if (!reusable || worker->runCount >= CronPoolWorkerMaxRuns)
+	{
+		StopPoolWorker(worker);
+	}
+}
+
+
+/*
+ * RecycleIdlePoolWorkers stops pool workers that have been idle for longer
+ * than cron.pool_worker_idle_timeout or that exited on their own.
+ */
+void
+RecycleIdlePoolWorkers(TimestampTz currentTime)
+{
+	ListCell *workerCell = NULL;
+	List *stopList = NIL;
+
+	foreach(workerCell, PoolWorkerList)
+	{
+		CronPoolWorker *worker = (CronPoolWorker *) lfirst(workerCell);
+
+		if (worker->isBusy)
+			continue;
+
+		if (!PoolWorkerIsAlive(worker) ||
+			TimestampDifferenceExceeds(worker->idleSince, currentTime,
+									   CronPoolWorkerIdleTimeout))
+		{
+			stopList = lappend(stopList, worker);
+		}
+	}
+
+	foreach(workerCell, stopList)
+	{
+		StopPoolWorker((CronPoolWorker *) lfirst(workerCell));
+	}
+
+	list_free(stopList);
+}
+
+
+/*
+ * StartPoolWorker creates the DSM segment with the command and response queues
+ * of a new pool worker and starts the worker.
+ */
+static CronPoolWorker *
+StartPoolWorker(const char *database, const char *userName, char **errorMessage)
+{
+	BackgroundWorker bgw;
+	BackgroundWorkerHandle *handle;
+	shm_toc_estimator e;
+	shm_toc *toc;
+	shm_mq *commandq;
+	shm_mq *responseq;
+	char *sharedDatabase;
+	char *sharedUserName;
+	Size segsize;
+	MemoryContext oldcontext;
+	CronPoolWorker *worker = NULL;
+
+	shm_toc_initialize_estimator(&e);
+	shm_toc_estimate_chunk(&e, strlen(database) + 1);
+	shm_toc_estimate_chunk(&e, strlen(userName) + 1);
+	shm_toc_estimate_chunk(&e, POOL_QUEUE_SIZE);
+	shm_toc_estimate_chunk(&e, POOL_QUEUE_SIZE);
+	shm_toc_estimate_keys(&e, PG_CRON_POOL_NKEYS);
+	segsize = shm_toc_estimate(&e);
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+
+	worker = palloc0(sizeof(CronPoolWorker));
+	strlcpy(worker->database, database, NAMEDATALEN);
+	strlcpy(worker->userName, userName, NAMEDATALEN);
+
+	worker->seg = dsm_create(segsize, DSM_CREATE_NULL_IF_MAXSEGMENTS);
+	if (worker->seg == NULL)
+	{
+		MemoryContextSwitchTo(oldcontext);
+		pfree(worker);
+
+		/* the caller retries until its startup deadline passes */
+		*errorMessage = "unable to create a DSM segment; more "
+						"details may be available in the server log";
+
+		return NULL;
+	}
+
+	/* the segment lives as long as the worker, not as long as a transaction */
+	dsm_pin_mapping(worker->seg);
+
+	toc = shm_toc_create(PG_CRON_POOL_MAGIC, dsm_segment_address(worker->seg), segsize);
+
+	sharedDatabase = shm_toc_allocate(toc, strlen(database) + 1);
+	strcpy(sharedDatabase, database);
+	shm_toc_insert(toc, PG_CRON_POOL_KEY_DATABASE, sharedDatabase);
+
+	sharedUserName = shm_toc_allocate(toc, strlen(userName) + 1);
+	strcpy(sharedUserName, userName);
+	shm_toc_insert(toc, PG_CRON_POOL_KEY_USERNAME, sharedUserName);
+
+	commandq = shm_mq_create(shm_toc_allocate(toc, POOL_QUEUE_SIZE), POOL_QUEUE_SIZE);
+	shm_toc_insert(toc, PG_CRON_POOL_KEY_COMMANDQ, commandq);
+	shm_mq_set_sender(commandq, MyProc);
+
+	responseq = shm_mq_create(shm_toc_allocate(toc, POOL_QUEUE_SIZE), POOL_QUEUE_SIZE);
+	shm_toc_insert(toc, PG_CRON_POOL_KEY_RESPONSEQ, responseq);
+	shm_mq_set_receiver(responseq, MyProc);
+
+	/*
+	 * Attach the queues before launching the worker, so that the worker sees
+	 * the launcher go away if it exits.
+	 */
+	worker->commandq = shm_mq_attach(commandq, worker->seg, NULL);
+	worker->responseq = shm_mq_attach(responseq, worker->seg, NULL);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	memset(&bgw, 0, sizeof(BackgroundWorker));
+	bgw.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	bgw.bgw_start_time = BgWorkerStart_ConsistentState;
+	bgw.bgw_restart_time = BGW_NEVER_RESTART;
+	sprintf(bgw.bgw_library_name, "pg_cron");
+	sprintf(bgw.bgw_function_name, "CronPoolWorkerMain");
+#if (PG_VERSION_NUM >= 110000)
+	snprintf(bgw.bgw_type, BGW_MAXLEN, "pg_cron pool worker");
+#endif
+	snprintf(bgw.bgw_name, BGW_MAXLEN, "pg_cron pool worker for %s", database);
+	bgw.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(worker->seg));
+	bgw.bgw_notify_pid = MyProcPid;
+
+	if (!RegisterDynamicBackgroundWorker(&bgw, &handle))
+	{
+		dsm_detach(worker->seg);
+		pfree(worker);
+
+		/* the caller retries until its startup deadline passes */
+		*errorMessage = "could not start background process; more "
+						"details may be available in the server log";
+
+		return NULL;
+	}
+
+	/*
+	 * Do not wait for the worker to start. The first command is picked up
+	 * from the queue once it is up, and the launcher learns the pid of the
+	 * worker from its handle.
+	 */
+	worker->handle = *handle;
+
+	/* notice it when the worker dies instead of waiting on it forever */
+	shm_mq_set_handle(worker->commandq, &worker->handle);
+	shm_mq_set_handle(worker->responseq, &worker->handle);
+
+	worker->isBusy = false;
+	worker->runCount = 0;
+	worker->idleSince = GetCurrentTimestamp();
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	PoolWorkerList = lappend(PoolWorkerList, worker);
+	MemoryContextSwitchTo(oldcontext);
+
+	return worker;
+}
+
+
+/*
+ * StopPoolWorker removes a worker from the pool. Detaching from its queues
+ * makes the worker exit once it is done with the current command, if any.
+ */
+static void
+StopPoolWorker(CronPoolWorker *worker)
+{
+	PoolWorkerList = list_delete_ptr(PoolWorkerList, worker);
+
+	dsm_detach(worker->seg);
+	pfree(worker);
+}
+
+
+/*
+ * PoolWorkerIsAlive returns whether the process of a pool worker still runs
+ * or is about to be started by the postmaster.
+ */
+static bool
+PoolWorkerIsAlive(CronPoolWorker *worker)
+{
+	pid_t pid;
+	BgwHandleStatus status = GetBackgroundWorkerPid(&worker->handle, &pid);
+
+	return status == BGWH_STARTED || status == BGWH_NOT_YET_STARTED;
+}
+
+
+/*
+ * CronPoolWorkerMain is the entry point of a pool worker. It connects to the
+ * database once and then executes the commands it receives until the
+ * launcher detaches from its queues.
+ */
+void
+CronPoolWorkerMain(Datum main_arg)
+{
+	dsm_segment *seg;
+	shm_toc *toc;
+	char *database;
+	char *username;
+	shm_mq *commandmq;
+	shm_mq *responsemq;
+	shm_mq_handle *commandq;
+	shm_mq_handle *responseq;
+	MemoryContext runContext;
+
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	Assert(CurrentResourceOwner == NULL);
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "pg_cron pool worker");
+
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("unable to map dynamic shared memory segment")));
+	toc = shm_toc_attach(PG_CRON_POOL_MAGIC, dsm_segment_address(seg));
+	if (toc == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("bad magic number in dynamic shared memory segment")));
+
+#if PG_VERSION_NUM < 100000
+	database = shm_toc_lookup(toc, PG_CRON_POOL_KEY_DATABASE);
+	username = shm_toc_lookup(toc, PG_CRON_POOL_KEY_USERNAME);
+	commandmq = shm_toc_lookup(toc, PG_CRON_POOL_KEY_COMMANDQ);
+	responsemq = shm_toc_lookup(toc, PG_CRON_POOL_KEY_RESPONSEQ);
+#else
+	database = shm_toc_lookup(toc, PG_CRON_POOL_KEY_DATABASE, false);
+	username = shm_toc_lookup(toc, PG_CRON_POOL_KEY_USERNAME, false);
+	commandmq = shm_toc_lookup(toc, PG_CRON_POOL_KEY_COMMANDQ, false);
+	responsemq = shm_toc_lookup(toc, PG_CRON_POOL_KEY_RESPONSEQ, false);
+#endif
+
+	shm_mq_set_receiver(commandmq, MyProc);
+	commandq = shm_mq_attach(commandmq, seg, NULL);
+
+	shm_mq_set_sender(responsemq, MyProc);
+	responseq = shm_mq_attach(responsemq, seg, NULL);
+	pq_redirect_to_shm_mq(seg, responseq);
+
+#if (PG_VERSION_NUM < 110000)
+	BackgroundWorkerInitializeConnection(database, username);
+#else
+	BackgroundWorkerInitializeConnection(database, username, 0);
+#endif
+
+	runContext = AllocSetContextCreate(TopMemoryContext,
+									   "pg_cron pool worker",
+									   ALLOCSET_DEFAULT_MINSIZE,
+									   ALLOCSET_DEFAULT_INITSIZE,
+									   ALLOCSET_DEFAULT_MAXSIZE);
+
+	for (;;)
+	{
+		Size nbytes;
+		void *data;
+		int64 jobId;
+		char *profile;
+		char *command;
+		Size profileLength;
+		shm_mq_result res;
+
+		MemoryContextSwitchTo(runContext);
+		MemoryContextReset(runContext);
+
+		/* sleep until the launcher sends a command or goes away */
+		res = shm_mq_receive(commandq, &nbytes, &data, false);
+		if (res != SHM_MQ_SUCCESS || nbytes <= sizeof(int64))
+			break;
+
+		memcpy(&jobId, data, sizeof(int64));
+		profile = pnstrdup((char *) data + sizeof(int64), nbytes - sizeof(int64));
+		profileLength = strlen(profile) + 1;
+		if (nbytes <= sizeof(int64) + profileLength)
+			break;
+
+		command = pnstrdup((char *) data + sizeof(int64) + profileLength,
+						   nbytes - sizeof(int64) - profileLength);
+
+		PG_TRY();
+		{
+			/* also undoes the settings of the previous run */
+			ApplyJobProfile(profile);
+
+			BeginRunTransaction(command);
+			ExecutePoolWorkerCommand(jobId, profile, command);
+			EndRunTransaction(command);
+		}
+		PG_CATCH();
+		{
+			/* report the error to the launcher and get ready for the next run */
+			HOLD_INTERRUPTS();
+			disable_all_timeouts(false);
+			EmitErrorReport();
+			/* also leaves a transaction block the command might have opened */
+			AbortOutOfAnyTransaction();
+			FlushErrorState();
+			RESUME_INTERRUPTS();
+		}
+		PG_END_TRY();
+
+		/* the next job must not see what this one left behind in the session */
+		ResetPoolWorkerSession();
+
+		debug_query_string = NULL;
+		pgstat_report_activity(STATE_IDLE, NULL);
+		pgstat_report_stat(true);
+
+		/* Signal that we are done. */
+		ReadyForQuery(DestRemote);
+	}
+
+	dsm_detach(seg);
+	proc_exit(0);
+}
+
+
+/*
+ * ResetPoolWorkerSession does what DISCARD ALL does, except for resetting the
+ * plan cache, which holds the plans that the pool worker keeps for its jobs.
+ */
+static void
+ResetPoolWorkerSession(void)
+{
+	StartTransactionCommand();
+
+	PortalHashTableDeleteAll();
+	SetPGVariable("session_authorization", NIL, false);
+	ResetAllOptions();
+	DropAllPreparedStatements();
+	Async_UnlistenAll();
+	LockReleaseAll(USER_LOCKMETHOD, true);
+	ResetTempTableNamespace();
+	ResetSequenceCaches();
+
+	CommitTransactionCommand();
+}
+
+
+/*
+ * ExecutePoolWorkerCommand executes the command of a job, using the cached
+ * plan of the job if the command can be cached.
+ */
+static void
+ExecutePoolWorkerCommand(int64 jobId, const char *profile, const char *command)
+{
+#if PG_VERSION_NUM >= 100000
+	CachedPlanSource *plansource = GetJobPlanSource(jobId, profile, command);
+	CachedPlan *cplan = NULL;
+	Portal portal = NULL;
+	DestReceiver *receiver = NULL;
+	int16 format = 1;
+#if PG_VERSION_NUM < 130000
+	char completionTag[COMPLETION_TAG_BUFSIZE];
+#else
+	QueryCompletion qc;
+#endif
+
+	if (plansource == NULL)
+	{
+		/* not a single plannable statement */
+		ExecuteSqlString(command);
+		return;
+	}
+
+#if PG_VERSION_NUM < 130000
+	set_ps_display(plansource->commandTag, false);
+#else
+	set_ps_display(GetCommandTagName(plansource->commandTag));
+#endif
+
+	BeginCommand(plansource->commandTag, DestNone);
+
+	/* revalidates the plan, replanning if it was invalidated in the meantime */
+#if PG_VERSION_NUM >= 140000
+	cplan = GetCachedPlan(plansource, NULL, NULL, NULL);
+#else
+	cplan = GetCachedPlan(plansource, NULL, false, NULL);
+#endif
+
+	portal = CreatePortal("", true, true);
+	/* Don't display the portal in pg_cursors */
+	portal->visible = false;
+	PortalDefineQuery(portal, NULL, plansource->query_string,
+					  plansource->commandTag, cplan->stmt_list, cplan);
+	PortalStart(portal, NULL, 0, InvalidSnapshot);
+	PortalSetResultFormat(portal, 1, &format);		/* binary format */
+
+	receiver = CreateDestReceiver(DestNone);
+
+#if PG_VERSION_NUM < 130000
+	(void) PortalRun(portal, FETCH_ALL, true, true, receiver, receiver, completionTag);
+#else
+	(void) PortalRun(portal, FETCH_ALL, true, true, receiver, receiver, &qc);
+#endif
+
+	(*receiver->rDestroy) (receiver);
+
+#if PG_VERSION_NUM < 130000
+	EndCommand(completionTag, DestRemote);
+#else
+	EndCommand(&qc, DestRemote, false);
+#endif
+
+	PortalDrop(portal, false);
+
+	CommandCounterIncrement();
+#else
+	ExecuteSqlString(command);
+#endif
+}
+
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * GetJobPlanSource returns the cached plan source for the command of a job,
+ * creating it if the job has none yet or its command or profile changed.
+ * Returns NULL if the command cannot be cached.
+ */
+static CachedPlanSource *
+GetJobPlanSource(int64 jobId, const char *profile, const char *command)
+{
+	uint32 commandHash = DatumGetUInt32(hash_any((const unsigned char *) command,
+												 strlen(command)));
+	uint32 profileHash = DatumGetUInt32(hash_any((const unsigned char *) profile,
+												 strlen(profile)));
+	CronCachedPlan *cachedPlan = NULL;
+	CachedPlanSource *plansource = NULL;
+	List *raw_parsetree_list = NIL;
+	List *querytree_list = NIL;
+	RawStmt *parsetree = NULL;
+	bool snapshot_set = false;
+	bool found = false;
+
+	if (CachedPlanHash == NULL)
+	{
+		HASHCTL info;
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(int64);
+		info.entrysize = sizeof(CronCachedPlan);
+		info.hash = tag_hash;
+		info.hcxt = TopMemoryContext;
+
+		CachedPlanHash = hash_create("pg_cron cached plans", 32, &info,
+									 HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+	}
+
+	cachedPlan = hash_search(CachedPlanHash, &jobId, HASH_FIND, &found);
+	if (found)
+	{
+		if (cachedPlan->commandHash == commandHash &&
+			cachedPlan->profileHash == profileHash &&
+			strcmp(cachedPlan->plansource->query_string, command) == 0)
+		{
+			return cachedPlan->plansource;
+		}
+
+		/* the command or the profile of the job changed */
+		DropCachedPlan(cachedPlan->plansource);
+		hash_search(CachedPlanHash, &jobId, HASH_REMOVE, NULL);
+	}
+
+	raw_parsetree_list = pg_parse_query(command);
+	if (list_length(raw_parsetree_list) != 1)
+	{
+		return NULL;
+	}
+
+	parsetree = (RawStmt *) linitial(raw_parsetree_list);
+	if (!IsCacheableStatement(parsetree))
+	{
+		return NULL;
+	}
+
+	plansource = CreateCachedPlan(parsetree, command, CreateCommandTag(parsetree->stmt));
+
+	if (analyze_requires_snapshot(parsetree))
+	{
+		PushActiveSnapshot(GetTransactionSnapshot());
+		snapshot_set = true;
+	}
+
+#if PG_VERSION_NUM >= 150000
+	querytree_list = pg_analyze_and_rewrite_fixedparams(parsetree, command, NULL, 0, NULL);
+#else
+	querytree_list = pg_analyze_and_rewrite(parsetree, command, NULL, 0, NULL);
+#endif
+
+	if (snapshot_set)
+		PopActiveSnapshot();
+
+	CompleteCachedPlan(plansource, querytree_list, NULL, NULL, 0, NULL, NULL,
+					   CURSOR_OPT_PARALLEL_OK, false);
+
+	/* move the plan source to long-lived memory and register it for invalidation */
+	SaveCachedPlan(plansource);
+
+	cachedPlan = hash_search(CachedPlanHash, &jobId, HASH_ENTER, NULL);
+	cachedPlan->commandHash = commandHash;
+	cachedPlan->profileHash = profileHash;
+	cachedPlan->plansource = plansource;
+
+	return plansource;
+}
+
+
+/*
+ * IsCacheableStatement returns whether a statement goes through the planner
+ * and can therefore benefit from a cached plan.
+ */
+static bool
+IsCacheableStatement(RawStmt *parsetree)
+{
+	Node *stmt = parsetree->stmt;
+
+	if (IsA(stmt, SelectStmt) || IsA(stmt, InsertStmt) ||
+		IsA(stmt, UpdateStmt) || IsA(stmt, DeleteStmt))
+	{
+		return true;
+	}
+
+#if PG_VERSION_NUM >= 150000
+	if (IsA(stmt, MergeStmt))
+	{
+		return true;
+	}
+#endif
+
+	return false;
+}
+#endif
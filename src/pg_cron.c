@@ -24,6 +24,7 @@
 #include "storage/latch.h"
 #include "storage/lwlock.h"
 #include "storage/proc.h"
+#include "storage/procarray.h"
 #include "storage/shm_mq.h"
 #include "storage/shm_toc.h"
 #include "storage/shmem.h"
@@ -37,6 +38,10 @@
 #include "task_states.h"
 #include "job_metadata.h"
 #include "lt_linux_cron.h"
+#include "lt_worker_pool.h"
+#include "lt_run_slots.h"
+#include "lt_job_profile.h"
+#include "lt_shared_state.h"
 
 #include "poll.h"
 #include "sys/time.h"
@@ -44,12 +49,14 @@
 #include "time.h"
 
 #include "access/genam.h"
+#include "access/hash.h"
 #include "access/heapam.h"
 #include "access/htup_details.h"
 #include "access/printtup.h"
 #include "access/xact.h"
 #include "access/xlog.h"
 #include "catalog/pg_extension.h"
+#include "catalog/pg_type.h"
 #include "catalog/indexing.h"
 #include "catalog/namespace.h"
 #include "commands/async.h"
@@ -57,6 +64,7 @@
 #include "commands/extension.h"
 #include "commands/sequence.h"
 #include "commands/trigger.h"
+#include "executor/spi.h"
 #include "lib/stringinfo.h"
 #include "libpq-fe.h"
 #include "libpq/pqmq.h"
@@ -98,7 +106,16 @@ PG_MODULE_MAGIC;
 #define PG_CRON_KEY_USERNAME	1
 #define PG_CRON_KEY_COMMAND		2
 #define PG_CRON_KEY_QUEUE		3
-#define PG_CRON_NKEYS			4
+#define PG_CRON_KEY_PROFILE		4
+#define PG_CRON_NKEYS			5
+
+/* what the launcher tells workers of runs that loop, in bgw_extra */
+typedef struct CronWorkerExtra
+{
+	int64 jobId;
+	int batchTargetTime;
+	int batchPause;
+} CronWorkerExtra;
 
 /* ways in which the clock can change between main loop iterations */
 typedef enum
@@ -117,9 +134,44 @@ static void pg_cron_sighup(SIGNAL_ARGS);
 static void pg_cron_background_worker_sigterm(SIGNAL_ARGS);
 void PgCronLauncherMain(Datum arg);
 void CronBackgroundWorker(Datum arg);
-
-static void StartAllPendingRuns(List *taskList, TimestampTz currentTime);
+void CronRunSlotWorker(Datum arg);
+void CronDaemonWorker(Datum arg);
+void CronConsumerWorker(Datum arg);
+void CronChunkedWorker(Datum arg);
+void CronFanoutWorker(Datum arg);
+static void StartCronWorker(const char *contextName);
+static dsm_segment * AttachWorkerSegment(Datum main_arg, char **database, char **username,
+										 char **profile, char **command, shm_mq **mq);
+static void ConnectWorkerRun(dsm_segment *seg, shm_mq *mq, char *database,
+							 char *username, char *profile);
+static void ConnectRunSPI(void);
+static void FinishRunSPI(void);
+static void FinishWorkerRun(dsm_segment *seg);
+static void ExecuteSqlStringInContext(const char *sql, MemoryContext parsecontext);
+static void ExecuteDaemonRun(dsm_segment *seg, char *database, char *username,
+							 char *profile, char *command, shm_mq *mq);
+static void ExecuteConsumerRun(dsm_segment *seg, int64 jobId, char *database,
+							   char *username, char *profile, char *command,
+							   shm_mq *mq);
+static void ExecuteChunkedRun(dsm_segment *seg, CronWorkerExtra *extra, char *database,
+							  char *username, char *profile, char *command,
+							  shm_mq *mq);
+static void ExecuteFanoutRun(dsm_segment *seg, char *database, char *username,
+							 char *profile, char *command, shm_mq *mq);
+static char * BatchCommand(const char *command, int batchSize);
+static int AdaptBatchSize(int batchSize, long batchTime, int batchTargetTime);
+static bool ModeHasOwnWorker(int mode);
+static void ExecuteBackgroundWorkerRun(dsm_segment *seg, char *database, char *username,
+									   char *profile, char *command, shm_mq *mq);
+
+static void ProcessRunRequests(void);
+static CronTask * FindRunningTask(int64 runId);
+static void StartAllPendingRuns(TimestampTz currentTime);
 static void StartPendingRuns(CronTask *task, TimestampTz currentTime);
+static void StartDaemonRuns(CronTask *task, TimestampTz currentTime);
+static void DelayDaemonRestart(CronTask *jobTask, TimestampTz runStartTime,
+							   TimestampTz currentTime);
+static bool DaemonRunOutdated(CronTask *task, CronJob *cronJob);
 static int SecondsPassed(TimestampTz startTime, TimestampTz stopTime);
 static TimestampTz TimestampSecondStart(TimestampTz time);
 static int MinutesPassed(TimestampTz startTime, TimestampTz stopTime);
@@ -132,12 +184,29 @@ static bool isSecondSchedule(char *schedule);
 static void WaitForCronTasks(List *taskList);
 static void WaitForLatch(int timeoutMs);
 static void PollForTasks(List *taskList);
+static WaitEventSet * TaskWaitEventSet(pgsocket *sockets, int *eventMasks,
+										int socketCount, bool forceRebuild);
 static bool CanStartTask(CronTask *task);
+static int JobMaxConcurrency(CronTask *task);
+static int64 TaskRunId(CronTask *task);
 static void ManageCronTasks(List *taskList, TimestampTz currentTime);
+static void StartRunInstances(CronTask *task);
+static void StartFanoutRuns(CronTask *task);
+static bool FanoutInProgress(CronTask *task);
+static void AddFanoutTarget(CronTask *task, const char *target);
+static void DropFanoutTargets(CronTask *task);
+static char * FanoutCommand(const char *command, const char *target);
+static char * TaskCommand(CronTask *task, CronJob *cronJob);
+static char * TaskDatabase(CronTask *task, CronJob *cronJob);
+static char * TaskNodeName(CronTask *task, CronJob *cronJob);
+static int TaskNodePort(CronTask *task, CronJob *cronJob);
+static void FreeRunTargets(CronTask *task);
+static void ReportFanoutResult(CronTask *instance, bool succeeded);
+static void FinishFanout(CronTask *task);
 static void ManageCronTask(CronTask *task, TimestampTz currentTime);
-static void ExecuteSqlString(const char *sql);
 static void GetTaskFeedback(PGresult *result, CronTask *task);
-static void GetBgwTaskFeedback(shm_mq_handle *responseq, CronTask *task);
+static shm_mq_result GetBgwTaskFeedback(shm_mq_handle *responseq, CronTask *task, bool nowait);
+static void ReportBgwTaskResult(CronTask *task);
 
 static bool jobCanceled(CronTask *task);
 static bool jobStartupTimeout(CronTask *task, TimestampTz currentTime);
@@ -146,10 +215,27 @@ static void bgw_generate_returned_message(StringInfoData *display_msg, ErrorData
 
 static void clearJobRunDetails(void);
 static bool cron_task_count_check_hook(int *newval, void **extra, GucSource source);
-static void cron_list_del(List *fixedTaskList, CronTask *task);
-static int queryTaskConnections(int64 jobId);
-static bool CronFixedStartTask(CronFixedTask *task);
 static bool jobRunningTimeout(CronTask *task, TimestampTz currentTime);
+static void StartTaskCancel(CronTask *task, TimestampTz currentTime);
+static void SendConnectionCancel(CronTask *task);
+static bool ConnectionIsLocal(PGconn *connection);
+static bool NodeIsLocal(const char *host, int port);
+static CronExecutor TaskExecutor(CronTask *task, CronJob *cronJob);
+static char * TaskCommandKey(CronJob *cronJob);
+static bool TaskCommandMatches(CronTask *task, CronJob *cronJob);
+static void SetTaskCommandKey(CronTask *task, CronJob *cronJob);
+static bool CommandIsPreparable(const char *command);
+static bool KeepTaskConnection(CronTask *task, CronJob *cronJob);
+static void CloseKeptConnections(TimestampTz currentTime);
+#ifdef LIBPQ_HAS_PIPELINING
+static void FormTaskBatch(CronTask *task, CronJob *cronJob);
+static int SendTaskBatch(CronTask *task, char *command);
+static bool ReceiveTaskBatchResults(CronTask *task);
+#endif
+static void FinishTaskBatch(CronTask *task, char *errorMessage);
+static bool IsBgwRetryQueueHead(int64 runId);
+static void EnterBgwRetryQueue(int64 runId);
+static void LeaveBgwRetryQueue(int64 runId);
 
 /* global settings */
 char *CronTableDatabaseName = "postgres";
@@ -162,11 +248,33 @@ static volatile sig_atomic_t got_sigterm = false;
 
 /* global variables */
 static int CronTaskStartTimeout = 10000; /* maximum connection time */
-static const int MaxWait = 1000; /* maximum time in ms that poll() can block */
+static int CronTaskCancelTimeout = 10000; /* maximum time to wait for a canceled run to stop */
+static const int MaxWait = 1000; /* maximum time in ms that waiting for tasks can block */
+static const int BgwRetryInterval = 100; /* time in ms between attempts to get a worker slot */
+static const int BgwProgressInterval = 1000; /* time in ms between progress updates of a run */
+static const int DaemonMinBackoff = 1000; /* time in ms before restarting a daemon run that exited early */
+static const int DaemonMaxBackoff = 300000; /* longest time in ms before restarting a daemon run */
+static const int DaemonStableRunTime = 60000; /* time in ms after which a daemon run restarts right away */
+static int CronDaemonNaptime = 1000; /* time in ms between the iterations of a daemon run */
+static const int InitialBatchSize = 1000; /* rows in the first batch of a chunked run */
+static const int MaxBatchSize = 1000000; /* most rows in a batch of a chunked run */
 static bool RebootJobsScheduled = false;
 static int RunningTaskCount = 0;
 static int MaxRunningTasks = 0;
 static bool UseBackgroundWorkers = false;
+static bool CronUsePreparedStatements = false;
+static int CronMaxJobsPerBatch = 1;
+static int CronKeptConnectionIdleTimeout = 300;
+static int CronMaxKeptConnections = 10;
+
+/* runs waiting for a background worker slot, in order of arrival */
+static List *BgwRetryQueue = NIL;
+
+/* the wait event set of the launcher and the sockets it waits for */
+static WaitEventSet *CronWaitEventSet = NULL;
+static pgsocket *CronWaitSockets = NULL;
+static int *CronWaitEventMasks = NULL;
+static int CronWaitSocketCount = 0;
 
 static TimestampTz g_lastSecond = 0;
 static TimestampTz g_lastMinute = 0;
@@ -241,13 +349,93 @@ _PG_init(void)
 	DefineCustomBoolVariable(
 		"cron.use_background_workers",
 		gettext_noop("Use background workers instead of client sessions."),
-		NULL,
+		gettext_noop("Only applies to jobs that leave the choice of executor to pg_cron."),
 		&UseBackgroundWorkers,
 		false,
 		PGC_POSTMASTER,
 		GUC_SUPERUSER_ONLY,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"cron.use_worker_pool",
+		gettext_noop("Run jobs in a pool of long-lived background workers."),
+		gettext_noop("This setting only has an effect when background workers are used."),
+		&CronUseWorkerPool,
+		false,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.pool_worker_max_runs",
+		gettext_noop("Number of runs after which a pool worker is replaced."),
+		NULL,
+		&CronPoolWorkerMaxRuns,
+		1000,
+		1,
+		INT_MAX,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.pool_worker_idle_timeout",
+		gettext_noop("Time after which an idle pool worker exits."),
+		NULL,
+		&CronPoolWorkerIdleTimeout,
+		60000,
+		0,
+		INT_MAX,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY | GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"cron.use_prepared_statements",
+		gettext_noop("Keep job connections open and run single-statement jobs as prepared statements."),
+		gettext_noop("This setting has no effect when background workers are used."),
+		&CronUsePreparedStatements,
+		false,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.kept_connection_idle_timeout",
+		gettext_noop("Time after which a job connection kept open between runs is closed."),
+		gettext_noop("Zero keeps idle connections open until they are needed elsewhere."),
+		&CronKeptConnectionIdleTimeout,
+		300,
+		0,
+		INT_MAX / 1000,
+		PGC_SIGHUP,
+		GUC_SUPERUSER_ONLY | GUC_UNIT_S,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.max_kept_connections",
+		gettext_noop("Maximum number of job connections kept open between runs."),
+		NULL,
+		&CronMaxKeptConnections,
+		10,
+		0,
+		MaxConnections,
+		PGC_SIGHUP,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.max_jobs_per_batch",
+		gettext_noop("Maximum number of co-due jobs that can share one pipelined connection."),
+		gettext_noop("This setting has no effect when background workers are used."),
+		&CronMaxJobsPerBatch,
+		1,
+		1,
+		64,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
 	if (!UseBackgroundWorkers)
 		DefineCustomIntVariable(
 			"cron.max_running_jobs",
@@ -320,6 +508,32 @@ _PG_init(void)
 		GUC_SUPERUSER_ONLY,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"cron.shared_task_slots",
+		gettext_noop("Number of jobs and runs whose state is shown in cron.running_jobs()."),
+		NULL,
+		&CronSharedTaskSlots,
+		4096,
+		0,
+		1000000,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"cron.daemon_naptime",
+		gettext_noop("Time to sleep between the iterations of a daemon job."),
+		NULL,
+		&CronDaemonNaptime,
+		1000,
+		0,
+		INT_MAX,
+		PGC_POSTMASTER,
+		GUC_SUPERUSER_ONLY | GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
+	InitializeSharedStateHooks();
+
 	/* set up common data for all our workers */
 	worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
 	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
@@ -600,6 +814,12 @@ PgCronLauncherMain(Datum arg)
 		MaxRunningTasks = 1;
 	}
 
+	/* one-shot background worker runs get their parameters from a run slot */
+	if (UseBackgroundWorkers && !CronUseWorkerPool)
+	{
+		InitializeRunSlots(MaxRunningTasks);
+	}
+
 
 	CronLoopContext = AllocSetContextCreate(CurrentMemoryContext,
 											  "pg_cron loop context",
@@ -607,8 +827,9 @@ PgCronLauncherMain(Datum arg)
 											  ALLOCSET_DEFAULT_INITSIZE,
 											  ALLOCSET_DEFAULT_MAXSIZE);
 	InitializeJobMetadataCache();
+	ResetSharedTaskStates();
 	InitializeTaskStateHash();
-	InitializeFixedTaskStateHash();
+	InitializeRunInstanceHash();
 
 	ereport(LOG, (errmsg("pg_cron scheduler started")));
 
@@ -635,14 +856,23 @@ PgCronLauncherMain(Datum arg)
 
 		clearJobRunDetails();
 
-		taskList = CurrentTaskList();
 		currentTime = GetCurrentTimestamp();
 
-		StartAllPendingRuns(taskList, currentTime);
+		ProcessRunRequests();
+		StartAllPendingRuns(currentTime);
+
+		/* idle tasks have nothing to wait for or to do */
+		taskList = ActiveTaskList();
 
 		WaitForCronTasks(taskList);
 		ManageCronTasks(taskList, currentTime);
 
+		/* jobs may use the pool even if it is not the default */
+		RecycleIdlePoolWorkers(GetCurrentTimestamp());
+
+		/* connections kept for later runs must not pile up */
+		CloseKeptConnections(GetCurrentTimestamp());
+
 		MemoryContextReset(CronLoopContext);
 	}
 
@@ -672,18 +902,145 @@ clearJobRunDetails(void)
 	}
 }
 
+/*
+ * ProcessRunRequests handles the requests that backends sent through shared
+ * memory. Jobs for which cron.run_job() was called or cron.job_trigger()
+ * fired get a pending run, which then starts like any other run as soon as
+ * the concurrency of the job allows. Triggers are coalesced: they do not add
+ * a run if one is pending already, since it will see the changes that fired
+ * the trigger. Runs for which cron.cancel_run() was called are stopped the
+ * next time their task is managed.
+ */
+static void
+ProcessRunRequests(void)
+{
+	int64 jobId = 0;
+	int64 runId = 0;
+	CronRequestType type = CRON_REQUEST_RUN;
+
+	while (PopRunRequest(&jobId, &runId, &type))
+	{
+		CronTask *task = NULL;
+		CronJob *job = NULL;
+
+		if (type == CRON_REQUEST_CANCEL)
+		{
+			task = FindRunningTask(runId);
+			if (task == NULL)
+			{
+				ereport(LOG, (errmsg("run " INT64_FORMAT " of cron job " INT64_FORMAT
+									 " is not in progress, not canceled",
+									 runId, jobId)));
+				continue;
+			}
+
+			task->run.cancelRequested = true;
+			continue;
+		}
+
+		task = FindCronTask(jobId);
+		job = GetCronJob(jobId);
+		if (task == NULL || !task->isActive)
+		{
+			if (type == CRON_REQUEST_TRIGGER)
+			{
+				ereport(DEBUG1, (errmsg("cron job " INT64_FORMAT " is not active, "
+										"trigger is ignored", jobId)));
+			}
+			else
+			{
+				ereport(WARNING, (errmsg("cron job " INT64_FORMAT " is not active, "
+										 "run " INT64_FORMAT " is not started",
+										 jobId, runId)));
+
+				/* the caller of cron.run_job() may wait for the run */
+				DropRequestedRun(jobId, runId, job != NULL ? job->userName : NULL,
+								 "job not active when the run was to start");
+			}
+			continue;
+		}
+
+		/* the run in progress, if any, holds one of the pending runs */
+		if (type == CRON_REQUEST_TRIGGER &&
+			task->pendingRunCount > (task->state == CRON_TASK_WAITING ? 0 : 1))
+		{
+			continue;
+		}
+
+		if (runId != 0)
+		{
+			AddRequestedRun(jobId, runId, job != NULL ? job->userName : NULL);
+		}
+
+		task->pendingRunCount += 1;
+		RequeueTask(task);
+	}
+}
+
+/*
+ * DropRequestedRun gives up a run that cron.run_job() handed out but that
+ * will never start. The run is recorded as failed with the given message,
+ * and the sessions that wait for it are woken up.
+ */
+void
+DropRequestedRun(int64 jobId, int64 runId, char *userName, char *message)
+{
+	if (runId == 0)
+		return;
+
+	if (CronLogRun)
+	{
+		CronJob *job = GetCronJob(jobId);
+		TimestampTz endTime = GetCurrentTimestamp();
+
+		InsertJobRunDetail(runId, &jobId, job != NULL ? job->database : NULL,
+						   userName, job != NULL ? job->command : NULL,
+						   GetCronStatus(CRON_STATUS_FAILED), 0, NULL);
+		UpdateJobRunDetail(runId, NULL, GetCronStatus(CRON_STATUS_FAILED), message,
+						   NULL, &endTime);
+	}
+
+	WakeRunWaiters(runId);
+}
+
+/*
+ * FindRunningTask returns the task or run instance that runs the run with
+ * the given run ID, or NULL if the run is not in progress.
+ */
+static CronTask *
+FindRunningTask(int64 runId)
+{
+	List *taskList = ActiveTaskList();
+	ListCell *taskCell = NULL;
+
+	foreach(taskCell, taskList)
+	{
+		CronTask *task = (CronTask *) lfirst(taskCell);
+
+		if (task->state != CRON_TASK_WAITING && task->run.runId == runId)
+		{
+			return task;
+		}
+	}
+
+	return NULL;
+}
+
 /*
  * StartPendingRuns goes through the list of tasks and kicks of
  * runs for tasks that should start, taking clock changes into
  * into consideration.
  */
 static void
-StartAllPendingRuns(List *taskList, TimestampTz currentTime)
+StartAllPendingRuns(TimestampTz currentTime)
 {
+	List *taskList = NIL;
 	ListCell *taskCell = NULL;
 
 	if (!RebootJobsScheduled)
 	{
+		taskList = CurrentTaskList();
+
 		/* find jobs with @reboot as a schedule */
 		foreach(taskCell, taskList)
 		{
@@ -691,15 +1048,28 @@ StartAllPendingRuns(List *taskList, TimestampTz currentTime)
 			CronJob *cronJob = GetCronJob(task->jobId);
 			entry *schedule = &cronJob->schedule;
 
-			if (schedule->flags & WHEN_REBOOT)
+			/* daemon jobs do not follow their schedule */
+			if ((schedule->flags & WHEN_REBOOT) && task->mode != CRON_MODE_DAEMON)
 			{
 				task->pendingRunCount += 1;
+				RequeueTask(task);
 			}
 		}
 
 		RebootJobsScheduled = true;
 	}
 
+	if (g_lastSecond != 0 && SecondsPassed(g_lastSecond, currentTime) == 0)
+	{
+		/* no job becomes due before the next second starts */
+		return;
+	}
+
+	if (taskList == NIL)
+	{
+		taskList = CurrentTaskList();
+	}
+
 	foreach(taskCell, taskList)
 	{
 		CronTask *task = (CronTask *) lfirst(taskCell);
@@ -714,7 +1084,12 @@ StartAllPendingRuns(List *taskList, TimestampTz currentTime)
 			continue;
 		}
 
-		StartPendingRuns(task, currentTime);
+		if (task->mode == CRON_MODE_DAEMON)
+			StartDaemonRuns(task, currentTime);
+		else
+			StartPendingRuns(task, currentTime);
+
+		RequeueTask(task);
 	}
 
 	/* update time start point
@@ -926,6 +1301,80 @@ StartPendingRuns(CronTask *task, TimestampTz currentTime)
 	}
 }
 
+/*
+ * StartDaemonRuns keeps as many runs of a daemon job in progress as the
+ * maximum concurrency of the job asks for. Runs that exited are started
+ * again once the restart backoff of the job has passed.
+ */
+static void
+StartDaemonRuns(CronTask *task, TimestampTz currentTime)
+{
+	int maxConcurrency = JobMaxConcurrency(task);
+	int runCount = task->pendingRunCount + JobRunInstanceCount(task->jobId);
+
+	if (runCount >= maxConcurrency)
+	{
+		return;
+	}
+
+	if (!TimestampDifferenceExceeds(task->daemonRestartTime, currentTime, 0))
+	{
+		return;
+	}
+
+	/* the task starts the first run, run instances take the others */
+	task->pendingRunCount += maxConcurrency - runCount;
+}
+
+
+/*
+ * DelayDaemonRestart sets when runs of a daemon job may start again after one
+ * of them ended. A run that stayed up for a while is replaced right away, but
+ * the delay doubles for every run that exits early, so that a daemon that
+ * keeps failing does not flood the run details.
+ */
+static void
+DelayDaemonRestart(CronTask *jobTask, TimestampTz runStartTime, TimestampTz currentTime)
+{
+	if (runStartTime != 0 &&
+		TimestampDifferenceExceeds(runStartTime, currentTime, DaemonStableRunTime))
+	{
+		jobTask->daemonBackoff = 0;
+	}
+	else if (jobTask->daemonBackoff == 0)
+	{
+		jobTask->daemonBackoff = DaemonMinBackoff;
+	}
+	else
+	{
+		jobTask->daemonBackoff = Min(jobTask->daemonBackoff * 2, DaemonMaxBackoff);
+	}
+
+	jobTask->daemonRestartTime = TimestampTzPlusMilliseconds(currentTime,
+															 jobTask->daemonBackoff);
+}
+
+
+/*
+ * DaemonRunOutdated returns whether a run of a daemon job has to be restarted
+ * because the job left daemon mode or its command changed.
+ */
+static bool
+DaemonRunOutdated(CronTask *task, CronJob *cronJob)
+{
+	CronTask *jobTask = FindCronTask(task->jobId);
+
+	if (cronJob == NULL || jobTask == NULL)
+	{
+		/* the run is canceled with the job */
+		return false;
+	}
+
+	return jobTask->mode != CRON_MODE_DAEMON ||
+		   !TaskCommandMatches(task, cronJob);
+}
+
+
 /*
  * SecondsPassed returns the number of seconds between startTime and
  * stopTime rounded down to the closest integer.
@@ -1115,18 +1564,34 @@ ShouldRunTask(CronTask *task, entry *schedule, TimestampTz currentTime, bool doW
 			switch(task->mode)
 			{
 				case CRON_MODE_NEXT:
+				case CRON_MODE_FIXED:
+				case CRON_MODE_CHUNKED:
 				{
-					if (0 == task->pendingRunCount)
+					/* skip the run if the job already has as many runs as it may */
+					if (task->pendingRunCount + JobRunInstanceCount(task->jobId) <
+						(uint) JobMaxConcurrency(task))
 					{
 						return true;
-					}	
+					}
 
 					break;
 				}
 
-				case CRON_MODE_FIXED:
+				case CRON_MODE_CONSUMER:
+				{
+					/* wake up a consumer, running ones ask for more themselves */
+					if (task->pendingRunCount + JobRunInstanceCount(task->jobId) == 0)
+					{
+						return true;
+					}
+
+					break;
+				}
+
+				case CRON_MODE_FANOUT:
 				{
-					if ((unsigned int)MaxConnectPerTask > task->pendingRunCount)
+					/* skip the run while the targets of the last one are processed */
+					if (task->pendingRunCount == 0 && !FanoutInProgress(task))
 					{
 						return true;
 					}
@@ -1194,8 +1659,9 @@ WaitForLatch(int timeoutMs)
 
 
 /*
- * PollForTasks calls poll() for the sockets of all tasks. It checks for
- * read or write events based on the pollingStatus of the task.
+ * PollForTasks waits for the sockets of all tasks and for the latch of the
+ * launcher. It checks for read or write events based on the pollingStatus
+ * of the task.
  */
 static void
 PollForTasks(List *taskList)
@@ -1207,20 +1673,25 @@ PollForTasks(List *taskList)
 	int waitMicros = 0;
 	CronTask **polledTasks = NULL;
 	struct pollfd *pollFDs = NULL;
-	int pollResult = 0;
+	WaitEventSet *waitEventSet = NULL;
+	WaitEvent *waitEvents = NULL;
+	int eventCount = 0;
+	int eventIndex = 0;
+	CronTask **socketTasks = NULL;
+	pgsocket *sockets = NULL;
+	int *eventMasks = NULL;
+	int socketCount = 0;
+	bool forceRebuild = false;
 
 	int taskIndex = 0;
-	int taskCount = list_length(taskList);
 	int activeTaskCount = 0;
+	int taskCount = list_length(taskList);
 	ListCell *taskCell = NULL;
-	int maxTaskConnectCnt = taskCount * MaxConnectPerTask;
-	List *fixedTaskList = NIL;
 
-	polledTasks = (CronTask **) palloc0(maxTaskConnectCnt * sizeof(CronTask));
-	pollFDs = (struct pollfd *) palloc0(maxTaskConnectCnt * sizeof(struct pollfd));
+	polledTasks = (CronTask **) palloc0(taskCount * sizeof(CronTask *));
+	pollFDs = (struct pollfd *) palloc0(taskCount * sizeof(struct pollfd));
 
 	currentTime = GetCurrentTimestamp();
-	fixedTaskList = CurrentFixedTaskList();
 
 	/*
 	 * At the latest, wake up when the next minute starts.
@@ -1230,200 +1701,110 @@ PollForTasks(List *taskList)
 	foreach(taskCell, taskList)
 	{
 		CronTask *task = (CronTask *) lfirst(taskCell);
+		PostgresPollingStatusType pollingStatus = task->run.pollingStatus;
+		struct pollfd *pollFileDescriptor = &pollFDs[activeTaskCount];
 
-		/* fixed interval mode cron task.
-		 * lightdb add 2022/3/21 for S202203046035
-		 */
-		if (CRON_MODE_FIXED == task->mode)
+		if (activeTaskCount >= MaxRunningTasks)
 		{
-			ListCell* _cell = NULL;
-
-			if (fixedTaskList)
-			{
-				foreach (_cell, fixedTaskList)
-				{
-					CronFixedTask* _curNode = (CronFixedTask *) lfirst(_cell);
-
-					if (_curNode)
-					{
-						if (task->jobId == _curNode->jobId)
-						{
-							PostgresPollingStatusType pollingStatus = _curNode->pollingStatus;
-							struct pollfd *pollFileDescriptor = &pollFDs[activeTaskCount];
-
-							if (activeTaskCount >= MaxRunningTasks)
-							{
-								/* already polling the maximum number of tasks */
-								break;
-							}
-
-							if (_curNode->state == CRON_TASK_ERROR || _curNode->state == CRON_TASK_DONE ||
-								CronFixedStartTask(_curNode))
-							{
-								/* there is work to be done, don't wait */
-								pfree(polledTasks);
-								pfree(pollFDs);
-								return;
-							}
-
-							if (_curNode->state == CRON_TASK_WAITING && _curNode->pendingRunCount == 0)
-							{
-								/* don't poll idle tasks */
-								continue;
-							}
-
-							if (CRON_COMMAND_TYPE_LINUX == _curNode->commandtype)
-							{
-								continue;
-							}
+			/* already polling the maximum number of tasks */
+			break;
+		}
 
-							if (_curNode->state == CRON_TASK_CONNECTING ||
-								_curNode->state == CRON_TASK_SENDING)
-							{
-								/*
-								 * We need to wake up when a timeout expires.
-								 * Take the minimum of nextEventTime and task->startDeadline.
-								 */
-								if (TimestampDifferenceExceeds(_curNode->startDeadline, nextEventTime, 0))
-								{
-									nextEventTime = _curNode->startDeadline;
-								}
-							}
+		if (task->state == CRON_TASK_ERROR || task->state == CRON_TASK_DONE ||
+			CanStartTask(task))
+		{
+			/* there is work to be done, don't wait */
+			pfree(polledTasks);
+			pfree(pollFDs);
+			return;
+		}
 
-							/* we plan to poll this task */
-							pollFileDescriptor = &pollFDs[activeTaskCount];
-							polledTasks[activeTaskCount] = (CronTask *)_curNode;
+		if (task->state == CRON_TASK_WAITING && task->pendingRunCount == 0)
+		{
+			/* don't poll idle tasks */
+			continue;
+		}
 
-							if (_curNode->state == CRON_TASK_CONNECTING ||
-								_curNode->state == CRON_TASK_SENDING ||
-								_curNode->state == CRON_TASK_BGW_RUNNING ||
-								_curNode->state == CRON_TASK_RUNNING)
-							{
-								PGconn *connection = _curNode->connection;
-								int pollEventMask = 0;
-
-								/*
-								 * Set the appropriate mask for poll, based on the current polling
-								 * status of the task, controlled by ManageCronTask.
-								 */
-
-								if (pollingStatus == PGRES_POLLING_READING)
-								{
-									pollEventMask = POLLERR | POLLIN;
-								}
-								else if (pollingStatus == PGRES_POLLING_WRITING)
-								{
-									pollEventMask = POLLERR | POLLOUT;
-								}
-
-								pollFileDescriptor->fd = PQsocket(connection);
-								pollFileDescriptor->events = pollEventMask;
-							}
-							else
-							{
-								/*
-								 * Task is not running.
-								 */
+		if (task->state == CRON_TASK_CONNECTING ||
+			task->state == CRON_TASK_SENDING ||
+			task->state == CRON_TASK_PREPARING ||
+			task->state == CRON_TASK_BGW_START ||
+			task->state == CRON_TASK_BGW_STARTING ||
+			task->state == CRON_TASK_CANCELING)
+		{
+			/*
+			 * We need to wake up when a timeout expires.
+			 * Take the minimum of nextEventTime and task->run.startDeadline.
+			 */
+			if (TimestampDifferenceExceeds(task->run.startDeadline, nextEventTime, 0))
+			{
+				nextEventTime = task->run.startDeadline;
+			}
+		}
 
-								pollFileDescriptor->fd = -1;
-								pollFileDescriptor->events = 0;
-							}
+		if (CRON_COMMAND_TYPE_LINUX == task->commandtype)
+		{
+			continue;
+		}
 
-							pollFileDescriptor->revents = 0;
+		/* we plan to poll this task */
+		pollFileDescriptor = &pollFDs[activeTaskCount];
+		polledTasks[activeTaskCount] = task;
 
-							activeTaskCount++;
-						}
-					}
-				}
-			}
-		}
-		else
+		if (task->state == CRON_TASK_CONNECTING ||
+			task->state == CRON_TASK_SENDING ||
+			task->state == CRON_TASK_PREPARING ||
+			task->state == CRON_TASK_BGW_RUNNING ||
+			task->state == CRON_TASK_RUNNING ||
+			task->state == CRON_TASK_CANCELING)
 		{
-			PostgresPollingStatusType pollingStatus = task->pollingStatus;
-			struct pollfd *pollFileDescriptor = &pollFDs[activeTaskCount];
+			PGconn *connection = task->connection;
+			int pollEventMask = 0;
 
-			if (activeTaskCount >= MaxRunningTasks)
-			{
-				/* already polling the maximum number of tasks */
-				break;
-			}
+			/*
+			 * Set the appropriate mask for poll, based on the current polling
+			 * status of the task, controlled by ManageCronTask.
+			 */
 
-			if (task->state == CRON_TASK_ERROR || task->state == CRON_TASK_DONE ||
-				CanStartTask(task))
+			if (pollingStatus == PGRES_POLLING_READING)
 			{
-				/* there is work to be done, don't wait */
-				pfree(polledTasks);
-				pfree(pollFDs);
-				return;
+				pollEventMask = POLLERR | POLLIN;
 			}
-
-			if (task->state == CRON_TASK_WAITING && task->pendingRunCount == 0)
+			else if (pollingStatus == PGRES_POLLING_WRITING)
 			{
-				/* don't poll idle tasks */
-				continue;
+				pollEventMask = POLLERR | POLLOUT;
 			}
 
-			if (task->state == CRON_TASK_CONNECTING ||
-				task->state == CRON_TASK_SENDING)
+			pollFileDescriptor->fd = PQsocket(connection);
+			pollFileDescriptor->events = pollEventMask;
+
+#ifdef LIBPQ_HAS_ASYNC_CANCEL
+			if (task->state == CRON_TASK_CANCELING && task->run.cancelConn != NULL)
 			{
 				/*
-				 * We need to wake up when a timeout expires.
-				 * Take the minimum of nextEventTime and task->startDeadline.
+				 * While the cancel request is being sent, the backend has no
+				 * reason to respond, so wait for the cancel connection instead.
 				 */
-				if (TimestampDifferenceExceeds(task->startDeadline, nextEventTime, 0))
-				{
-					nextEventTime = task->startDeadline;
-				}
-			}
-
-			if (CRON_COMMAND_TYPE_LINUX == task->commandtype)
-			{
-				continue;
-			}
-
-			/* we plan to poll this task */
-			pollFileDescriptor = &pollFDs[activeTaskCount];
-			polledTasks[activeTaskCount] = task;
-
-			if (task->state == CRON_TASK_CONNECTING ||
-				task->state == CRON_TASK_SENDING ||
-				task->state == CRON_TASK_BGW_RUNNING ||
-				task->state == CRON_TASK_RUNNING)
-			{
-				PGconn *connection = task->connection;
-				int pollEventMask = 0;
-
-				/*
-				 * Set the appropriate mask for poll, based on the current polling
-				 * status of the task, controlled by ManageCronTask.
-				 */
-
-				if (pollingStatus == PGRES_POLLING_READING)
-				{
-					pollEventMask = POLLERR | POLLIN;
-				}
-				else if (pollingStatus == PGRES_POLLING_WRITING)
-				{
-					pollEventMask = POLLERR | POLLOUT;
-				}
-
-				pollFileDescriptor->fd = PQsocket(connection);
-				pollFileDescriptor->events = pollEventMask;
+				pollFileDescriptor->fd = PQcancelSocket(task->run.cancelConn);
+				pollFileDescriptor->events =
+					task->run.cancelPollingStatus == PGRES_POLLING_READING ?
+					POLLERR | POLLIN : POLLERR | POLLOUT;
 			}
-			else
-			{
-				/*
-				 * Task is not running.
-				 */
+#endif
+		}
+		else
+		{
+			/*
+			 * Task is not running.
+			 */
 
-				pollFileDescriptor->fd = -1;
-				pollFileDescriptor->events = 0;
-			}
+			pollFileDescriptor->fd = -1;
+			pollFileDescriptor->events = 0;
+		}
 
-			pollFileDescriptor->revents = 0;
+		pollFileDescriptor->revents = 0;
 
-			activeTaskCount++;
-		}
+		activeTaskCount++;
 	}
 
 	/*
@@ -1449,6 +1830,15 @@ PollForTasks(List *taskList)
 		pollTimeout = MaxWait;
 	}
 
+	if (BgwRetryQueue != NIL && pollTimeout > BgwRetryInterval)
+	{
+		/*
+		 * Slots freed by our own workers set the latch, but other processes
+		 * release slots without telling us, so check back regularly.
+		 */
+		pollTimeout = BgwRetryInterval;
+	}
+
 	if (activeTaskCount == 0)
 	{
 		/* turns out there's nothing to do, just wait for something to happen */
@@ -1459,116 +1849,217 @@ PollForTasks(List *taskList)
 		return;
 	}
 
-	pollResult = poll(pollFDs, activeTaskCount, pollTimeout);
-	if (pollResult < 0)
+	/*
+	 * Wait for the sockets of the tasks as well as for the latch, which is set
+	 * when one of our background workers starts or stops, when a worker sends
+	 * a message and when a signal arrives.
+	 */
+	socketTasks = (CronTask **) palloc0(activeTaskCount * sizeof(CronTask *));
+	sockets = (pgsocket *) palloc0(activeTaskCount * sizeof(pgsocket));
+	eventMasks = (int *) palloc0(activeTaskCount * sizeof(int));
+
+	for (taskIndex = 0; taskIndex < activeTaskCount; taskIndex++)
 	{
+		CronTask *task = polledTasks[taskIndex];
+		struct pollfd *pollFileDescriptor = &pollFDs[taskIndex];
+
+		task->run.isSocketReady = false;
+
+		if (pollFileDescriptor->fd < 0 || pollFileDescriptor->events == 0)
+		{
+			continue;
+		}
+
 		/*
-		 * This typically happens in case of a signal, though we should
-		 * probably check errno in case something bad happened.
+		 * While a connection is established, libpq may close its socket and
+		 * open another one that gets the same number.
 		 */
+		if (task->state == CRON_TASK_CONNECTING)
+			forceRebuild = true;
+#ifdef LIBPQ_HAS_ASYNC_CANCEL
+		if (task->run.cancelConn != NULL)
+			forceRebuild = true;
+#endif
 
-		pfree(polledTasks);
-		pfree(pollFDs);
-		return;
+		socketTasks[socketCount] = task;
+		sockets[socketCount] = pollFileDescriptor->fd;
+		eventMasks[socketCount] = (pollFileDescriptor->events & POLLIN) ?
+								  WL_SOCKET_READABLE : WL_SOCKET_WRITEABLE;
+		socketCount++;
 	}
 
-	for (taskIndex = 0; taskIndex < activeTaskCount; taskIndex++)
+	waitEventSet = TaskWaitEventSet(sockets, eventMasks, socketCount, forceRebuild);
+
+	waitEvents = (WaitEvent *) palloc0((socketCount + 2) * sizeof(WaitEvent));
+
+#if (PG_VERSION_NUM >= 100000)
+	eventCount = WaitEventSetWait(waitEventSet, pollTimeout, waitEvents,
+								  socketCount + 2, PG_WAIT_EXTENSION);
+#else
+	eventCount = WaitEventSetWait(waitEventSet, pollTimeout, waitEvents,
+								  socketCount + 2);
+#endif
+
+	for (eventIndex = 0; eventIndex < eventCount; eventIndex++)
 	{
-		CronTask *task = polledTasks[taskIndex];
-		struct pollfd *pollFileDescriptor = &pollFDs[taskIndex];
+		WaitEvent *waitEvent = &waitEvents[eventIndex];
+
+		if (waitEvent->events & WL_POSTMASTER_DEATH)
+		{
+			/* postmaster died and we should bail out immediately */
+			proc_exit(1);
+		}
 
-		if (CRON_COMMAND_TYPE_SQL == task->commandtype)
+		if (waitEvent->events & WL_LATCH_SET)
 		{
-			task->isSocketReady = pollFileDescriptor->revents &
-			  pollFileDescriptor->events;
+			ResetLatch(MyLatch);
+		}
+
+		if (waitEvent->events & (WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE))
+		{
+			/* the latch and postmaster death come before the sockets */
+			CronTask *task = socketTasks[waitEvent->pos - 2];
+
+			if (CRON_COMMAND_TYPE_SQL == task->commandtype)
+			{
+				task->run.isSocketReady = true;
+			}
 		}
 	}
 
+	pfree(waitEvents);
+	pfree(eventMasks);
+	pfree(sockets);
+	pfree(socketTasks);
 	pfree(polledTasks);
 	pfree(pollFDs);
 }
 
 
 /*
- * CanStartTask determines whether a task is ready to be started because
- * it has pending runs and we are running less than MaxRunningTasks.
+ * TaskWaitEventSet returns the wait event set of the launcher, set up to wait
+ * for the latch, postmaster death and the given sockets. The set is kept
+ * across iterations of the launcher and only rebuilt when the sockets change
+ * or forceRebuild is set; when only the direction to wait for changes, the
+ * events of the set are modified in place.
  */
-static bool
-CanStartTask(CronTask *task)
+static WaitEventSet *
+TaskWaitEventSet(pgsocket *sockets, int *eventMasks, int socketCount,
+				 bool forceRebuild)
 {
-	return task->state == CRON_TASK_WAITING && task->pendingRunCount > 0 &&
-		   RunningTaskCount < (MaxRunningTasks * MaxConnectPerTask);
+	int socketIndex = 0;
+
+	if (!forceRebuild && CronWaitEventSet != NULL &&
+		socketCount == CronWaitSocketCount &&
+		memcmp(sockets, CronWaitSockets, socketCount * sizeof(pgsocket)) == 0)
+	{
+		for (socketIndex = 0; socketIndex < socketCount; socketIndex++)
+		{
+			if (eventMasks[socketIndex] != CronWaitEventMasks[socketIndex])
+			{
+				ModifyWaitEvent(CronWaitEventSet, socketIndex + 2,
+								eventMasks[socketIndex], NULL);
+				CronWaitEventMasks[socketIndex] = eventMasks[socketIndex];
+			}
+		}
+
+		return CronWaitEventSet;
+	}
+
+	if (CronWaitEventSet != NULL)
+	{
+		FreeWaitEventSet(CronWaitEventSet);
+		pfree(CronWaitSockets);
+		pfree(CronWaitEventMasks);
+	}
+
+#if PG_VERSION_NUM >= 170000
+	CronWaitEventSet = CreateWaitEventSet(NULL, socketCount + 2);
+#else
+	CronWaitEventSet = CreateWaitEventSet(TopMemoryContext, socketCount + 2);
+#endif
+	AddWaitEventToSet(CronWaitEventSet, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+	AddWaitEventToSet(CronWaitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL, NULL);
+
+	for (socketIndex = 0; socketIndex < socketCount; socketIndex++)
+	{
+		AddWaitEventToSet(CronWaitEventSet, eventMasks[socketIndex],
+						  sockets[socketIndex], NULL, NULL);
+	}
+
+	/* one more element keeps the allocations non-empty */
+	CronWaitSockets = MemoryContextAlloc(TopMemoryContext,
+										 (socketCount + 1) * sizeof(pgsocket));
+	CronWaitEventMasks = MemoryContextAlloc(TopMemoryContext,
+											(socketCount + 1) * sizeof(int));
+	memcpy(CronWaitSockets, sockets, socketCount * sizeof(pgsocket));
+	memcpy(CronWaitEventMasks, eventMasks, socketCount * sizeof(int));
+	CronWaitSocketCount = socketCount;
+
+	return CronWaitEventSet;
 }
 
+
 /*
- * CronFixedStartTask determines whether a task is ready to be started because
- * it has pending runs and we are running less than MaxRunningTasks.
- * lightdb add 2022/3/27 for S202203046035
+ * CanStartTask determines whether a task is ready to be started because
+ * it has pending runs and we are running less than MaxRunningTasks. The
+ * task of a job also waits while the run instances of the job take all the
+ * runs that the job may have at a time, and the task of a fan-out job waits
+ * until the targets of its last run have been processed.
  */
 static bool
-CronFixedStartTask(CronFixedTask *task)
+CanStartTask(CronTask *task)
 {
 	return task->state == CRON_TASK_WAITING && task->pendingRunCount > 0 &&
-		   RunningTaskCount < (MaxRunningTasks * MaxConnectPerTask);
+		   RunningTaskCount < (MaxRunningTasks * MaxConnectPerTask) &&
+		   (task->isRunInstance ||
+			(task->mode == CRON_MODE_FANOUT ? !FanoutInProgress(task) :
+			 JobRunInstanceCount(task->jobId) < JobMaxConcurrency(task)));
 }
 
 /*
- * delete node from cron_task_list.
- * lightdb add 2022/3/23 for S202203046035
+ * JobMaxConcurrency returns the number of runs of a job that may be in
+ * progress at the same time. Unless the job sets it, fixed interval jobs
+ * may have cron.max_connections_per_task runs and other jobs one.
  */
-static void
-cron_list_del(List *fixedTaskList, CronTask *task)
+static int
+JobMaxConcurrency(CronTask *task)
 {
-	ListCell* _cell = NULL;
-	
-	if (fixedTaskList)
+	CronJob *cronJob = GetCronJob(task->jobId);
+
+	if (cronJob != NULL && cronJob->maxConcurrency > 0)
 	{
-		foreach (_cell, fixedTaskList)
-		{
-			CronFixedTask* _delNode = (CronFixedTask *) lfirst(_cell);
-			if (_delNode)
-			{
-				if (CRON_TASK_WAITING == _delNode->state && task->jobId == _delNode->jobId)
-				{
-					RemoveFixedTask(_delNode->runId);
-				}
-			}
-		}
+		return cronJob->maxConcurrency;
 	}
+
+	if (CRON_MODE_FIXED == task->mode)
+	{
+		return Max(MaxConnectPerTask, 1);
+	}
+
+	return 1;
 }
 
 /*
- * query node count from cron_task_list.
- * lightdb add 2022/3/23 for S202203046035
+ * TaskRunId returns the run ID for a run of a task that is about to start,
+ * which is the oldest one that cron.run_job() handed out for the job, if any.
  */
-static int
-queryTaskConnections(int64 jobId)
+static int64
+TaskRunId(CronTask *task)
 {
-	List *fixedTaskList = NIL;
-	ListCell* _cell = NULL;
-	unsigned int connectTaskCount = 0;
+	int64 runId = TakeRequestedRunId(task->jobId);
 
-	fixedTaskList = CurrentFixedTaskList();
-	if (fixedTaskList)
+	if (runId == 0)
 	{
-		foreach (_cell, fixedTaskList)
-		{
-			CronFixedTask* _curNode = (CronFixedTask *) lfirst(_cell);
-			if (_curNode)
-			{
-				if (jobId == _curNode->jobId)
-				{
-					connectTaskCount++;
-				}
-			}
-		}
+		runId = NextRunId();
 	}
 
-	return connectTaskCount;
+	return runId;
 }
 
 /*
- * ManageCronTasks proceeds the state machines of the given list of tasks.G
+ * ManageCronTasks proceeds the state machines of the given list of tasks,
+ * which includes run instances, and files the tasks under their new state.
  */
 static void
 ManageCronTasks(List *taskList, TimestampTz currentTime)
@@ -1578,215 +2069,517 @@ ManageCronTasks(List *taskList, TimestampTz currentTime)
 	foreach(taskCell, taskList)
 	{
 		CronTask *task = (CronTask *) lfirst(taskCell);
+		int64 jobId = task->jobId;
 
-		switch(task->mode)
+		if (task->isRunInstance)
 		{
-			/* fixed interval mode cron task.
-			 * lightdb add 2022/5/20
-			 */
-			case CRON_MODE_FIXED:
-			{
-				List *fixedTaskList = NIL;
-				ListCell *_cell = NULL;
-				unsigned int connectCount = 0;
+			CronTask *jobTask = FindCronTask(jobId);
 
-				/* the current task has been switched to fixed mode, and you need to 
-				 * wait for the previous mode to complete before executing the fixed mode.
-				 * lightdb add 2022/3/16 for S202203046035
-				 */
-				if (CRON_TASK_WAITING != task->state)
-				{
-					ManageCronTask(task, currentTime);
-					break;
-				}
-					
-				connectCount = queryTaskConnections(task->jobId);
-				if (task->isActive && connectCount < task->pendingRunCount && (unsigned int)MaxConnectPerTask > connectCount)
-				{
-					RefreshFixedTaskHash(task);
-				}
+			/* the runs of a job stop with the job */
+			task->isActive = jobTask != NULL && jobTask->isActive;
 
-				fixedTaskList = CurrentFixedTaskList();
-				if (fixedTaskList)
-				{
-					foreach (_cell, fixedTaskList)
-					{
-						CronFixedTask* _curNode = (CronFixedTask *) lfirst(_cell);
-						if (_curNode)
-						{
-							if (task->jobId == _curNode->jobId)
-							{
-								int offsetlen = sizeof(task->jobId) + sizeof(task->runId);
-								CronTask temp;
-								memset(&temp, 0, sizeof(CronTask));
-
-								_curNode->isActive = task->isActive;
-								temp.jobId = _curNode->jobId;
-								temp.runId = _curNode->runId;
-								memcpy((char*)&temp + offsetlen, (char*)_curNode + offsetlen, sizeof(CronTask) - offsetlen);
-								ManageCronTask(&temp, currentTime);
-								memcpy((char*)_curNode + offsetlen, (char*)&temp + offsetlen, sizeof(CronTask) - offsetlen);
-							}
-						}
-					}
+			ManageCronTask(task, currentTime);
 
-					cron_list_del(fixedTaskList, task);
-				}
-				
-				break;
-			}
+			if (task->state == CRON_TASK_WAITING && task->pendingRunCount == 0)
+			{
+				/* the run is finished */
+				FreeRunTargets(task);
+				RemoveRunInstance(task);
 
-			default:
+				/* the last run over a target completes the run that found it */
+				if (jobTask != NULL)
+					FinishFanout(jobTask);
+			}
+			else
 			{
-				
-				/* the current task has been switched to next/asap/single mode. It is necessary to judge and 
-				 * wait for the execution of the previous fixed mode to complete before continuing to execute.
-				 * lightdb add 2022/3/16 for S202203046035
-				 */
-				List *fixedTaskList = NIL;
-				ListCell *_cell = NULL;
-				bool isLastFixedRunning = false;
+				RequeueTask(task);
+			}
 
-				fixedTaskList = CurrentFixedTaskList();
-				if (fixedTaskList)
-				{
-					foreach (_cell, fixedTaskList)
-					{
-						CronFixedTask* _curNode = (CronFixedTask *) lfirst(_cell);
-						if (_curNode)
-						{
-							if (task->jobId == _curNode->jobId)
-							{
-								int offsetlen = sizeof(task->jobId) + sizeof(task->runId);
-								CronTask temp;
-								isLastFixedRunning = true;
-								memset(&temp, 0, sizeof(CronTask));
-
-								_curNode->isActive = task->isActive;
-								temp.jobId = _curNode->jobId;
-								temp.runId = _curNode->runId;
-								memcpy((char*)&temp + offsetlen, (char*)_curNode + offsetlen, sizeof(CronTask) - offsetlen);
-								ManageCronTask(&temp, currentTime);
-								memcpy((char*)_curNode + offsetlen, (char*)&temp + offsetlen, sizeof(CronTask) - offsetlen);
-							}
-						}
-					}
+			continue;
+		}
 
-					cron_list_del(fixedTaskList, task);
-				}
+		StartRunInstances(task);
+		StartFanoutRuns(task);
 
-				if (!isLastFixedRunning)
-					ManageCronTask(task, currentTime);
-			}
+		ManageCronTask(task, currentTime);
+
+		/* the task is removed once the job is gone and has no run instances */
+		if (FindCronTask(jobId) != NULL)
+		{
+			/* the targets of a run that just ended start right away */
+			StartFanoutRuns(task);
+			RequeueTask(task);
 		}
 	}
 }
 
+/*
+ * StartRunInstances hands the pending runs of a job that cannot wait for the
+ * run in progress to run instances of their own, as far as the maximum
+ * concurrency of the job allows. The runs of a fan-out job take turns, since
+ * its run instances process the targets of the last run.
+ */
+static void
+StartRunInstances(CronTask *task)
+{
+	int maxConcurrency = JobMaxConcurrency(task);
+
+	/* the first pending run is the one of the task itself */
+	while (task->isActive && task->state != CRON_TASK_WAITING &&
+		   task->mode != CRON_MODE_FANOUT &&
+		   task->pendingRunCount > 1 &&
+		   1 + JobRunInstanceCount(task->jobId) < maxConcurrency)
+	{
+		StartRunInstance(task);
+		task->pendingRunCount -= 1;
+	}
+}
 
 /*
- * ManageCronTask implements the cron task state machine.
+ * StartFanoutRuns hands the targets that the last run of a fan-out job found
+ * to run instances, as many at a time as the maximum concurrency of the job
+ * allows. Each run instance executes the command of the job for one target,
+ * in one database or on one node, and is recorded as a child of the run that
+ * found the target.
  */
 static void
-ManageCronTask(CronTask *task, TimestampTz currentTime)
+StartFanoutRuns(CronTask *task)
 {
-	CronTaskState checkState = task->state;
-	int64 jobId = task->jobId;
-	CronJob *cronJob = GetCronJob(jobId);
-	PGconn *connection = task->connection;
-	ConnStatusType connectionStatus = CONNECTION_BAD;
-	TimestampTz start_time;
+	CronJob *cronJob = GetCronJob(task->jobId);
+	int maxParallel = JobMaxConcurrency(task);
+	MemoryContext oldContext = NULL;
 
-	switch (checkState)
+	if (task->state != CRON_TASK_WAITING || task->fanoutTargets == NIL)
 	{
-		case CRON_TASK_WAITING:
-		{
-			/* check if job has been removed */
-			if (!task->isActive)
-			{
-				/* remove task as well */
-				RemoveTask(jobId);
-				break;
-			}
+		return;
+	}
 
-			if (!CanStartTask(task))
-			{
-				break;
-			}
+	if (!task->isActive || cronJob == NULL)
+	{
+		/* the targets are dropped with the job */
+		DropFanoutTargets(task);
+		return;
+	}
 
-			//task->pendingRunCount -= 1;
-			if (UseBackgroundWorkers)
-				task->state = CRON_TASK_BGW_START;
-			else
-				task->state = CRON_TASK_START;
+	oldContext = MemoryContextSwitchTo(TopMemoryContext);
 
-			RunningTaskCount++;
+	while (task->fanoutTargets != NIL &&
+		   JobRunInstanceCount(task->jobId) < maxParallel)
+	{
+		char *target = (char *) linitial(task->fanoutTargets);
+		CronTask *instance = StartRunInstance(task);
 
-			/* Add new entry to audit table. */
-			if (CRON_MODE_FIXED != task->mode)
-			{
-				task->runId = NextRunId();
-			}
-			if (CronLogRun)
-				InsertJobRunDetail(task->runId, &cronJob->jobId,
-										cronJob->database,
-										cronJob->userName,
-										cronJob->command, GetCronStatus(CRON_STATUS_STARTING));
-		}
+		instance->run.command = FanoutCommand(cronJob->command, target);
+		instance->run.parentRunId = task->fanoutRunId;
+		instance->run.target = target;
 
-		case CRON_TASK_START:
+		if (cronJob->fanoutTarget == CRON_FANOUT_DATABASE)
 		{
-			/* as there is no break at the end of the previous case
-			 * to not add an extra second, then do another check here
-			 */
-			if (CRON_COMMAND_TYPE_SQL == task->commandtype)
-			{
-				if (!UseBackgroundWorkers)
-				{
-					const char *clientEncoding = GetDatabaseEncodingName();
-					char nodePortString[12];
-					TimestampTz startDeadline = 0;
+			instance->run.database = pstrdup(target);
+		}
+		else if (cronJob->fanoutTarget == CRON_FANOUT_NODE)
+		{
+			/* nodes were checked when the job was scheduled */
+			instance->run.nodePort = cronJob->nodePort;
+			if (!ParseNodeTarget(target, &instance->run.nodeName, &instance->run.nodePort))
+				instance->run.nodeName = pstrdup(target);
+		}
 
-					const char *keywordArray[] = {
-						"host",
-						"port",
-						"fallback_application_name",
-						"client_encoding",
-						"dbname",
-						"user",
-						NULL
-						};
-					const char *valueArray[] = {
-						cronJob->nodeName,
-						nodePortString,
-						"pg_cron",
-						clientEncoding,
-						cronJob->database,
-						cronJob->userName,
-						NULL
-					};
-					sprintf(nodePortString, "%d", cronJob->nodePort);
+		task->fanoutTargets = list_delete_first(task->fanoutTargets);
+	}
 
-					Assert(sizeof(keywordArray) == sizeof(valueArray));
+	MemoryContextSwitchTo(oldContext);
+}
 
-					/*if (CronLogStatement)
-					{
-						char *command = cronJob->command;
+/*
+ * FanoutInProgress returns whether the targets of the last run of a fan-out
+ * job are still being processed.
+ */
+static bool
+FanoutInProgress(CronTask *task)
+{
+	return task->fanoutTargets != NIL || JobRunInstanceCount(task->jobId) > 0;
+}
 
-						ereport(LOG, (errmsg("cron job " INT64_FORMAT " %s: %s",
-										 jobId, GetCronStatus(CRON_STATUS_STARTING), command)));
-					}*/
+/*
+ * AddFanoutTarget remembers a target that a run of a fan-out job found, until
+ * a run instance takes it once the run is over.
+ */
+static void
+AddFanoutTarget(CronTask *task, const char *target)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(TopMemoryContext);
 
-					connection = PQconnectStartParams(keywordArray, valueArray, false);
-					PQsetnonblocking(connection, 1);
+	task->fanoutTargets = lappend(task->fanoutTargets, pstrdup(target));
 
-					connectionStatus = PQstatus(connection);
+	MemoryContextSwitchTo(oldContext);
+}
+
+/*
+ * DropFanoutTargets forgets the targets of a fan-out job that no run instance
+ * took yet.
+ */
+static void
+DropFanoutTargets(CronTask *task)
+{
+	list_free_deep(task->fanoutTargets);
+	task->fanoutTargets = NIL;
+}
+
+/*
+ * FanoutCommand returns the command of a fan-out job with the placeholder
+ * replaced by the given target.
+ */
+static char *
+FanoutCommand(const char *command, const char *target)
+{
+	StringInfoData fanoutCommand;
+	const char *placeholder = NULL;
+	int placeholderLength = strlen(FANOUT_TARGET_PLACEHOLDER);
+
+	initStringInfo(&fanoutCommand);
+
+	while ((placeholder = strstr(command, FANOUT_TARGET_PLACEHOLDER)) != NULL)
+	{
+		appendBinaryStringInfo(&fanoutCommand, command, placeholder - command);
+		appendStringInfoString(&fanoutCommand, target);
+		command = placeholder + placeholderLength;
+	}
+
+	appendStringInfoString(&fanoutCommand, command);
+
+	return fanoutCommand.data;
+}
+
+/*
+ * TaskCommand returns the command that the current run of a task executes,
+ * which is the command of the job unless the run was given one of its own.
+ */
+static char *
+TaskCommand(CronTask *task, CronJob *cronJob)
+{
+	return task->run.command != NULL ? task->run.command : cronJob->command;
+}
+
+/*
+ * TaskDatabase returns the database that the current run of a task executes
+ * in, which is the database of the job unless the run was given one of its
+ * own.
+ */
+static char *
+TaskDatabase(CronTask *task, CronJob *cronJob)
+{
+	return task->run.database != NULL ? task->run.database : cronJob->database;
+}
+
+/*
+ * TaskNodeName returns the host of the node that the current run of a task
+ * executes on, which is the node of the job unless the run was given one of
+ * its own.
+ */
+static char *
+TaskNodeName(CronTask *task, CronJob *cronJob)
+{
+	return task->run.nodeName != NULL ? task->run.nodeName : cronJob->nodeName;
+}
+
+/*
+ * TaskNodePort returns the port of the node that the current run of a task
+ * executes on.
+ */
+static int
+TaskNodePort(CronTask *task, CronJob *cronJob)
+{
+	return task->run.nodeName != NULL ? task->run.nodePort : cronJob->nodePort;
+}
+
+/*
+ * FreeRunTargets frees the command, database, node and fan-out target that
+ * were given to the current run of a task.
+ */
+static void
+FreeRunTargets(CronTask *task)
+{
+	if (task->run.command != NULL)
+		pfree(task->run.command);
+	if (task->run.database != NULL)
+		pfree(task->run.database);
+	if (task->run.nodeName != NULL)
+		pfree(task->run.nodeName);
+	if (task->run.target != NULL)
+		pfree(task->run.target);
+
+	task->run.command = NULL;
+	task->run.database = NULL;
+	task->run.nodeName = NULL;
+	task->run.target = NULL;
+}
+
+/*
+ * ReportFanoutResult counts the outcome of a run over a target of a fan-out
+ * job towards the result of the run that found the target.
+ */
+static void
+ReportFanoutResult(CronTask *instance, bool succeeded)
+{
+	CronTask *jobTask = FindCronTask(instance->jobId);
+
+	if (jobTask == NULL || jobTask->fanoutRunId != instance->run.parentRunId)
+	{
+		return;
+	}
+
+	if (succeeded)
+		jobTask->fanoutSucceeded++;
+	else
+		jobTask->fanoutFailed++;
+}
+
+/*
+ * FinishFanout writes the aggregate result of the runs over the targets of
+ * the last run of a fan-out job to the run details of that run, once all of
+ * them ended. The run fails if any of them failed.
+ */
+static void
+FinishFanout(CronTask *task)
+{
+	int targetCount = task->fanoutSucceeded + task->fanoutFailed;
+
+	if (targetCount == 0 || FanoutInProgress(task))
+	{
+		return;
+	}
+
+	if (CronLogRun)
+	{
+		TimestampTz end_time = GetCurrentTimestamp();
+		CronStatus status = task->fanoutFailed > 0 ? CRON_STATUS_FAILED :
+													 CRON_STATUS_SUCCEEDED;
+		char message[64];
+
+		snprintf(message, sizeof(message), "%d of %d targets succeeded",
+				 task->fanoutSucceeded, targetCount);
+		UpdateJobRunDetail(task->fanoutRunId, NULL, GetCronStatus(status), message,
+						   NULL, &end_time);
+	}
+
+	task->fanoutSucceeded = 0;
+	task->fanoutFailed = 0;
+}
+
+
+/*
+ * ManageCronTask implements the cron task state machine.
+ */
+static void
+ManageCronTask(CronTask *task, TimestampTz currentTime)
+{
+	CronTaskState checkState = task->state;
+	int64 jobId = task->jobId;
+	CronJob *cronJob = GetCronJob(jobId);
+	PGconn *connection = task->connection;
+	ConnStatusType connectionStatus = CONNECTION_BAD;
+	TimestampTz start_time;
+	bool runFailed = false;
+
+	switch (checkState)
+	{
+		case CRON_TASK_WAITING:
+		{
+			/* check if job has been removed */
+			if (!task->isActive)
+			{
+				/* close a connection kept open for the next run */
+				if (task->isConnectionKept)
+				{
+					CloseKeptConnection(task);
+				}
+
+				if (task->isRunInstance)
+				{
+					/* drop the run, the instance is removed by the caller */
+					task->pendingRunCount = 0;
+				}
+				else if (JobRunInstanceCount(jobId) == 0)
+				{
+					/* remove task as well */
+					RemoveTask(jobId);
+				}
+				break;
+			}
+
+			if (!CanStartTask(task))
+			{
+				break;
+			}
+
+			//task->pendingRunCount -= 1;
+			task->run.executor = TaskExecutor(task, cronJob);
+			task->run.runStartTime = currentTime;
+			task->run.runMode = task->mode;
+
+			if (task->run.parentRunId != 0)
+			{
+				/* a run over a target of a fan-out job is a plain run */
+				task->run.runMode = CRON_MODE_NEXT;
+			}
+			else if (task->run.runMode == CRON_MODE_FANOUT)
+			{
+				/* the run looks up the targets, the command runs for each of them */
+				task->run.command = MemoryContextStrdup(TopMemoryContext,
+													cronJob->fanoutTargets != NULL ?
+													cronJob->fanoutTargets : "");
+			}
+
+			if (ModeHasOwnWorker(task->run.runMode))
+			{
+				/* these runs execute in a background worker of their own */
+				task->run.executor = CRON_EXECUTOR_BGWORKER;
+				SetTaskCommandKey(task, cronJob);
+			}
+
+			/* linux commands are always started by the launcher */
+			if (CRON_COMMAND_TYPE_SQL == task->commandtype &&
+				task->run.executor != CRON_EXECUTOR_LIBPQ)
+				task->state = CRON_TASK_BGW_START;
+			else
+				task->state = CRON_TASK_START;
+
+			RunningTaskCount++;
+
+			/* Add new entry to audit table. */
+			task->run.runId = task->run.parentRunId != 0 ? NextRunId() : TaskRunId(task);
+			if (task->run.runMode == CRON_MODE_FANOUT)
+			{
+				task->fanoutRunId = task->run.runId;
+				task->fanoutSucceeded = 0;
+				task->fanoutFailed = 0;
+			}
+			if (CronLogRun)
+				InsertJobRunDetail(task->run.runId, &cronJob->jobId,
+										TaskDatabase(task, cronJob),
+										cronJob->userName,
+										TaskCommand(task, cronJob),
+										GetCronStatus(CRON_STATUS_STARTING),
+										task->run.parentRunId, task->run.target);
+
+			if (ModeHasOwnWorker(task->run.runMode) &&
+				!NodeIsLocal(cronJob->nodeName, cronJob->nodePort))
+			{
+				/* a worker of this server cannot run the job on another node */
+				task->run.errorMessage = "daemon, consumer, chunked and fan-out jobs "
+									 "can only run on the local node";
+				task->run.pollingStatus = 0;
+				task->state = CRON_TASK_ERROR;
+				break;
+			}
+		}
+
+		case CRON_TASK_START:
+		{
+			/* as there is no break at the end of the previous case
+			 * to not add an extra second, then do another check here
+			 */
+			if (CRON_COMMAND_TYPE_SQL == task->commandtype)
+			{
+				if (task->run.executor == CRON_EXECUTOR_LIBPQ)
+				{
+					const char *clientEncoding = GetDatabaseEncodingName();
+					char nodePortString[12];
+					TimestampTz startDeadline = 0;
+					bool commandMatches = TaskCommandMatches(task, cronJob);
+					char *profileOptions = NULL;
+
+					const char *keywordArray[] = {
+						"host",
+						"port",
+						"fallback_application_name",
+						"client_encoding",
+						"dbname",
+						"user",
+						"options",
+						NULL
+						};
+					const char *valueArray[] = {
+						TaskNodeName(task, cronJob),
+						nodePortString,
+						"pg_cron",
+						clientEncoding,
+						TaskDatabase(task, cronJob),
+						cronJob->userName,
+						NULL,
+						NULL
+					};
+					sprintf(nodePortString, "%d", TaskNodePort(task, cronJob));
+
+					Assert(sizeof(keywordArray) == sizeof(valueArray));
+
+#ifdef LIBPQ_HAS_PIPELINING
+					/* take other due jobs for the same target along on this connection */
+					FormTaskBatch(task, cronJob);
+#endif
+
+					if (connection != NULL)
+					{
+						TakeKeptConnection(task);
+
+						/*
+						 * The connection of the previous run was kept open. Reuse
+						 * it, including the statement prepared on it, as long as
+						 * it is healthy and the job did not change in between.
+						 */
+						if (commandMatches &&
+							PQconsumeInput(connection) == 1 &&
+							PQstatus(connection) == CONNECTION_OK &&
+							PQtransactionStatus(connection) == PQTRANS_IDLE)
+						{
+							task->run.startDeadline = TimestampTzPlusMilliseconds(currentTime,
+														CronTaskStartTimeout);
+							task->run.pollingStatus = PGRES_POLLING_WRITING;
+							task->state = CRON_TASK_SENDING;
+
+							if (CronLogRun)
+							{
+								pid_t pid = (pid_t) PQbackendPID(connection);
+
+								UpdateJobRunDetail(task->run.runId, &pid, GetCronStatus(CRON_STATUS_SENDING), NULL, NULL, NULL);
+							}
+
+							break;
+						}
+
+						PQfinish(connection);
+						task->connection = NULL;
+						task->isPrepared = false;
+					}
+
+					SetTaskCommandKey(task, cronJob);
+
+					/*if (CronLogStatement)
+					{
+						char *command = cronJob->command;
+
+						ereport(LOG, (errmsg("cron job " INT64_FORMAT " %s: %s",
+										 jobId, GetCronStatus(CRON_STATUS_STARTING), command)));
+					}*/
+
+					/* the session settings of the job profile, if any */
+					profileOptions = JobProfileConnectionOptions(cronJob->profile);
+					valueArray[6] = profileOptions;
+
+					connection = PQconnectStartParams(keywordArray, valueArray, false);
+					PQsetnonblocking(connection, 1);
+
+					pfree(profileOptions);
+
+					connectionStatus = PQstatus(connection);
 					if (connectionStatus == CONNECTION_BAD)
 					{
 						/* make sure we call PQfinish on the connection */
 						task->connection = connection;
 
-						task->errorMessage = "connection failed";
-						task->pollingStatus = 0;
+						task->run.errorMessage = "connection failed";
+						task->run.pollingStatus = 0;
 						task->state = CRON_TASK_ERROR;
 						break;
 					}
@@ -1794,13 +2587,13 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 					startDeadline = TimestampTzPlusMilliseconds(currentTime,
 												CronTaskStartTimeout);
 
-					task->startDeadline = startDeadline;
+					task->run.startDeadline = startDeadline;
 					task->connection = connection;
-					task->pollingStatus = PGRES_POLLING_WRITING;
+					task->run.pollingStatus = PGRES_POLLING_WRITING;
 					task->state = CRON_TASK_CONNECTING;
 
 					if (CronLogRun)
-						UpdateJobRunDetail(task->runId, NULL, GetCronStatus(CRON_STATUS_CONNECTING), NULL, NULL, NULL);
+						UpdateJobRunDetail(task->run.runId, NULL, GetCronStatus(CRON_STATUS_CONNECTING), NULL, NULL, NULL);
 
 					break;
 				}			
@@ -1811,7 +2604,7 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 				 * lightdb add 2022/4/20 for S202204117426
 				 */
 				if (MaxRunLinuxTaskTimeout)
-					task->startDeadline = TimestampTzPlusMilliseconds(currentTime, (MaxRunLinuxTaskTimeout * 1000));
+					task->run.startDeadline = TimestampTzPlusMilliseconds(currentTime, (MaxRunLinuxTaskTimeout * 1000));
 				
 				ManageLinuxCronTask(task);
 				
@@ -1823,129 +2616,76 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 		{
 
 			BackgroundWorker worker;
-			pid_t pid;
 			shm_toc_estimator e;
 			shm_toc *toc;
 			char *database;
 			char *username;
 			char *command;
+			char *profile;
 			MemoryContext oldcontext;
 			shm_mq *mq;
 			Size segsize;
 			BackgroundWorkerHandle *handle;
-			BgwHandleStatus status;
-			bool registered;
-			TimestampTz startDeadline = 0;
 
 			/* break in the previous case has not been reached
 			 * checking just for extra precaution
 			 */
-			Assert(UseBackgroundWorkers);
+			Assert(task->run.executor != CRON_EXECUTOR_LIBPQ);
 			#if PG_VERSION_NUM < 100000
-				Assert(CurrentResourceOwner == NULL);
-				CurrentResourceOwner = ResourceOwnerCreate(NULL, "pg_cron_worker");
+				if (CurrentResourceOwner == NULL)
+					CurrentResourceOwner = ResourceOwnerCreate(NULL, "pg_cron_worker");
 			#endif
 
-			#define QUEUE_SIZE ((Size) 65536)
-
 			/*
-			 * Create the shared memory that we will pass to the background
-			 * worker process.  We use DSM_CREATE_NULL_IF_MAXSEGMENTS so that we
-			 * do not ERROR here.  This way, we can mark the job as failed and
-			 * keep the launcher process running normally.
+			 * Registering a worker never blocks. If no background worker slot
+			 * is available, the task stays in this state and is retried on
+			 * later iterations until the startup deadline passes.
 			 */
-			shm_toc_initialize_estimator(&e);
-			shm_toc_estimate_chunk(&e, strlen(cronJob->database) + 1);
-			shm_toc_estimate_chunk(&e, strlen(cronJob->userName) + 1);
-			shm_toc_estimate_chunk(&e, strlen(cronJob->command) + 1);
-			shm_toc_estimate_chunk(&e, QUEUE_SIZE);
-			shm_toc_estimate_keys(&e, PG_CRON_NKEYS);
-			segsize = shm_toc_estimate(&e);
-
-			task->seg = dsm_create(segsize, DSM_CREATE_NULL_IF_MAXSEGMENTS);
-			if (task->seg == NULL)
+			if (task->run.startDeadline == 0)
 			{
-				task->state = CRON_TASK_ERROR;
-				task->errorMessage = "unable to create a DSM segment; more "
-								"details may be available in the server log";
-
-				ereport(WARNING,
-					(errmsg("max number of DSM segments may has been reached")));
-
-				break;
+				task->run.startDeadline = TimestampTzPlusMilliseconds(currentTime,
+											CronTaskStartTimeout);
 			}
 
-			toc = shm_toc_create(PG_CRON_MAGIC, dsm_segment_address(task->seg), segsize);
-
-			database = shm_toc_allocate(toc, strlen(cronJob->database) + 1);
-			strcpy(database, cronJob->database);
-			shm_toc_insert(toc, PG_CRON_KEY_DATABASE, database);
-
-			username = shm_toc_allocate(toc, strlen(cronJob->userName) + 1);
-			strcpy(username, cronJob->userName);
-			shm_toc_insert(toc, PG_CRON_KEY_USERNAME, username);
-
-			command = shm_toc_allocate(toc, strlen(cronJob->command) + 1);
-			strcpy(command, cronJob->command);
-			shm_toc_insert(toc, PG_CRON_KEY_COMMAND, command);
+			if (!task->isActive)
+			{
+				LeaveBgwRetryQueue(task->run.runId);
 
-			mq = shm_mq_create(shm_toc_allocate(toc, QUEUE_SIZE), QUEUE_SIZE);
-			shm_toc_insert(toc, PG_CRON_KEY_QUEUE, mq);
-			shm_mq_set_receiver(mq, MyProc);
+				if (task->run.seg != NULL)
+				{
+					dsm_detach(task->run.seg);
+					task->run.seg = NULL;
+				}
 
-			/*
-			 * Attach the queue before launching a worker, so that we'll automatically
-			 * detach the queue if we error out.  (Otherwise, the worker might sit
-			 * there trying to write the queue long after we've gone away.)
-			 */
-			oldcontext = MemoryContextSwitchTo(TopMemoryContext);
-			shm_mq_attach(mq, task->seg, NULL);
-			MemoryContextSwitchTo(oldcontext);
+				if (task->run.runSlot >= 0)
+				{
+					ReleaseRunSlot(task->run.runSlot, NULL);
+					task->run.runSlot = -1;
+				}
 
-			/*
-			 * Prepare the background worker.
-			 *
-			 */
-			memset(&worker, 0, sizeof(BackgroundWorker));
-			worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
-			worker.bgw_start_time = BgWorkerStart_ConsistentState;
-			worker.bgw_restart_time = BGW_NEVER_RESTART;
-			sprintf(worker.bgw_library_name, "pg_cron");
-			sprintf(worker.bgw_function_name, "CronBackgroundWorker");
-#if (PG_VERSION_NUM >= 110000)
-			snprintf(worker.bgw_type, BGW_MAXLEN, "pg_cron");
-#endif
-			snprintf(worker.bgw_name, BGW_MAXLEN, "pg_cron worker");
-			worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(task->seg));
-			worker.bgw_notify_pid = MyProcPid;
+				task->run.errorMessage = "job canceled";
+				task->state = CRON_TASK_ERROR;
+				break;
+			}
 
-			/*
-			 * Start the worker process.
-			 */
-			/*if (CronLogStatement)
+			if (TimestampDifferenceExceeds(task->run.startDeadline, currentTime, 0))
 			{
-				ereport(LOG, (errmsg("cron job " INT64_FORMAT " %s: %s",
-										 jobId, GetCronStatus(CRON_STATUS_STARTING), command)));
-			}*/
+				LeaveBgwRetryQueue(task->run.runId);
 
-			/* If no no background worker slots are currently available
-			 * let's try until we reach jobStartupTimeout
-			 */
-			startDeadline = TimestampTzPlusMilliseconds(currentTime,
-										CronTaskStartTimeout);
-			task->startDeadline = startDeadline;
-			do
-			{
-				registered = RegisterDynamicBackgroundWorker(&worker, &handle);
-			}
-			while (!registered && !jobStartupTimeout(task, GetCurrentTimestamp()));
+				if (task->run.seg != NULL)
+				{
+					dsm_detach(task->run.seg);
+					task->run.seg = NULL;
+				}
+
+				if (task->run.runSlot >= 0)
+				{
+					ReleaseRunSlot(task->run.runSlot, NULL);
+					task->run.runSlot = -1;
+				}
 
-			if (!registered)
-			{
-				dsm_detach(task->seg);
-				task->seg = NULL;
 				task->state = CRON_TASK_ERROR;
-				task->errorMessage = "could not start background process; more "
+				task->run.errorMessage = "could not start background process; more "
 									 "details may be available in the server log";
 				ereport(WARNING,
 					(errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
@@ -1954,23 +2694,252 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 				break;
 			}
 
-			task->startDeadline = 0;
-			task->handle = *handle;
-			status = WaitForBackgroundWorkerStartup(&task->handle, &pid);
-			if (status != BGWH_STARTED && status != BGWH_STOPPED)
+			/*
+			 * Runs get worker slots in the order in which they asked for one,
+			 * so a run waits while another one is ahead of it in the queue.
+			 * A run that gets a slot leaves the queue right away.
+			 */
+			EnterBgwRetryQueue(task->run.runId);
+
+			if (!IsBgwRetryQueueHead(task->run.runId))
 			{
-				dsm_detach(task->seg);
-				task->seg = NULL;
-				task->state = CRON_TASK_ERROR;
-				task->errorMessage = "could not start background process; more "
-									 "details may be available in the server log";
 				break;
 			}
 
+			if (task->run.executor == CRON_EXECUTOR_POOL)
+			{
+				char *errorMessage = NULL;
+				CronPoolWorker *poolWorker = AcquirePoolWorker(TaskDatabase(task, cronJob),
+															   cronJob->userName,
+															   &errorMessage);
+
+				if (poolWorker == NULL)
+				{
+					/* try again once a worker slot frees up */
+					EnterBgwRetryQueue(task->run.runId);
+					break;
+				}
+
+				LeaveBgwRetryQueue(task->run.runId);
+
+				if (!SendPoolWorkerCommand(poolWorker, cronJob->jobId, cronJob->profile,
+										   TaskCommand(task, cronJob)))
+				{
+					ReleasePoolWorker(poolWorker, false);
+
+					task->state = CRON_TASK_ERROR;
+					task->run.errorMessage = "could not send command to pool worker";
+					break;
+				}
+
+				/* the handle lets cancellation terminate the pool worker */
+				task->run.poolWorker = poolWorker;
+				task->run.handle = poolWorker->handle;
+				task->run.responseq = poolWorker->responseq;
+				task->state = CRON_TASK_BGW_STARTING;
+				break;
+			}
+
+			#define QUEUE_SIZE ((Size) 65536)
+
+			/*
+			 * Prefer a slot of the preallocated arena over a new DSM segment,
+			 * except for runs that loop in a worker of their own, which may
+			 * hold on to the slot for long.
+			 */
+			if (task->run.seg == NULL && task->run.runSlot < 0 && !ModeHasOwnWorker(task->run.runMode))
+			{
+				task->run.runSlot = AcquireRunSlot(TaskDatabase(task, cronJob), cronJob->userName,
+											   cronJob->profile, TaskCommand(task, cronJob));
+			}
+
+			/* the segment is kept while waiting for a worker slot */
+			if (task->run.seg == NULL && task->run.runSlot < 0)
+			{
+				/*
+				 * Create the shared memory that we will pass to the background
+				 * worker process.  We use DSM_CREATE_NULL_IF_MAXSEGMENTS so that we
+				 * do not ERROR here.  This way, we can mark the job as failed and
+				 * keep the launcher process running normally.
+				 */
+				shm_toc_initialize_estimator(&e);
+				shm_toc_estimate_chunk(&e, strlen(TaskDatabase(task, cronJob)) + 1);
+				shm_toc_estimate_chunk(&e, strlen(cronJob->userName) + 1);
+				shm_toc_estimate_chunk(&e, strlen(TaskCommand(task, cronJob)) + 1);
+				shm_toc_estimate_chunk(&e, strlen(cronJob->profile) + 1);
+				shm_toc_estimate_chunk(&e, QUEUE_SIZE);
+				shm_toc_estimate_keys(&e, PG_CRON_NKEYS);
+				segsize = shm_toc_estimate(&e);
+
+				task->run.seg = dsm_create(segsize, DSM_CREATE_NULL_IF_MAXSEGMENTS);
+				if (task->run.seg == NULL)
+				{
+					LeaveBgwRetryQueue(task->run.runId);
+
+					task->state = CRON_TASK_ERROR;
+					task->run.errorMessage = "unable to create a DSM segment; more "
+									"details may be available in the server log";
+
+					ereport(WARNING,
+						(errmsg("max number of DSM segments may has been reached")));
+
+					break;
+				}
+
+				toc = shm_toc_create(PG_CRON_MAGIC, dsm_segment_address(task->run.seg), segsize);
+
+				database = shm_toc_allocate(toc, strlen(TaskDatabase(task, cronJob)) + 1);
+				strcpy(database, TaskDatabase(task, cronJob));
+				shm_toc_insert(toc, PG_CRON_KEY_DATABASE, database);
+
+				username = shm_toc_allocate(toc, strlen(cronJob->userName) + 1);
+				strcpy(username, cronJob->userName);
+				shm_toc_insert(toc, PG_CRON_KEY_USERNAME, username);
+
+				command = shm_toc_allocate(toc, strlen(TaskCommand(task, cronJob)) + 1);
+				strcpy(command, TaskCommand(task, cronJob));
+				shm_toc_insert(toc, PG_CRON_KEY_COMMAND, command);
+
+				profile = shm_toc_allocate(toc, strlen(cronJob->profile) + 1);
+				strcpy(profile, cronJob->profile);
+				shm_toc_insert(toc, PG_CRON_KEY_PROFILE, profile);
+
+				mq = shm_mq_create(shm_toc_allocate(toc, QUEUE_SIZE), QUEUE_SIZE);
+				shm_toc_insert(toc, PG_CRON_KEY_QUEUE, mq);
+				shm_mq_set_receiver(mq, MyProc);
+
+				/*
+				 * Attach the queue before launching a worker, so that we'll automatically
+				 * detach the queue if we error out.  (Otherwise, the worker might sit
+				 * there trying to write the queue long after we've gone away.)
+				 */
+				oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+				task->run.responseq = shm_mq_attach(mq, task->run.seg, NULL);
+				MemoryContextSwitchTo(oldcontext);
+			}
+			else if (task->run.runSlot >= 0)
+			{
+				task->run.responseq = RunSlotResponseQueue(task->run.runSlot);
+			}
+
+			/*
+			 * Prepare the background worker.
+			 *
+			 */
+			memset(&worker, 0, sizeof(BackgroundWorker));
+			worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+			worker.bgw_start_time = BgWorkerStart_ConsistentState;
+			worker.bgw_restart_time = BGW_NEVER_RESTART;
+			sprintf(worker.bgw_library_name, "pg_cron");
+			if (task->run.runMode == CRON_MODE_DAEMON)
+			{
+				sprintf(worker.bgw_function_name, "CronDaemonWorker");
+				snprintf(worker.bgw_name, BGW_MAXLEN, "pg_cron daemon for job " INT64_FORMAT,
+						 jobId);
+			}
+			else if (task->run.runMode == CRON_MODE_CONSUMER)
+			{
+				sprintf(worker.bgw_function_name, "CronConsumerWorker");
+				snprintf(worker.bgw_name, BGW_MAXLEN, "pg_cron consumer for job " INT64_FORMAT,
+						 jobId);
+			}
+			else if (task->run.runMode == CRON_MODE_CHUNKED)
+			{
+				sprintf(worker.bgw_function_name, "CronChunkedWorker");
+				snprintf(worker.bgw_name, BGW_MAXLEN, "pg_cron chunked job " INT64_FORMAT,
+						 jobId);
+			}
+			else if (task->run.runMode == CRON_MODE_FANOUT)
+			{
+				sprintf(worker.bgw_function_name, "CronFanoutWorker");
+				snprintf(worker.bgw_name, BGW_MAXLEN, "pg_cron fan-out for job " INT64_FORMAT,
+						 jobId);
+			}
+			else
+			{
+				sprintf(worker.bgw_function_name, "CronBackgroundWorker");
+				snprintf(worker.bgw_name, BGW_MAXLEN, "pg_cron worker");
+			}
+#if (PG_VERSION_NUM >= 110000)
+			snprintf(worker.bgw_type, BGW_MAXLEN, "pg_cron");
+#endif
+			if (ModeHasOwnWorker(task->run.runMode))
+			{
+				CronWorkerExtra extra;
+
+				extra.jobId = jobId;
+				extra.batchTargetTime = cronJob->batchTargetTime;
+				extra.batchPause = cronJob->batchPause;
+				memcpy(worker.bgw_extra, &extra, sizeof(CronWorkerExtra));
+			}
+			if (task->run.runSlot >= 0)
+				PrepareRunSlotWorker(&worker, task->run.runSlot);
+			else
+				worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(task->run.seg));
+			/* the postmaster sets our latch when the worker starts or stops */
+			worker.bgw_notify_pid = MyProcPid;
+
+			if (!RegisterDynamicBackgroundWorker(&worker, &handle))
+			{
+				/* no slot available, try again once one frees up */
+				EnterBgwRetryQueue(task->run.runId);
+				break;
+			}
+
+			LeaveBgwRetryQueue(task->run.runId);
+
+			task->run.handle = *handle;
+			task->state = CRON_TASK_BGW_STARTING;
+			break;
+		}
+
+		case CRON_TASK_BGW_STARTING:
+		{
+			pid_t pid = 0;
+			BgwHandleStatus status;
+
+			/* check if job has been removed */
+			if (jobCanceled(task))
+				break;
+
+			status = GetBackgroundWorkerPid(&task->run.handle, &pid);
+			if (status == BGWH_NOT_YET_STARTED)
+			{
+				if (!TimestampDifferenceExceeds(task->run.startDeadline, currentTime, 0))
+				{
+					/* still waiting for the postmaster to start the worker */
+					break;
+				}
+
+				task->run.errorMessage = "job startup timeout";
+				StartTaskCancel(task, currentTime);
+				break;
+			}
+
+			if (status == BGWH_POSTMASTER_DIED)
+			{
+				if (task->run.seg != NULL)
+				{
+					dsm_detach(task->run.seg);
+					task->run.seg = NULL;
+				}
+
+				task->state = CRON_TASK_ERROR;
+				task->run.errorMessage = "could not start background process; more "
+									 "details may be available in the server log";
+				break;
+			}
+
+			/*
+			 * The worker started, or it even finished already, in which case
+			 * CRON_TASK_BGW_RUNNING collects its results right away.
+			 */
+			task->run.startDeadline = 0;
 			start_time = GetCurrentTimestamp();
 
 			if (CronLogRun)
-				UpdateJobRunDetail(task->runId, &pid, GetCronStatus(CRON_STATUS_RUNNING), NULL, &start_time, NULL);
+				UpdateJobRunDetail(task->run.runId, status == BGWH_STARTED ? &pid : NULL,
+								   GetCronStatus(CRON_STATUS_RUNNING), NULL, &start_time, NULL);
 
 			task->state = CRON_TASK_BGW_RUNNING;
 			break;
@@ -1980,7 +2949,7 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 		{
 			PostgresPollingStatusType pollingStatus = 0;
 
-			Assert(!UseBackgroundWorkers);
+			Assert(task->run.executor == CRON_EXECUTOR_LIBPQ);
 
 			/* check if job has been removed */
 			if (jobCanceled(task))
@@ -1994,14 +2963,14 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 			connectionStatus = PQstatus(connection);
 			if (connectionStatus == CONNECTION_BAD)
 			{
-				task->errorMessage = "connection failed";
-				task->pollingStatus = 0;
+				task->run.errorMessage = "connection failed";
+				task->run.pollingStatus = 0;
 				task->state = CRON_TASK_ERROR;
 				break;
 			}
 
 			/* check if socket is ready to send */
-			if (!task->isSocketReady)
+			if (!task->run.isSocketReady)
 			{
 				break;
 			}
@@ -2012,18 +2981,18 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 			{
 				pid_t pid;
 				/* wait for socket to be ready to send a query */
-				task->pollingStatus = PGRES_POLLING_WRITING;
+				task->run.pollingStatus = PGRES_POLLING_WRITING;
 
 				task->state = CRON_TASK_SENDING;
 
 				pid = (pid_t) PQbackendPID(connection);
 				if (CronLogRun)
-					UpdateJobRunDetail(task->runId, &pid, GetCronStatus(CRON_STATUS_SENDING), NULL, NULL, NULL);
+					UpdateJobRunDetail(task->run.runId, &pid, GetCronStatus(CRON_STATUS_SENDING), NULL, NULL, NULL);
 			}
 			else if (pollingStatus == PGRES_POLLING_FAILED)
 			{
-				task->errorMessage = "connection failed";
-				task->pollingStatus = 0;
+				task->run.errorMessage = "connection failed";
+				task->run.pollingStatus = 0;
 				task->state = CRON_TASK_ERROR;
 			}
 			else
@@ -2035,7 +3004,7 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 				 * based on the status returned by PQconnectPoll, see:
 				 * https://www.postgresql.org/docs/9.5/static/libpq-connect.html
 				 */
-				task->pollingStatus = pollingStatus;
+				task->run.pollingStatus = pollingStatus;
 			}
 
 			break;
@@ -2043,10 +3012,10 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 
 		case CRON_TASK_SENDING:
 		{
-			char *command = cronJob->command;
+			char *command = TaskCommand(task, cronJob);
 			int sendResult = 0;
 
-			Assert(!UseBackgroundWorkers);
+			Assert(task->run.executor == CRON_EXECUTOR_LIBPQ);
 
 			/* check if job has been removed */
 			if (jobCanceled(task))
@@ -2057,7 +3026,7 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 				break;
 
 			/* check if socket is ready to send */
-			if (!task->isSocketReady)
+			if (!task->run.isSocketReady)
 			{
 				break;
 			}
@@ -2066,17 +3035,58 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 			connectionStatus = PQstatus(connection);
 			if (connectionStatus == CONNECTION_BAD)
 			{
-				task->errorMessage = "connection lost";
-				task->pollingStatus = 0;
+				task->run.errorMessage = "connection lost";
+				task->run.pollingStatus = 0;
 				task->state = CRON_TASK_ERROR;
 				break;
 			}
 
-			sendResult = PQsendQuery(connection, command);
+#ifdef LIBPQ_HAS_PIPELINING
+			if (task->run.batchSize > 0)
+			{
+				sendResult = SendTaskBatch(task, command);
+			}
+			else
+#endif
+			if (CronUsePreparedStatements && task->mode != CRON_MODE_FIXED &&
+				!task->isRunInstance && CommandIsPreparable(command))
+			{
+				char statementName[NAMEDATALEN];
+
+				snprintf(statementName, NAMEDATALEN, "pg_cron_" INT64_FORMAT, jobId);
+
+				if (!task->isPrepared)
+				{
+					/* parse and plan the command once per connection */
+					if (PQsendPrepare(connection, statementName, command, 0, NULL) == 1)
+					{
+						task->run.pollingStatus = PGRES_POLLING_READING;
+						task->state = CRON_TASK_PREPARING;
+					}
+
+					break;
+				}
+
+				sendResult = PQsendQueryPrepared(connection, statementName, 0, NULL,
+												 NULL, NULL, 0);
+			}
+			else
+			{
+				sendResult = PQsendQuery(connection, command);
+			}
+
 			if (sendResult == 1)
 			{
 				/* wait for socket to be ready to receive results */
-				task->pollingStatus = PGRES_POLLING_READING;
+				task->run.pollingStatus = PGRES_POLLING_READING;
+
+#ifdef LIBPQ_HAS_PIPELINING
+				/* in nonblocking mode, a batch may not be sent all at once */
+				if (task->run.batchSize > 0 && PQflush(connection) != 0)
+				{
+					task->run.pollingStatus = PGRES_POLLING_WRITING;
+				}
+#endif
 
 				/*
 				 * set task execution timeout
@@ -2084,19 +3094,19 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 				 */
 				if (MaxRunTaskTimeout)
 				{
-					task->startDeadline = TimestampTzPlusMilliseconds(currentTime, (MaxRunTaskTimeout * 1000));
+					task->run.startDeadline = TimestampTzPlusMilliseconds(currentTime, (MaxRunTaskTimeout * 1000));
 				}
 				else
 				{
 					/* command is underway, stop using timeout */
-					task->startDeadline = 0;
+					task->run.startDeadline = 0;
 				}
 
 				task->state = CRON_TASK_RUNNING;
 
 				start_time = GetCurrentTimestamp();
 				if (CronLogRun)
-					UpdateJobRunDetail(task->runId, NULL, GetCronStatus(CRON_STATUS_RUNNING), NULL, &start_time, NULL);
+					UpdateJobRunDetail(task->run.runId, NULL, GetCronStatus(CRON_STATUS_RUNNING), NULL, &start_time, NULL);
 			}
 			else
 			{
@@ -2106,13 +3116,75 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 			break;
 		}
 
+		case CRON_TASK_PREPARING:
+		{
+			PGresult *result = NULL;
+
+			Assert(task->run.executor == CRON_EXECUTOR_LIBPQ);
+
+			/* check if job has been removed */
+			if (jobCanceled(task))
+				break;
+
+			/* check if timeout has been reached */
+			if (jobStartupTimeout(task, currentTime))
+				break;
+
+			/* check if connection is still alive */
+			connectionStatus = PQstatus(connection);
+			if (connectionStatus == CONNECTION_BAD)
+			{
+				task->run.errorMessage = "connection lost";
+				task->run.pollingStatus = 0;
+				task->state = CRON_TASK_ERROR;
+				break;
+			}
+
+			/* check if socket is ready to receive */
+			if (!task->run.isSocketReady)
+			{
+				break;
+			}
+
+			PQconsumeInput(connection);
+
+			if (PQisBusy(connection))
+			{
+				/* still waiting for the statement to be prepared */
+				break;
+			}
+
+			while ((result = PQgetResult(connection)) != NULL)
+			{
+				if (PQresultStatus(result) == PGRES_COMMAND_OK)
+				{
+					task->isPrepared = true;
+					PQclear(result);
+				}
+				else
+				{
+					/* the command cannot run, report why like any other failure */
+					GetTaskFeedback(result, task);
+				}
+			}
+
+			if (task->state == CRON_TASK_ERROR)
+				break;
+
+			/* wait for socket to be ready to execute the prepared statement */
+			task->run.pollingStatus = PGRES_POLLING_WRITING;
+			task->state = CRON_TASK_SENDING;
+
+			break;
+		}
+
 		case CRON_TASK_RUNNING:
 		{
 			if (CRON_COMMAND_TYPE_SQL == task->commandtype)
 			{
 				int connectionBusy = 0;
 				PGresult *result = NULL;
-				Assert(!UseBackgroundWorkers);
+				Assert(task->run.executor == CRON_EXECUTOR_LIBPQ);
 
 				/* check if job has been removed */
 				if (jobCanceled(task))
@@ -2122,63 +3194,97 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 				 * lightdb add 2022/4/20 for S202204026369
 				 */
 				if (MaxRunTaskTimeout && jobRunningTimeout(task, currentTime))
-				{
-					if (connection)
-					{
-						char errbuf[256] = {0};
-						PGcancel *cancel = PQgetCancel(connection);
-
-						if (cancel)
-						{
-							if (1 != PQcancel(cancel, errbuf, 256))
-							{
-								task->errorMessage = errbuf;
-							}
-							
-							PQfreeCancel(cancel);
-						}
-					}
-					
 					break;
-				}
 
 				/* check if connection is still alive */
 				connectionStatus = PQstatus(connection);
 				if (connectionStatus == CONNECTION_BAD)
 				{
-					task->errorMessage = "connection lost";
-					task->pollingStatus = 0;
+					task->run.errorMessage = "connection lost";
+					task->run.pollingStatus = 0;
 					task->state = CRON_TASK_ERROR;
 					break;
 				}
 
 				/* check if socket is ready to send */
-				if (!task->isSocketReady)
+				if (!task->run.isSocketReady)
 				{
 					break;
 				}
 
 				PQconsumeInput(connection);
 
-				connectionBusy = PQisBusy(connection);
+#ifdef LIBPQ_HAS_PIPELINING
+				if (task->run.batchSize > 0)
+				{
+					if (task->run.pollingStatus == PGRES_POLLING_WRITING)
+					{
+						/* send the rest of the batch first */
+						int flushResult = PQflush(connection);
+
+						if (flushResult == -1)
+						{
+							task->run.errorMessage = strdup(PQerrorMessage(connection));
+							task->run.freeErrorMessage = true;
+							task->run.pollingStatus = 0;
+							task->state = CRON_TASK_ERROR;
+							break;
+						}
+						else if (flushResult == 1)
+						{
+							break;
+						}
+
+						task->run.pollingStatus = PGRES_POLLING_READING;
+					}
+
+					/* results of the batched jobs arrive in the order they were sent */
+					if (!ReceiveTaskBatchResults(task))
+						break;
+
+					PQexitPipelineMode(connection);
+					FinishTaskBatch(task, NULL);
 
-				if (connectionBusy)
+					if (task->run.batchLeaderFailed)
+					{
+						/* the followers are settled, now the leader fails */
+						task->run.batchLeaderFailed = false;
+						task->run.pollingStatus = 0;
+						task->state = CRON_TASK_ERROR;
+						break;
+					}
+				}
+				else
+#endif
 				{
-					/* still waiting for results */
-					
-					break;
+					connectionBusy = PQisBusy(connection);
+
+					if (connectionBusy)
+					{
+						/* still waiting for results */
+						break;
+					}
+
+					while ((result = PQgetResult(connection)) != NULL)
+					{
+						GetTaskFeedback(result, task);
+					}
 				}
 
-				while ((result = PQgetResult(connection)) != NULL)
+				if (!KeepTaskConnection(task, cronJob))
 				{
-					GetTaskFeedback(result, task);
-				}
+					PQfinish(connection);
 
-				PQfinish(connection);
+					task->connection = NULL;
+					task->isPrepared = false;
+				}
+				else
+				{
+					AddKeptConnection(task, currentTime);
+				}
 
-				task->connection = NULL;
-				task->pollingStatus = 0;
-				task->isSocketReady = false;
+				task->run.pollingStatus = 0;
+				task->run.isSocketReady = false;
 
 				task->state = CRON_TASK_DONE;
 				RunningTaskCount--;
@@ -2192,21 +3298,17 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 			
 				/* check if job has been removed */
 				if (jobCanceled(task))
-				{
-					TerminateBackgroundWorker(&task->handle);
-					WaitForBackgroundWorkerShutdown(&task->handle);
 					break;
-				}
 
 				/*if (MaxRunLinuxTaskTimeout && jobRunningTimeout(task, currentTime))
 				{
-					TerminateBackgroundWorker(&task->handle);
-					WaitForBackgroundWorkerShutdown(&task->handle);
+					TerminateBackgroundWorker(&task->run.handle);
+					WaitForBackgroundWorkerShutdown(&task->run.handle);
 					break;
 				}*/
 
 				/* still waiting for job to complete */
-				if (GetBackgroundWorkerPid(&task->handle, &pid) != BGWH_STOPPED)
+				if (GetBackgroundWorkerPid(&task->run.handle, &pid) != BGWH_STOPPED)
 					break;
 
 				task->state = CRON_TASK_DONE;
@@ -2220,68 +3322,230 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 		case CRON_TASK_BGW_RUNNING:
 		{
 			pid_t pid;
-			shm_mq_handle *responseq;
-			shm_mq *mq;
-			shm_toc *toc;
+			shm_mq_result res;
+
+			Assert(task->run.executor != CRON_EXECUTOR_LIBPQ);
+
+			/* a daemon run is restarted when its job changes */
+			if (task->run.runMode == CRON_MODE_DAEMON && DaemonRunOutdated(task, cronJob))
+				task->run.cancelRequested = true;
 
-			Assert(UseBackgroundWorkers);
 			/* check if job has been removed */
 			if (jobCanceled(task))
+				break;
+
+			/*
+			 * Read what the worker sent so far, so that a worker producing a
+			 * lot of output never blocks on a full queue. The worker sets our
+			 * latch whenever it sends a message.
+			 */
+			res = GetBgwTaskFeedback(task->run.responseq, task, true);
+
+			if (res == SHM_MQ_WOULD_BLOCK)
 			{
-				TerminateBackgroundWorker(&task->handle);
-				WaitForBackgroundWorkerShutdown(&task->handle);
-				dsm_detach(task->seg);
-				task->seg = NULL;
+				/* pool workers stay around, a dead one detaches its queue */
+				if (task->run.poolWorker != NULL)
+					break;
 
-				break;
+				/* still waiting for job to complete */
+				if (GetBackgroundWorkerPid(&task->run.handle, &pid) != BGWH_STOPPED)
+					break;
+
+				/* the worker is gone, so everything it sent is in the queue */
+				res = GetBgwTaskFeedback(task->run.responseq, task, true);
+				if (res == SHM_MQ_WOULD_BLOCK)
+					res = SHM_MQ_DETACHED;
 			}
 
-			/* still waiting for job to complete */
-			if (GetBackgroundWorkerPid(&task->handle, &pid) != BGWH_STOPPED)
+			if (res == SHM_MQ_DETACHED && !task->run.bgwHasResult)
+			{
+				task->run.errorMessage = "background worker exited";
+				task->state = CRON_TASK_ERROR;
 				break;
+			}
 
-			toc = shm_toc_attach(PG_CRON_MAGIC, dsm_segment_address(task->seg));
-			#if PG_VERSION_NUM < 100000
-				mq = shm_toc_lookup(toc, PG_CRON_KEY_QUEUE);
-			#else
-				mq = shm_toc_lookup(toc, PG_CRON_KEY_QUEUE, false);
-			#endif
-			responseq = shm_mq_attach(mq, task->seg, NULL);
-			GetBgwTaskFeedback(responseq, task);
+			ReportBgwTaskResult(task);
 
+			/* the targets of a fan-out run that failed are not processed */
+			if (task->run.bgwFailed)
+				DropFanoutTargets(task);
+
+			if (task->run.poolWorker != NULL)
+			{
+				/* a pool worker that went away mid-run cannot be reused */
+				ReleasePoolWorker(task->run.poolWorker, res == SHM_MQ_SUCCESS);
+				task->run.poolWorker = NULL;
+			}
+			else if (task->run.runSlot >= 0)
+			{
+				/* the worker may still be exiting after ReadyForQuery */
+				ReleaseRunSlot(task->run.runSlot, &task->run.handle);
+				task->run.runSlot = -1;
+			}
+			else
+			{
+#if PG_VERSION_NUM >= 110000
+				shm_mq_detach(task->run.responseq);
+#endif
+				dsm_detach(task->run.seg);
+				task->run.seg = NULL;
+			}
+
+			task->run.responseq = NULL;
 			task->state = CRON_TASK_DONE;
-			dsm_detach(task->seg);
-			task->seg = NULL;
 			RunningTaskCount--;
 
 			break;
 		}
 
-		case CRON_TASK_ERROR:
+		case CRON_TASK_BATCHED:
 		{
-			if (connection != NULL)
-			{
-				PQfinish(connection);
-				task->connection = NULL;
-			}
+			/*
+			 * The command runs on the connection of the batch leader, which
+			 * moves this task on once its result has been received.
+			 */
+			break;
+		}
 
-			if (!task->isActive)
+		case CRON_TASK_CANCELING:
+		{
+			pid_t pid;
+			PGresult *result = NULL;
+
+			/*
+			 * A cancel request or SIGTERM has been sent without waiting for
+			 * it to take effect. Poll until the run has actually stopped, but
+			 * never wait longer than the cancel deadline.
+			 */
+			if (TimestampDifferenceExceeds(task->run.startDeadline, currentTime, 0))
+			{
+				ereport(LOG, (errmsg("cron job " INT64_FORMAT " did not stop within %d ms "
+									 "after being canceled", jobId, CronTaskCancelTimeout)));
+			}
+			else if (connection != NULL)
+			{
+#ifdef LIBPQ_HAS_ASYNC_CANCEL
+				if (task->run.cancelConn != NULL)
+				{
+					PostgresPollingStatusType cancelStatus = PQcancelPoll(task->run.cancelConn);
+
+					if (cancelStatus == PGRES_POLLING_OK ||
+						cancelStatus == PGRES_POLLING_FAILED)
+					{
+						PQcancelFinish(task->run.cancelConn);
+						task->run.cancelConn = NULL;
+						task->run.cancelPollingStatus = 0;
+					}
+					else
+					{
+						/* the cancel request is still in flight, wait for its socket */
+						task->run.cancelPollingStatus = cancelStatus;
+						break;
+					}
+				}
+#endif
+				if (PQstatus(connection) != CONNECTION_BAD)
+				{
+					if (!task->run.isSocketReady)
+						break;
+
+					PQconsumeInput(connection);
+
+					/* still waiting for the backend to act on the cancel */
+					if (PQisBusy(connection))
+						break;
+
+					/* discard the "canceling statement" error and anything before it */
+					while ((result = PQgetResult(connection)) != NULL)
+						PQclear(result);
+				}
+			}
+			else if (GetBackgroundWorkerPid(&task->run.handle, &pid) != BGWH_STOPPED)
+			{
+				/* still waiting for the worker to exit */
+				break;
+			}
+
+			if (task->run.seg != NULL)
+			{
+				dsm_detach(task->run.seg);
+				task->run.seg = NULL;
+			}
+
+			task->run.pollingStatus = 0;
+			task->state = CRON_TASK_ERROR;
+
+			/* fall through to CRON_TASK_ERROR */
+		}
+
+		case CRON_TASK_ERROR:
+		{
+			runFailed = true;
+
+#ifdef LIBPQ_HAS_ASYNC_CANCEL
+			if (task->run.cancelConn != NULL)
+			{
+				PQcancelFinish(task->run.cancelConn);
+				task->run.cancelConn = NULL;
+				task->run.cancelPollingStatus = 0;
+			}
+#endif
+			if (connection != NULL)
+			{
+				PQfinish(connection);
+				task->connection = NULL;
+				task->isPrepared = false;
+			}
+
+			if (task->run.batchSize > 0)
+			{
+				FinishTaskBatch(task, task->run.errorMessage != NULL ?
+								task->run.errorMessage : "batch leader failed");
+			}
+
+			LeaveBgwRetryQueue(task->run.runId);
+			DropFanoutTargets(task);
+
+			if (task->run.seg != NULL)
+			{
+				dsm_detach(task->run.seg);
+				task->run.seg = NULL;
+			}
+
+			if (task->run.runSlot >= 0)
+			{
+				/* the worker may outlive a canceled run, keep its slot until it exits */
+				ReleaseRunSlot(task->run.runSlot, &task->run.handle);
+				task->run.runSlot = -1;
+			}
+
+			if (task->run.poolWorker != NULL)
+			{
+				/* the worker may be gone or in an unknown state, replace it */
+				ReleasePoolWorker(task->run.poolWorker, false);
+				task->run.poolWorker = NULL;
+			}
+
+			task->run.responseq = NULL;
+
+			if (!task->isActive && !task->isRunInstance &&
+				JobRunInstanceCount(jobId) == 0)
 			{
 				RemoveTask(jobId);
 			}
 
-			if (task->errorMessage != NULL)
+			if (task->run.errorMessage != NULL)
 			{
 				if (CronLogRun)
-					UpdateJobRunDetail(task->runId, NULL, GetCronStatus(CRON_STATUS_FAILED), task->errorMessage, NULL, NULL);
+					UpdateJobRunDetail(task->run.runId, NULL, GetCronStatus(CRON_STATUS_FAILED), task->run.errorMessage, NULL, NULL);
 
 				ereport(LOG, (errmsg("cron job " INT64_FORMAT " %s",
-									 jobId, task->errorMessage)));
+									 jobId, task->run.errorMessage)));
 
 
-				if (task->freeErrorMessage)
+				if (task->run.freeErrorMessage)
 				{
-					free(task->errorMessage);
+					free(task->run.errorMessage);
 				}
 			}
 			else
@@ -2289,36 +3553,55 @@ ManageCronTask(CronTask *task, TimestampTz currentTime)
 				ereport(LOG, (errmsg("cron job " INT64_FORMAT " %s", jobId, GetCronStatus(CRON_STATUS_FAILED))));
 			}
 
-			task->startDeadline = 0;
-			task->isSocketReady = false;
+			task->run.startDeadline = 0;
+			task->run.isSocketReady = false;
 			task->state = CRON_TASK_DONE;
 
+			RunningTaskCount--;
+
 			/* fall through to CRON_TASK_DONE */
 		}
 
 		case CRON_TASK_DONE:
 		default:
 		{
-			int currentPendingRunCount = task->pendingRunCount;
 			CronJob *job = GetCronJob(jobId);
 
+			/* the run is over, wake up the sessions that wait for it */
+			WakeRunWaiters(task->run.runId);
+
+			if (task->run.parentRunId != 0)
+				ReportFanoutResult(task, !runFailed && !task->run.bgwFailed);
+
+			if (task->run.runMode == CRON_MODE_DAEMON)
+			{
+				/* the restart backoff is kept by the task of the job */
+				CronTask *jobTask = task->isRunInstance ? FindCronTask(jobId) : task;
+
+				if (jobTask != NULL)
+					DelayDaemonRestart(jobTask, task->run.runStartTime,
+									   GetCurrentTimestamp());
+			}
+
+			FreeRunTargets(task);
+
 			/*
 			 * It may happen that job was unscheduled during task execution.
-			 * In this case we keep task as-is. Otherwise, we should
-			 * re-initialize task, i.e. reset fields to initial values including
-			 * status.
+			 * In this case we keep the run as-is. Otherwise, we reset it, while
+			 * what outlives the run, like a connection kept open, stays.
 			 */
 			if (job != NULL && job->active)
-				InitializeCronTask(task, jobId);
-			else
-				task->state = CRON_TASK_WAITING;
+			{
+				InitializeCronTaskRun(&task->run);
+			}
+
+			task->state = CRON_TASK_WAITING;
 
 			/*
 			 * We keep the number of runs that should have started while
 			 * the task was still running. If >0, this will trigger another
 			 * run immediately.
 			 */
-			task->pendingRunCount = currentPendingRunCount;
 			task->pendingRunCount -= 1;
 
 			if (CRON_MODE_SINGLE == task->mode)
@@ -2349,7 +3632,7 @@ GetTaskFeedback(PGresult *result, CronTask *task)
 			char *cmdTuples = PQcmdTuples(result);
 
 			if (CronLogRun)
-				UpdateJobRunDetail(task->runId, NULL, GetCronStatus(CRON_STATUS_SUCCEEDED), cmdStatus, NULL, &end_time);
+				UpdateJobRunDetail(task->run.runId, NULL, GetCronStatus(CRON_STATUS_SUCCEEDED), cmdStatus, NULL, &end_time);
 
 			if (CronLogStatement)
 			{
@@ -2363,30 +3646,46 @@ GetTaskFeedback(PGresult *result, CronTask *task)
 		case PGRES_BAD_RESPONSE:
 		case PGRES_FATAL_ERROR:
 		{
-			task->errorMessage = strdup(PQresultErrorMessage(result));
-			task->freeErrorMessage = true;
-			task->pollingStatus = 0;
+			task->run.errorMessage = strdup(PQresultErrorMessage(result));
+			task->run.freeErrorMessage = true;
+			task->run.pollingStatus = 0;
 			task->state = CRON_TASK_ERROR;
 
 			if (CronLogRun)
-				UpdateJobRunDetail(task->runId, NULL, GetCronStatus(CRON_STATUS_FAILED), task->errorMessage, NULL, &end_time);
+				UpdateJobRunDetail(task->run.runId, NULL, GetCronStatus(CRON_STATUS_FAILED), task->run.errorMessage, NULL, &end_time);
 
 			PQclear(result);
 
 			return;
 		}
 
+#ifdef LIBPQ_HAS_PIPELINING
+		case PGRES_PIPELINE_ABORTED:
+		{
+			task->run.errorMessage = "pipeline aborted";
+			task->run.pollingStatus = 0;
+			task->state = CRON_TASK_ERROR;
+
+			if (CronLogRun)
+				UpdateJobRunDetail(task->run.runId, NULL, GetCronStatus(CRON_STATUS_FAILED), task->run.errorMessage, NULL, &end_time);
+
+			PQclear(result);
+
+			return;
+		}
+#endif
+
 		case PGRES_COPY_IN:
 		case PGRES_COPY_OUT:
 		case PGRES_COPY_BOTH:
 		{
 			/* cannot handle COPY input/output */
-			task->errorMessage = "COPY not supported";
-			task->pollingStatus = 0;
+			task->run.errorMessage = "COPY not supported";
+			task->run.pollingStatus = 0;
 			task->state = CRON_TASK_ERROR;
 
 			if (CronLogRun)
-				UpdateJobRunDetail(task->runId, NULL, GetCronStatus(CRON_STATUS_FAILED), task->errorMessage, NULL, &end_time);
+				UpdateJobRunDetail(task->run.runId, NULL, GetCronStatus(CRON_STATUS_FAILED), task->run.errorMessage, NULL, &end_time);
 
 			PQclear(result);
 
@@ -2409,7 +3708,7 @@ GetTaskFeedback(PGresult *result, CronTask *task)
 			snprintf(outputrows, sizeof(outputrows), "%s %s", rows, rowString);
 
 			if (CronLogRun)
-				UpdateJobRunDetail(task->runId, NULL, GetCronStatus(CRON_STATUS_SUCCEEDED), outputrows, NULL, &end_time);
+				UpdateJobRunDetail(task->run.runId, NULL, GetCronStatus(CRON_STATUS_SUCCEEDED), outputrows, NULL, &end_time);
 
 			/*if (CronLogStatement)
 			{
@@ -2427,19 +3726,26 @@ GetTaskFeedback(PGresult *result, CronTask *task)
 	PQclear(result);
 }
 
-static void
-GetBgwTaskFeedback(shm_mq_handle *responseq, CronTask *task)
+/*
+ * GetBgwTaskFeedback processes the messages that a background worker sent
+ * for a run. Only a bounded summary of them is kept in the task: the last
+ * result or error message, whether the run failed and the number of rows
+ * processed, which is written to the run details at most once per
+ * BgwProgressInterval while the run goes on. With nowait it stops when no
+ * more messages are available and returns SHM_MQ_WOULD_BLOCK. Returns
+ * SHM_MQ_SUCCESS once ReadyForQuery has been received and SHM_MQ_DETACHED if
+ * the worker went away before that.
+ */
+static shm_mq_result
+GetBgwTaskFeedback(shm_mq_handle *responseq, CronTask *task, bool nowait)
 {
-
-	TimestampTz end_time;
-
 	Size            nbytes;
 	void       *data;
 	char            msgtype;
 	StringInfoData  msg;
 	shm_mq_result res;
+	TimestampTz currentTime;
 
-	end_time = GetCurrentTimestamp();
 	/*
 	 * Message-parsing routines operate on a null-terminated StringInfo,
 	 * so we must construct one.
@@ -2447,7 +3753,7 @@ GetBgwTaskFeedback(shm_mq_handle *responseq, CronTask *task)
 	for (;;)
 	{
 		/* Get next message. */
-		res = shm_mq_receive(responseq, &nbytes, &data, false);
+		res = shm_mq_receive(responseq, &nbytes, &data, nowait);
 
 		if (res != SHM_MQ_SUCCESS)
 			break;
@@ -2470,15 +3776,9 @@ GetBgwTaskFeedback(shm_mq_handle *responseq, CronTask *task)
 					initStringInfo(&display_msg);
 					bgw_generate_returned_message(&display_msg, edata);
 
-					if (CronLogRun)
-					{
-
-						if (edata.elevel >= ERROR)
-							UpdateJobRunDetail(task->runId, NULL, GetCronStatus(CRON_STATUS_FAILED), display_msg.data, NULL, &end_time);
-						else
-							UpdateJobRunDetail(task->runId, NULL, GetCronStatus(CRON_STATUS_SUCCEEDED), display_msg.data, NULL, &end_time);
-
-					}
+					task->run.bgwFailed = edata.elevel >= ERROR;
+					task->run.bgwHasResult = true;
+					strlcpy(task->run.bgwMessage, display_msg.data, BGW_RETURN_MESSAGE_SIZE);
 
 					ereport(LOG, (errmsg("cron job " INT64_FORMAT ": %s",
 									 task->jobId, display_msg.data)));
@@ -2495,12 +3795,17 @@ GetBgwTaskFeedback(shm_mq_handle *responseq, CronTask *task)
 					char *cmdTuples;
 
 					nonconst_tag = strdup(tag);
+					cmdTuples = pg_cron_cmdTuples(nonconst_tag);
 
-					if (CronLogRun)
-						UpdateJobRunDetail(task->runId, NULL, GetCronStatus(CRON_STATUS_SUCCEEDED), nonconst_tag, NULL, &end_time);
+					task->run.bgwFailed = false;
+					task->run.bgwHasResult = true;
+					strlcpy(task->run.bgwMessage, nonconst_tag, BGW_RETURN_MESSAGE_SIZE);
 
-					if (CronLogStatement) {
-						cmdTuples = pg_cron_cmdTuples(nonconst_tag);
+					if (cmdTuples[0] != '\0')
+						task->run.rowsProcessed += strtol(cmdTuples, NULL, 10);
+
+					/* runs that loop complete a command on every iteration */
+					if (CronLogStatement && !ModeHasOwnWorker(task->run.runMode)) {
 						ereport(LOG, (errmsg("cron job " INT64_FORMAT " COMMAND completed: %s %s",
 											 task->jobId, nonconst_tag, cmdTuples)));
 					}
@@ -2508,13 +3813,25 @@ GetBgwTaskFeedback(shm_mq_handle *responseq, CronTask *task)
 					free(nonconst_tag);
 					break;
 				}
-			case 'A':
 			case 'D':
+				{
+					/* a fan-out run sends the targets that it found */
+					if (task->run.runMode == CRON_MODE_FANOUT)
+						AddFanoutTarget(task, pq_getmsgstring(&msg));
+
+					break;
+				}
+			case 'A':
 			case 'G':
 			case 'H':
 			case 'W':
-			case 'Z':
 					break;
+			case 'Z':
+				{
+					/* the run is complete */
+					pfree(msg.data);
+					return SHM_MQ_SUCCESS;
+				}
 			default:
 					elog(WARNING, "unknown message type: %c (%zu bytes)",
 						 msg.data[0], nbytes);
@@ -2522,22 +3839,51 @@ GetBgwTaskFeedback(shm_mq_handle *responseq, CronTask *task)
 		}
 		pfree(msg.data);
 	}
+
+	currentTime = GetCurrentTimestamp();
+
+	if (res == SHM_MQ_WOULD_BLOCK && CronLogRun &&
+		task->run.rowsProcessed != task->run.rowsReported &&
+		TimestampDifferenceExceeds(task->run.lastProgressTime, currentTime,
+								   BgwProgressInterval))
+	{
+		char progress[64];
+
+		snprintf(progress, sizeof(progress), INT64_FORMAT " rows processed",
+				 task->run.rowsProcessed);
+		UpdateJobRunDetail(task->run.runId, NULL, NULL, progress, NULL, NULL);
+
+		task->run.rowsReported = task->run.rowsProcessed;
+		task->run.lastProgressTime = currentTime;
+	}
+
+	return res;
 }
 
 /*
- * Background worker logic.
+ * ReportBgwTaskResult writes the outcome of a background worker run, as
+ * summarized by GetBgwTaskFeedback, to the run details.
  */
-void
-CronBackgroundWorker(Datum main_arg)
+static void
+ReportBgwTaskResult(CronTask *task)
 {
-	dsm_segment *seg;
-	shm_toc *toc;
-	char *database;
-	char *username;
-	char *command;
-	shm_mq *mq;
-	shm_mq_handle *responseq;
+	TimestampTz end_time = GetCurrentTimestamp();
+	CronStatus status = task->run.bgwFailed ? CRON_STATUS_FAILED : CRON_STATUS_SUCCEEDED;
+
+	if (!task->run.bgwHasResult || !CronLogRun)
+		return;
 
+	UpdateJobRunDetail(task->run.runId, NULL, GetCronStatus(status), task->run.bgwMessage,
+					   NULL, &end_time);
+}
+
+/*
+ * StartCronWorker sets up the signal handling, resource owner and memory
+ * context that every background worker of pg_cron starts with.
+ */
+static void
+StartCronWorker(const char *contextName)
+{
 	pqsignal(SIGTERM, pg_cron_background_worker_sigterm);
 	BackgroundWorkerUnblockSignals();
 
@@ -2545,10 +3891,128 @@ CronBackgroundWorker(Datum main_arg)
 	Assert(CurrentResourceOwner == NULL);
 	CurrentResourceOwner = ResourceOwnerCreate(NULL, "pg_cron");
 	CurrentMemoryContext = AllocSetContextCreate(TopMemoryContext,
-												 "pg_cron worker",
+												 contextName,
 												 ALLOCSET_DEFAULT_MINSIZE,
 												 ALLOCSET_DEFAULT_INITSIZE,
 												 ALLOCSET_DEFAULT_MAXSIZE);
+}
+
+/*
+ * Background worker logic.
+ */
+void
+CronBackgroundWorker(Datum main_arg)
+{
+	dsm_segment *seg;
+	char *database;
+	char *username;
+	char *command;
+	char *profile;
+	shm_mq *mq;
+
+	StartCronWorker("pg_cron worker");
+
+	seg = AttachWorkerSegment(main_arg, &database, &username, &profile, &command, &mq);
+
+	ExecuteBackgroundWorkerRun(seg, database, username, profile, command, mq);
+}
+
+/*
+ * Background worker logic for the runs of daemon jobs.
+ */
+void
+CronDaemonWorker(Datum main_arg)
+{
+	dsm_segment *seg;
+	char *database;
+	char *username;
+	char *command;
+	char *profile;
+	shm_mq *mq;
+
+	StartCronWorker("pg_cron daemon");
+
+	seg = AttachWorkerSegment(main_arg, &database, &username, &profile, &command, &mq);
+
+	ExecuteDaemonRun(seg, database, username, profile, command, mq);
+}
+
+/*
+ * Background worker logic for the runs of queue consumers.
+ */
+void
+CronConsumerWorker(Datum main_arg)
+{
+	dsm_segment *seg;
+	char *database;
+	char *username;
+	char *command;
+	char *profile;
+	shm_mq *mq;
+	CronWorkerExtra extra;
+
+	StartCronWorker("pg_cron consumer");
+
+	memcpy(&extra, MyBgworkerEntry->bgw_extra, sizeof(CronWorkerExtra));
+
+	seg = AttachWorkerSegment(main_arg, &database, &username, &profile, &command, &mq);
+
+	ExecuteConsumerRun(seg, extra.jobId, database, username, profile, command, mq);
+}
+
+/*
+ * Background worker logic for the runs of chunked jobs.
+ */
+void
+CronChunkedWorker(Datum main_arg)
+{
+	dsm_segment *seg;
+	char *database;
+	char *username;
+	char *command;
+	char *profile;
+	shm_mq *mq;
+	CronWorkerExtra extra;
+
+	StartCronWorker("pg_cron chunked job");
+
+	memcpy(&extra, MyBgworkerEntry->bgw_extra, sizeof(CronWorkerExtra));
+
+	seg = AttachWorkerSegment(main_arg, &database, &username, &profile, &command, &mq);
+
+	ExecuteChunkedRun(seg, &extra, database, username, profile, command, mq);
+}
+
+/*
+ * Background worker logic for the runs of fan-out jobs.
+ */
+void
+CronFanoutWorker(Datum main_arg)
+{
+	dsm_segment *seg;
+	char *database;
+	char *username;
+	char *command;
+	char *profile;
+	shm_mq *mq;
+
+	StartCronWorker("pg_cron fan-out");
+
+	seg = AttachWorkerSegment(main_arg, &database, &username, &profile, &command, &mq);
+
+	ExecuteFanoutRun(seg, database, username, profile, command, mq);
+}
+
+/*
+ * AttachWorkerSegment maps the dynamic shared memory segment that the
+ * launcher set up for a run and looks up the parameters of the run in it.
+ */
+static dsm_segment *
+AttachWorkerSegment(Datum main_arg, char **database, char **username,
+					char **profile, char **command, shm_mq **mq)
+{
+	dsm_segment *seg;
+	shm_toc *toc;
 
 	/* Set up a dynamic shared memory segment. */
 	seg = dsm_attach(DatumGetInt32(main_arg));
@@ -2563,17 +4027,33 @@ CronBackgroundWorker(Datum main_arg)
 			   errmsg("bad magic number in dynamic shared memory segment")));
 
 	#if PG_VERSION_NUM < 100000
-		database = shm_toc_lookup(toc, PG_CRON_KEY_DATABASE);
-		username = shm_toc_lookup(toc, PG_CRON_KEY_USERNAME);
-		command = shm_toc_lookup(toc, PG_CRON_KEY_COMMAND);
-		mq = shm_toc_lookup(toc, PG_CRON_KEY_QUEUE);
+		*database = shm_toc_lookup(toc, PG_CRON_KEY_DATABASE);
+		*username = shm_toc_lookup(toc, PG_CRON_KEY_USERNAME);
+		*command = shm_toc_lookup(toc, PG_CRON_KEY_COMMAND);
+		*profile = shm_toc_lookup(toc, PG_CRON_KEY_PROFILE);
+		*mq = shm_toc_lookup(toc, PG_CRON_KEY_QUEUE);
 	#else
-		database = shm_toc_lookup(toc, PG_CRON_KEY_DATABASE, false);
-		username = shm_toc_lookup(toc, PG_CRON_KEY_USERNAME, false);
-		command = shm_toc_lookup(toc, PG_CRON_KEY_COMMAND, false);
-		mq = shm_toc_lookup(toc, PG_CRON_KEY_QUEUE, false);
+		*database = shm_toc_lookup(toc, PG_CRON_KEY_DATABASE, false);
+		*username = shm_toc_lookup(toc, PG_CRON_KEY_USERNAME, false);
+		*command = shm_toc_lookup(toc, PG_CRON_KEY_COMMAND, false);
+		*profile = shm_toc_lookup(toc, PG_CRON_KEY_PROFILE, false);
+		*mq = shm_toc_lookup(toc, PG_CRON_KEY_QUEUE, false);
 	#endif
 
+	return seg;
+}
+
+/*
+ * ConnectWorkerRun sends the messages of the worker to the queue that the
+ * launcher reads, connects to the database of the run as the owner of the
+ * job and applies the profile of the job.
+ */
+static void
+ConnectWorkerRun(dsm_segment *seg, shm_mq *mq, char *database, char *username,
+				 char *profile)
+{
+	shm_mq_handle *responseq;
+
 	shm_mq_set_sender(mq, MyProc);
 	responseq = shm_mq_attach(mq, seg, NULL);
 	pq_redirect_to_shm_mq(seg, responseq);
@@ -2584,7 +4064,17 @@ CronBackgroundWorker(Datum main_arg)
 	BackgroundWorkerInitializeConnection(database, username, 0);
 #endif
 
-	/* Prepare to execute the query. */
+	/* session settings and memory limit of the job */
+	ApplyJobProfile(profile);
+}
+
+/*
+ * BeginRunTransaction starts the transaction in which a background worker or
+ * pool worker executes a command, under the statement timeout.
+ */
+void
+BeginRunTransaction(const char *command)
+{
 	SetCurrentStatementStartTimestamp();
 	debug_query_string = command;
 	pgstat_report_activity(STATE_RUNNING, command);
@@ -2593,42 +4083,421 @@ CronBackgroundWorker(Datum main_arg)
 		enable_timeout_after(STATEMENT_TIMEOUT, StatementTimeout);
 	else
 		disable_timeout(STATEMENT_TIMEOUT, false);
+}
 
-	/* Execute the query. */
-	ExecuteSqlString(command);
-
-	/* Post-execution cleanup. */
+/*
+ * EndRunTransaction commits the transaction that BeginRunTransaction started.
+ */
+void
+EndRunTransaction(const char *command)
+{
 	disable_timeout(STATEMENT_TIMEOUT, false);
 	CommitTransactionCommand();
-	/*ProcessCompletedNotifies();*/
 	pgstat_report_activity(STATE_IDLE, command);
-	pgstat_report_stat(true);
-
-	/* Signal that we are done. */
-	ReadyForQuery(DestRemote);
-
-	dsm_detach(seg);
-	proc_exit(0);
 }
 
 /*
- * Execute given SQL string without SPI or a libpq session.
+ * ConnectRunSPI connects to SPI for a command whose result the worker reads,
+ * within the transaction of the run.
  */
 static void
-ExecuteSqlString(const char *sql)
+ConnectRunSPI(void)
+{
+	if (SPI_connect() != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "SPI_connect failed");
+	}
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+}
+
+/*
+ * FinishRunSPI disconnects from SPI again.
+ */
+static void
+FinishRunSPI(void)
+{
+	SPI_finish();
+	PopActiveSnapshot();
+}
+
+/*
+ * FinishWorkerRun tells the launcher that the run is done and exits.
+ */
+static void
+FinishWorkerRun(dsm_segment *seg)
+{
+	pgstat_report_stat(true);
+
+	/* Signal that we are done. */
+	ReadyForQuery(DestRemote);
+
+	dsm_detach(seg);
+	proc_exit(0);
+}
+
+/*
+ * Background worker logic for runs whose parameters are in a run slot.
+ */
+void
+CronRunSlotWorker(Datum main_arg)
+{
+	dsm_segment *seg;
+	CronRunSlot *slot;
+	shm_mq *mq;
+
+	StartCronWorker("pg_cron worker");
+
+	slot = AttachRunSlot(&seg, &mq);
+
+	ExecuteBackgroundWorkerRun(seg, slot->database, slot->userName, slot->profile,
+							   slot->command, mq);
+}
+
+/*
+ * ExecuteBackgroundWorkerRun connects to the database and executes the command
+ * of a one-shot background worker run, sending the results to the launcher.
+ */
+static void
+ExecuteBackgroundWorkerRun(dsm_segment *seg, char *database, char *username,
+						   char *profile, char *command, shm_mq *mq)
+{
+	ConnectWorkerRun(seg, mq, database, username, profile);
+
+	BeginRunTransaction(command);
+
+	/* Execute the query. */
+	ExecuteSqlString(command);
+
+	EndRunTransaction(command);
+
+	FinishWorkerRun(seg);
+}
+
+/*
+ * ExecuteDaemonRun connects to the database and executes the command of a
+ * daemon job over and over, each time in a transaction of its own, until the
+ * worker is terminated or the command fails. The worker never signals that
+ * it is done, so the launcher records the run only when it starts and when
+ * it ends, with the error that stopped it.
+ */
+static void
+ExecuteDaemonRun(dsm_segment *seg, char *database, char *username,
+				 char *profile, char *command, shm_mq *mq)
+{
+	ConnectWorkerRun(seg, mq, database, username, profile);
+
+	for (;;)
+	{
+		int rc = 0;
+		int waitFlags = WL_LATCH_SET | WL_POSTMASTER_DEATH | WL_TIMEOUT;
+
+		CHECK_FOR_INTERRUPTS();
+
+		BeginRunTransaction(command);
+
+		/* Execute the query. */
+		ExecuteSqlString(command);
+
+		EndRunTransaction(command);
+		pgstat_report_stat(false);
+
+		/* SIGTERM sets the latch, so a stopped run does not wait out the nap */
+#if (PG_VERSION_NUM >= 100000)
+		rc = WaitLatch(MyLatch, waitFlags, CronDaemonNaptime, PG_WAIT_EXTENSION);
+#else
+		rc = WaitLatch(MyLatch, waitFlags, CronDaemonNaptime);
+#endif
+
+		ResetLatch(MyLatch);
+
+		if (rc & WL_POSTMASTER_DEATH)
+		{
+			proc_exit(1);
+		}
+	}
+}
+
+/*
+ * ExecuteConsumerRun connects to the database and executes the command of a
+ * queue consumer, each time in a transaction of its own, for as long as it
+ * consumes full batches. The command returns the number of rows it consumed
+ * and whether the batch was full. A full batch means that more work remains,
+ * so the consumer asks the launcher for another consumer, which the launcher
+ * starts as far as the maximum concurrency of the job allows.
+ */
+static void
+ExecuteConsumerRun(dsm_segment *seg, int64 jobId, char *database, char *username,
+				   char *profile, char *command, shm_mq *mq)
+{
+	bool moreItems = true;
+
+	ConnectWorkerRun(seg, mq, database, username, profile);
+
+	while (moreItems)
+	{
+		TupleDesc resultDescriptor = NULL;
+		HeapTuple resultRow = NULL;
+		bool isNull = false;
+		int64 consumedCount = 0;
+		char completionTag[64];
+
+		CHECK_FOR_INTERRUPTS();
+
+		BeginRunTransaction(command);
+		ConnectRunSPI();
+
+		if (SPI_execute(command, false, 0) != SPI_OK_SELECT || SPI_processed != 1 ||
+			SPI_tuptable->tupdesc->natts < 2 ||
+			SPI_gettypeid(SPI_tuptable->tupdesc, 1) != INT8OID ||
+			SPI_gettypeid(SPI_tuptable->tupdesc, 2) != BOOLOID)
+		{
+			ereport(ERROR, (errmsg("consumer command must return the number of consumed "
+								   "rows and whether more rows remain")));
+		}
+
+		resultDescriptor = SPI_tuptable->tupdesc;
+		resultRow = SPI_tuptable->vals[0];
+
+		consumedCount = DatumGetInt64(SPI_getbinval(resultRow, resultDescriptor, 1,
+													&isNull));
+		moreItems = DatumGetBool(SPI_getbinval(resultRow, resultDescriptor, 2, &isNull)) &&
+					!isNull;
+
+		FinishRunSPI();
+		EndRunTransaction(command);
+
+		/* the launcher counts the consumed rows like the rows of a DELETE */
+		snprintf(completionTag, sizeof(completionTag), "DELETE " INT64_FORMAT,
+				 consumedCount);
+		pq_puttextmessage('C', completionTag);
+
+		if (moreItems && !PushJobTrigger(jobId))
+		{
+			ereport(DEBUG1, (errmsg("could not ask for another consumer of cron job "
+									INT64_FORMAT, jobId)));
+		}
+	}
+
+	FinishWorkerRun(seg);
+}
+
+/*
+ * ExecuteChunkedRun connects to the database and executes the DML command of
+ * a chunked job in batches, each in a transaction of its own, until a batch
+ * affects no rows. The batch size that replaces the placeholder in the
+ * command adapts to the time that batches take, so that each batch holds its
+ * locks and produces WAL for about the target time of the job.
+ */
+static void
+ExecuteChunkedRun(dsm_segment *seg, CronWorkerExtra *extra, char *database,
+				  char *username, char *profile, char *command, shm_mq *mq)
+{
+	int batchTargetTime = extra->batchTargetTime > 0 ?
+						  extra->batchTargetTime : DEFAULT_BATCH_TARGET_TIME;
+	int batchSize = InitialBatchSize;
+	uint64 processedCount = 0;
+
+	ConnectWorkerRun(seg, mq, database, username, profile);
+
+	do
+	{
+		char *batchCommand = BatchCommand(command, batchSize);
+		char completionTag[64] = "";
+		TimestampTz batchStartTime = GetCurrentTimestamp();
+		long batchSeconds = 0;
+		int batchMicroseconds = 0;
+		int result = 0;
+
+		CHECK_FOR_INTERRUPTS();
+
+		BeginRunTransaction(batchCommand);
+		ConnectRunSPI();
+
+		result = SPI_execute(batchCommand, false, 0);
+		processedCount = SPI_processed;
+
+		switch (result)
+		{
+			case SPI_OK_INSERT:
+			case SPI_OK_INSERT_RETURNING:
+			{
+				snprintf(completionTag, sizeof(completionTag), "INSERT 0 " UINT64_FORMAT,
+						 processedCount);
+				break;
+			}
+
+			case SPI_OK_UPDATE:
+			case SPI_OK_UPDATE_RETURNING:
+			{
+				snprintf(completionTag, sizeof(completionTag), "UPDATE " UINT64_FORMAT,
+						 processedCount);
+				break;
+			}
+
+			case SPI_OK_DELETE:
+			case SPI_OK_DELETE_RETURNING:
+			{
+				snprintf(completionTag, sizeof(completionTag), "DELETE " UINT64_FORMAT,
+						 processedCount);
+				break;
+			}
+
+			default:
+			{
+				/* the run would never end if the command did not report its rows */
+				ereport(ERROR, (errmsg("chunked command must be an INSERT, UPDATE "
+									   "or DELETE statement")));
+			}
+		}
+
+		FinishRunSPI();
+		EndRunTransaction(batchCommand);
+		debug_query_string = NULL;
+		pfree(batchCommand);
+
+		/* the launcher adds up the rows of the batches */
+		pq_puttextmessage('C', completionTag);
+
+		TimestampDifference(batchStartTime, GetCurrentTimestamp(), &batchSeconds,
+							&batchMicroseconds);
+		batchSize = AdaptBatchSize(batchSize, batchSeconds * 1000 + batchMicroseconds / 1000,
+								   batchTargetTime);
+
+		if (processedCount > 0 && extra->batchPause > 0)
+		{
+			int rc = 0;
+			int waitFlags = WL_LATCH_SET | WL_POSTMASTER_DEATH | WL_TIMEOUT;
+
+			/* give replicas and other sessions room between batches */
+#if (PG_VERSION_NUM >= 100000)
+			rc = WaitLatch(MyLatch, waitFlags, extra->batchPause, PG_WAIT_EXTENSION);
+#else
+			rc = WaitLatch(MyLatch, waitFlags, extra->batchPause);
+#endif
+
+			ResetLatch(MyLatch);
+
+			if (rc & WL_POSTMASTER_DEATH)
+			{
+				proc_exit(1);
+			}
+		}
+	}
+	while (processedCount > 0);
+
+	FinishWorkerRun(seg);
+}
+
+/*
+ * ExecuteFanoutRun connects to the database and executes the targets query of
+ * a fan-out job. The first column of every row is sent to the launcher as a
+ * data row of its own, and the launcher runs the command of the job once for
+ * each of them after the run succeeded. Rows in which it is NULL are skipped.
+ */
+static void
+ExecuteFanoutRun(dsm_segment *seg, char *database, char *username,
+				 char *profile, char *command, shm_mq *mq)
+{
+	uint64 rowIndex = 0;
+	uint64 targetCount = 0;
+	char completionTag[64];
+
+	ConnectWorkerRun(seg, mq, database, username, profile);
+
+	BeginRunTransaction(command);
+	ConnectRunSPI();
+
+	if (SPI_execute(command, false, 0) != SPI_OK_SELECT)
+	{
+		ereport(ERROR, (errmsg("the targets query of a fan-out job must be a SELECT "
+							   "statement")));
+	}
+
+	for (rowIndex = 0; rowIndex < SPI_processed; rowIndex++)
+	{
+		char *target = SPI_getvalue(SPI_tuptable->vals[rowIndex],
+									SPI_tuptable->tupdesc, 1);
+
+		if (target == NULL)
+		{
+			continue;
+		}
+
+		pq_puttextmessage('D', target);
+		targetCount++;
+	}
+
+	FinishRunSPI();
+	EndRunTransaction(command);
+
+	snprintf(completionTag, sizeof(completionTag), "SELECT " UINT64_FORMAT, targetCount);
+	pq_puttextmessage('C', completionTag);
+
+	FinishWorkerRun(seg);
+}
+
+/*
+ * BatchCommand returns the command of a chunked job with the placeholder
+ * replaced by the given batch size.
+ */
+static char *
+BatchCommand(const char *command, int batchSize)
+{
+	StringInfoData batchCommand;
+	const char *placeholder = NULL;
+	int placeholderLength = strlen(BATCH_SIZE_PLACEHOLDER);
+
+	initStringInfo(&batchCommand);
+
+	while ((placeholder = strstr(command, BATCH_SIZE_PLACEHOLDER)) != NULL)
+	{
+		appendBinaryStringInfo(&batchCommand, command, placeholder - command);
+		appendStringInfo(&batchCommand, "%d", batchSize);
+		command = placeholder + placeholderLength;
+	}
+
+	appendStringInfoString(&batchCommand, command);
+
+	return batchCommand.data;
+}
+
+/*
+ * AdaptBatchSize scales the batch size of a chunked run by how far the time
+ * of the last batch was off the target time, but at most by a factor of two
+ * per batch, so that a single slow or fast batch does not throw it off.
+ */
+static int
+AdaptBatchSize(int batchSize, long batchTime, int batchTargetTime)
+{
+	int64 newBatchSize = 0;
+
+	if (batchTime <= 0)
+	{
+		newBatchSize = (int64) batchSize * 2;
+	}
+	else
+	{
+		newBatchSize = (int64) batchSize * batchTargetTime / batchTime;
+	}
+
+	newBatchSize = Max(newBatchSize, batchSize / 2);
+	newBatchSize = Min(newBatchSize, (int64) batchSize * 2);
+
+	return (int) Max(Min(newBatchSize, MaxBatchSize), 1);
+}
+
+/*
+ * Execute given SQL string without SPI or a libpq session.
+ */
+void
+ExecuteSqlString(const char *sql)
 {
-	List *raw_parsetree_list;
-	ListCell *lc1;
-	bool isTopLevel;
-	int commands_remaining;
 	MemoryContext parsecontext;
-	MemoryContext oldcontext;
 
 	/*
-	 * Parse the SQL string into a list of raw parse trees.
-	 *
 	 * Because we allow statements that perform internal transaction control,
-	 * we can't do this in TopTransactionContext; the parse trees might get
+	 * we can't parse in TopTransactionContext; the parse trees might get
 	 * blown away before we're done executing them.
 	 */
 	parsecontext = AllocSetContextCreate(TopMemoryContext,
@@ -2636,10 +4505,55 @@ ExecuteSqlString(const char *sql)
 										 ALLOCSET_DEFAULT_MINSIZE,
 										 ALLOCSET_DEFAULT_INITSIZE,
 										 ALLOCSET_DEFAULT_MAXSIZE);
+
+	/* pool workers execute many commands, so do not leak the parse trees */
+	PG_TRY();
+	{
+		ExecuteSqlStringInContext(sql, parsecontext);
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(TopMemoryContext);
+		MemoryContextDelete(parsecontext);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	MemoryContextDelete(parsecontext);
+}
+
+/*
+ * ExecuteSqlStringInContext executes the given SQL string, keeping its parse
+ * trees and plans in parsecontext.
+ */
+static void
+ExecuteSqlStringInContext(const char *sql, MemoryContext parsecontext)
+{
+	List *raw_parsetree_list;
+	ListCell *lc1;
+	bool isTopLevel;
+	int commands_remaining;
+	MemoryContext oldcontext;
+#if PG_VERSION_NUM >= 110000
+	bool use_implicit_block;
+#endif
+
+	/* Parse the SQL string into a list of raw parse trees. */
 	oldcontext = MemoryContextSwitchTo(parsecontext);
 	raw_parsetree_list = pg_parse_query(sql);
 	commands_remaining = list_length(raw_parsetree_list);
+#if PG_VERSION_NUM >= 110000
+	/*
+	 * Like a client session, run a multi-statement command in an implicit
+	 * transaction block, which its own COMMIT and ROLLBACK statements end,
+	 * and execute every statement as top level, so that a CALL on its own
+	 * is non-atomic and its procedure can commit along the way.
+	 */
+	use_implicit_block = commands_remaining > 1;
+	isTopLevel = true;
+#else
 	isTopLevel = commands_remaining == 1;
+#endif
 	MemoryContextSwitchTo(oldcontext);
 
 	/*
@@ -2670,15 +4584,25 @@ ExecuteSqlString(const char *sql)
 		DestReceiver *receiver;
 		int16 format = 1;
 
+#if PG_VERSION_NUM >= 110000
+		/* statements after a COMMIT or ROLLBACK start a new implicit block */
+		if (use_implicit_block)
+			BeginImplicitTransactionBlock();
+#else
 		/*
 		 * We don't allow transaction-control commands like COMMIT and ABORT
 		 * here.  The entire SQL statement is executed as a single transaction
 		 * which commits if no errors are encountered.
 		 */
+		#if PG_VERSION_NUM < 100000
 		if (IsA(parsetree, TransactionStmt))
+		#else
+		if (IsA(parsetree->stmt, TransactionStmt))
+		#endif
 			ereport(ERROR,
 					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
 					 errmsg("transaction control statements are not allowed in pg_cron")));
+#endif
 
 		/*
 		 * Get the command name for use in status display (it also becomes the
@@ -2782,38 +4706,78 @@ ExecuteSqlString(const char *sql)
 
 		/* Clean up the portal. */
 		PortalDrop(portal, false);
+
+#if PG_VERSION_NUM >= 110000
+		if (IsA(parsetree->stmt, TransactionStmt))
+		{
+			/*
+			 * Carry out the transaction control statement, like a client
+			 * session does after each one, and start the transaction in which
+			 * the remaining statements run.
+			 */
+			CommitTransactionCommand();
+			StartTransactionCommand();
+		}
+#endif
 	}
 
+#if PG_VERSION_NUM >= 110000
+	if (use_implicit_block)
+		EndImplicitTransactionBlock();
+
+	/* the caller commits at the end, which must not leave a block open */
+	if (IsTransactionBlock())
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TRANSACTION_STATE),
+				 errmsg("transaction block started by the job was not ended"),
+				 errhint("End the block with COMMIT or ROLLBACK.")));
+#endif
+
 	/* Be sure to advance the command counter after the last script command */
 	CommandCounterIncrement();
 }
 
 /*
- * If a task is not marked as active, set an appropriate error state on the task
- * and return true. Note that this should only be called after a task has
- * already been launched.
+ * If a task is not marked as active or its run is to be canceled, set an
+ * appropriate error state on the task and return true. Note that this should
+ * only be called after a task has already been launched.
  */
 static bool
 jobCanceled(CronTask *task)
 {
     Assert(task->state == CRON_TASK_CONNECTING || \
             task->state == CRON_TASK_SENDING || \
+            task->state == CRON_TASK_PREPARING || \
+            task->state == CRON_TASK_BGW_STARTING || \
             task->state == CRON_TASK_BGW_RUNNING || \
             task->state == CRON_TASK_RUNNING);
 
-    if (task->isActive)
+    if (task->isActive && !task->run.cancelRequested)
         return false;
     else
     {
         /* Use the American spelling for consistency with PG code. */
-        task->errorMessage = "job canceled";
+        task->run.errorMessage = task->isActive ? "run canceled" : "job canceled";
+
+        /*
+         * A command that is already executing is stopped asynchronously,
+         * everything else can go straight to the error state.
+         */
+        if (task->state == CRON_TASK_RUNNING ||
+            task->state == CRON_TASK_BGW_STARTING ||
+            task->state == CRON_TASK_BGW_RUNNING)
+        {
+            StartTaskCancel(task, GetCurrentTimestamp());
+            return true;
+        }
+
         task->state = CRON_TASK_ERROR;
 
         /*
-         * Technically, pollingStatus is only used by when UseBackgroundWorkers
-         * is false, but no damage in setting it in both cases.
+         * Technically, pollingStatus is only used by runs over libpq, but no
+         * damage in setting it in both cases.
          */
-        task->pollingStatus = 0;
+        task->run.pollingStatus = 0;
         return true;
     }
 }
@@ -2828,12 +4792,13 @@ jobStartupTimeout(CronTask *task, TimestampTz currentTime)
 {
     Assert(task->state == CRON_TASK_CONNECTING || \
             task->state == CRON_TASK_SENDING || \
+            task->state == CRON_TASK_PREPARING || \
             task->state == CRON_TASK_BGW_START);
 
-    if (TimestampDifferenceExceeds(task->startDeadline, currentTime, 0))
+    if (TimestampDifferenceExceeds(task->run.startDeadline, currentTime, 0))
     {
-        task->errorMessage = "job startup timeout";
-        task->pollingStatus = 0;
+        task->run.errorMessage = "job startup timeout";
+        task->run.pollingStatus = 0;
         task->state = CRON_TASK_ERROR;
         return true;
     }
@@ -2841,9 +4806,9 @@ jobStartupTimeout(CronTask *task, TimestampTz currentTime)
         return false;
 }
 /*
- * If a task has hit it's running deadline, set an appropriate error state on
- * the task and return true. Note that this should only be called after a task
- * has already been launched.
+ * If a task has hit it's running deadline, start canceling the run and
+ * return true. Note that this should only be called after a task has
+ * already been launched.
  */
 static bool
 jobRunningTimeout(CronTask *task, TimestampTz currentTime)
@@ -2853,13 +4818,662 @@ jobRunningTimeout(CronTask *task, TimestampTz currentTime)
 		return false;
 	}
 
-	if (TimestampDifferenceExceeds(task->startDeadline, currentTime, 0))
+	if (TimestampDifferenceExceeds(task->run.startDeadline, currentTime, 0))
 	{
-		task->errorMessage = "job running timeout";
-		task->pollingStatus = 0;
-		task->state = CRON_TASK_ERROR;
+		task->run.errorMessage = "job running timeout";
+		StartTaskCancel(task, currentTime);
 		return true;
 	}
 	else
 		return false;
-}
\ No newline at end of file
+}
+
+/*
+ * StartTaskCancel asks a running task to stop without waiting for it to do
+ * so and moves the task into CRON_TASK_CANCELING, where ManageCronTask polls
+ * until the run is gone or the cancel deadline passes. The caller is
+ * expected to have set task->run.errorMessage.
+ */
+static void
+StartTaskCancel(CronTask *task, TimestampTz currentTime)
+{
+	if (task->connection != NULL)
+	{
+		SendConnectionCancel(task);
+	}
+	else
+	{
+		bool isSignalled = false;
+#ifdef HAVE_SETSID
+		pid_t pid = 0;
+
+		/*
+		 * A linux command runs in a shell that the worker waits for, so
+		 * the shell and its children need to be signalled as well. The
+		 * worker leads their process group.
+		 */
+		if (CRON_COMMAND_TYPE_LINUX == task->commandtype &&
+			GetBackgroundWorkerPid(&task->run.handle, &pid) == BGWH_STARTED)
+		{
+			isSignalled = kill(-pid, SIGTERM) == 0;
+		}
+#endif
+		/* background worker runs */
+		if (!isSignalled)
+		{
+			TerminateBackgroundWorker(&task->run.handle);
+		}
+	}
+
+	task->run.startDeadline = TimestampTzPlusMilliseconds(currentTime, CronTaskCancelTimeout);
+	task->state = CRON_TASK_CANCELING;
+}
+
+/*
+ * SendConnectionCancel requests cancellation of the command running on the
+ * task's connection. When the connection goes to this server, the backend is
+ * signalled directly. Otherwise a non-blocking cancel connection is used if
+ * libpq provides one, and only older libpq versions fall back to the blocking
+ * PQcancel.
+ */
+static void
+SendConnectionCancel(CronTask *task)
+{
+	PGconn *connection = task->connection;
+	pid_t backendPid = (pid_t) PQbackendPID(connection);
+
+	/* wait for the error result of the canceled command */
+	task->run.pollingStatus = PGRES_POLLING_READING;
+
+	if (backendPid > 0 && ConnectionIsLocal(connection) &&
+		BackendPidGetProc(backendPid) != NULL)
+	{
+#ifdef HAVE_SETSID
+		if (kill(-backendPid, SIGINT) == 0)
+#else
+		if (kill(backendPid, SIGINT) == 0)
+#endif
+			return;
+	}
+
+#ifdef LIBPQ_HAS_ASYNC_CANCEL
+	task->run.cancelConn = PQcancelCreate(connection);
+	if (task->run.cancelConn != NULL)
+	{
+		if (PQcancelStart(task->run.cancelConn))
+		{
+			/* the cancel connection is established without blocking */
+			task->run.cancelPollingStatus = PGRES_POLLING_WRITING;
+			return;
+		}
+
+		PQcancelFinish(task->run.cancelConn);
+		task->run.cancelConn = NULL;
+	}
+#else
+	{
+		char errbuf[256] = {0};
+		PGcancel *cancel = PQgetCancel(connection);
+
+		if (cancel != NULL)
+		{
+			if (1 != PQcancel(cancel, errbuf, sizeof(errbuf)))
+			{
+				ereport(LOG, (errmsg("cron job " INT64_FORMAT " could not send cancel request: %s",
+									 task->jobId, errbuf)));
+			}
+
+			PQfreeCancel(cancel);
+		}
+	}
+#endif
+}
+
+/*
+ * ConnectionIsLocal returns whether the given connection goes to this
+ * server, in which case its backend can be signalled directly.
+ */
+static bool
+ConnectionIsLocal(PGconn *connection)
+{
+	char *host = PQhost(connection);
+	char *port = PQport(connection);
+
+	if (host == NULL || port == NULL)
+		return false;
+
+	return NodeIsLocal(host, atoi(port));
+}
+
+/*
+ * NodeIsLocal returns whether a host and port refer to this server.
+ */
+static bool
+NodeIsLocal(const char *host, int port)
+{
+	if (port != PostPortNumber)
+		return false;
+
+	return host[0] == '/' || host[0] == '\0' ||
+		   strcmp(host, "localhost") == 0 ||
+		   strcmp(host, "127.0.0.1") == 0 ||
+		   strcmp(host, "::1") == 0 ||
+		   strcmp(host, CronHost) == 0;
+}
+
+/*
+ * TaskExecutor returns the executor of the next run of a task. Jobs that
+ * leave the choice to pg_cron use the executor configured for the server,
+ * and runs on other nodes can only be run over libpq.
+ */
+static CronExecutor
+TaskExecutor(CronTask *task, CronJob *cronJob)
+{
+	if (!NodeIsLocal(TaskNodeName(task, cronJob), TaskNodePort(task, cronJob)))
+		return CRON_EXECUTOR_LIBPQ;
+
+	if (cronJob->executor != CRON_EXECUTOR_AUTO)
+		return cronJob->executor;
+
+	if (!UseBackgroundWorkers)
+		return CRON_EXECUTOR_LIBPQ;
+
+	return CronUseWorkerPool ? CRON_EXECUTOR_POOL : CRON_EXECUTOR_BGWORKER;
+}
+
+/*
+ * TaskCommandKey returns a string of everything that determines the
+ * connection and prepared statement of a job. Each string is preceded by its
+ * length, so that no two jobs that differ get the same key.
+ */
+static char *
+TaskCommandKey(CronJob *cronJob)
+{
+	StringInfoData key;
+
+	initStringInfo(&key);
+	appendStringInfo(&key, "%zu:%s %zu:%s %zu:%s %d %zu:%s %zu:%s",
+					 strlen(cronJob->database), cronJob->database,
+					 strlen(cronJob->userName), cronJob->userName,
+					 strlen(cronJob->nodeName), cronJob->nodeName,
+					 cronJob->nodePort,
+					 strlen(cronJob->profile), cronJob->profile,
+					 strlen(cronJob->command), cronJob->command);
+
+	return key.data;
+}
+
+/*
+ * TaskCommandMatches returns whether the connection and prepared statement
+ * of the last run of a task, or its daemon run, still fit the job. A
+ * connection that was kept open is only reused while they do.
+ */
+static bool
+TaskCommandMatches(CronTask *task, CronJob *cronJob)
+{
+	char *commandKey = NULL;
+	bool matches = false;
+
+	if (task->commandKey == NULL)
+		return false;
+
+	commandKey = TaskCommandKey(cronJob);
+	matches = strcmp(task->commandKey, commandKey) == 0;
+	pfree(commandKey);
+
+	return matches;
+}
+
+/*
+ * SetTaskCommandKey remembers what the current run of a task was started
+ * with, for TaskCommandMatches.
+ */
+static void
+SetTaskCommandKey(CronTask *task, CronJob *cronJob)
+{
+	char *commandKey = TaskCommandKey(cronJob);
+
+	if (task->commandKey != NULL)
+		pfree(task->commandKey);
+
+	task->commandKey = MemoryContextStrdup(TopMemoryContext, commandKey);
+	pfree(commandKey);
+}
+
+/*
+ * ModeHasOwnWorker returns whether the runs of jobs in the given mode execute
+ * in a background worker of their own, instead of executing the command once.
+ * Such runs fail when the job points to another node.
+ */
+static bool
+ModeHasOwnWorker(int mode)
+{
+	return mode == CRON_MODE_DAEMON || mode == CRON_MODE_CONSUMER ||
+		   mode == CRON_MODE_CHUNKED || mode == CRON_MODE_FANOUT;
+}
+
+/*
+ * CommandIsPreparable returns whether a command is a single SELECT, VALUES,
+ * INSERT, UPDATE, DELETE or WITH statement that can be run as a prepared
+ * statement. A semicolon anywhere but at the end is treated as a
+ * multi-statement command, which errs on the side of the simple protocol.
+ */
+static bool
+CommandIsPreparable(const char *command)
+{
+	static const char *const preparableKeywords[] = {
+		"select", "values", "insert", "update", "delete", "with", NULL
+	};
+	const char *semicolon = NULL;
+	int keywordIndex = 0;
+
+	while (isspace((unsigned char) *command))
+		command++;
+
+	semicolon = strchr(command, ';');
+	if (semicolon != NULL)
+	{
+		const char *rest = semicolon + 1;
+
+		while (isspace((unsigned char) *rest))
+			rest++;
+
+		if (*rest != '\0')
+			return false;
+	}
+
+	for (keywordIndex = 0; preparableKeywords[keywordIndex] != NULL; keywordIndex++)
+	{
+		const char *keyword = preparableKeywords[keywordIndex];
+		int keywordLength = strlen(keyword);
+
+		if (pg_strncasecmp(command, keyword, keywordLength) == 0 &&
+			!isalnum((unsigned char) command[keywordLength]) &&
+			command[keywordLength] != '_')
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * KeepTaskConnection returns whether the connection of a finished run should
+ * stay open for the next run of the same job. Only jobs whose command runs
+ * as a prepared statement gain enough from this to hold on to a backend.
+ */
+static bool
+KeepTaskConnection(CronTask *task, CronJob *cronJob)
+{
+	return CronUsePreparedStatements && CronMaxKeptConnections > 0 &&
+		   task->mode != CRON_MODE_FIXED && !task->isRunInstance &&
+		   task->isActive && cronJob != NULL &&
+		   CommandIsPreparable(TaskCommand(task, cronJob)) &&
+		   PQstatus(task->connection) == CONNECTION_OK;
+}
+
+/*
+ * CloseKeptConnections closes the connections kept open between runs that
+ * have been idle for longer than cron.kept_connection_idle_timeout, and then
+ * the longest idle ones until at most cron.max_kept_connections are left.
+ * Kept connections hold a backend each without counting as running jobs.
+ * They are kept in the order in which they became idle, so only the ones
+ * that are closed are looked at.
+ */
+static void
+CloseKeptConnections(TimestampTz currentTime)
+{
+	CronTask *task = NULL;
+
+	while ((task = OldestKeptConnection()) != NULL)
+	{
+		if (KeptConnectionTotal() <= CronMaxKeptConnections &&
+			(CronKeptConnectionIdleTimeout == 0 ||
+			 !TimestampDifferenceExceeds(task->connectionIdleSince, currentTime,
+										 CronKeptConnectionIdleTimeout * 1000)))
+		{
+			break;
+		}
+
+		CloseKeptConnection(task);
+	}
+}
+
+#ifdef LIBPQ_HAS_PIPELINING
+/*
+ * FormTaskBatch looks for other jobs that are due now, are not yet running
+ * and target the same database, user and node as the given task, and makes
+ * them followers of the task. Their commands are later sent in pipeline mode
+ * on the connection of the task, so that N small jobs cost one connection and
+ * one round trip. Only single-statement jobs can be batched, since pipeline
+ * mode requires the extended query protocol.
+ */
+static void
+FormTaskBatch(CronTask *task, CronJob *cronJob)
+{
+	List *taskList = NIL;
+	ListCell *taskCell = NULL;
+
+	if (CronMaxJobsPerBatch <= 1 || task->mode == CRON_MODE_FIXED ||
+		task->isRunInstance || !CommandIsPreparable(cronJob->command))
+	{
+		return;
+	}
+
+	/* only tasks that are ready to start can join the batch */
+	taskList = QueuedTaskList(CRON_TASK_QUEUE_READY);
+
+	foreach(taskCell, taskList)
+	{
+		CronTask *candidate = (CronTask *) lfirst(taskCell);
+		CronJob *candidateJob = NULL;
+
+		if (task->run.batchSize + 1 >= CronMaxJobsPerBatch)
+		{
+			break;
+		}
+
+		if (candidate == task || !candidate->isActive ||
+			candidate->mode == CRON_MODE_FIXED || ModeHasOwnWorker(candidate->mode) ||
+			candidate->commandtype != CRON_COMMAND_TYPE_SQL ||
+			candidate->connection != NULL || !CanStartTask(candidate))
+		{
+			continue;
+		}
+
+		candidateJob = GetCronJob(candidate->jobId);
+		if (candidateJob == NULL ||
+			TaskExecutor(candidate, candidateJob) != CRON_EXECUTOR_LIBPQ ||
+			strcmp(candidateJob->database, cronJob->database) != 0 ||
+			strcmp(candidateJob->userName, cronJob->userName) != 0 ||
+			strcmp(candidateJob->nodeName, cronJob->nodeName) != 0 ||
+			candidateJob->nodePort != cronJob->nodePort ||
+			strcmp(candidateJob->profile, cronJob->profile) != 0 ||
+			!CommandIsPreparable(candidateJob->command))
+		{
+			continue;
+		}
+
+		if (task->run.batchJobIds == NULL)
+		{
+			task->run.batchJobIds = MemoryContextAlloc(TopMemoryContext,
+												   sizeof(int64) * (CronMaxJobsPerBatch - 1));
+		}
+
+		candidate->state = CRON_TASK_BATCHED;
+		candidate->run.executor = CRON_EXECUTOR_LIBPQ;
+		candidate->run.batchLeaderJobId = task->jobId;
+		candidate->run.runId = TaskRunId(candidate);
+		RequeueTask(candidate);
+
+		RunningTaskCount++;
+
+		if (CronLogRun)
+			InsertJobRunDetail(candidate->run.runId, &candidateJob->jobId,
+							   candidateJob->database,
+							   candidateJob->userName,
+							   candidateJob->command, GetCronStatus(CRON_STATUS_STARTING), 0, NULL);
+
+		task->run.batchJobIds[task->run.batchSize++] = candidate->jobId;
+	}
+
+	list_free(taskList);
+}
+
+/*
+ * SendTaskBatch enters pipeline mode and sends the command of the batch
+ * leader followed by the commands of its followers. Each command gets its
+ * own sync point, so it runs in its own transaction and an error in one job
+ * does not abort the others. Returns 1 on success; on failure the task is
+ * moved into the error state and 0 is returned.
+ */
+static int
+SendTaskBatch(CronTask *task, char *command)
+{
+	PGconn *connection = task->connection;
+	int batchIndex = 0;
+	bool sendFailed = false;
+	pid_t pid = (pid_t) PQbackendPID(connection);
+	TimestampTz start_time = GetCurrentTimestamp();
+
+	if (PQenterPipelineMode(connection) != 1)
+	{
+		sendFailed = true;
+	}
+
+	for (batchIndex = 0; !sendFailed && batchIndex <= task->run.batchSize; batchIndex++)
+	{
+		char *batchCommand = command;
+
+		if (batchIndex > 0)
+		{
+			CronJob *job = GetCronJob(task->run.batchJobIds[batchIndex - 1]);
+
+			/*
+			 * A follower that was unscheduled in the meantime still gets an
+			 * (empty) slot in the pipeline to keep results in order.
+			 */
+			batchCommand = (job != NULL) ? job->command : "";
+		}
+
+		if (PQsendQueryParams(connection, batchCommand, 0, NULL, NULL, NULL, NULL, 0) != 1 ||
+			PQpipelineSync(connection) != 1)
+		{
+			sendFailed = true;
+		}
+	}
+
+	if (sendFailed)
+	{
+		task->run.errorMessage = strdup(PQerrorMessage(connection));
+		task->run.freeErrorMessage = true;
+		task->run.pollingStatus = 0;
+		task->state = CRON_TASK_ERROR;
+
+		return 0;
+	}
+
+	for (batchIndex = 0; batchIndex < task->run.batchSize; batchIndex++)
+	{
+		CronTask *follower = FindCronTask(task->run.batchJobIds[batchIndex]);
+
+		if (follower != NULL && CronLogRun)
+			UpdateJobRunDetail(follower->run.runId, &pid, GetCronStatus(CRON_STATUS_RUNNING), NULL, &start_time, NULL);
+	}
+
+	return 1;
+}
+
+/*
+ * ReceiveTaskBatchResults reads whatever results of a pipelined batch are
+ * available without blocking and attributes each of them to the job that
+ * sent the command. A failure of the leader's own command is only recorded
+ * in batchLeaderFailed, since the leader has to keep reading the results of
+ * its followers. Returns true once the results of all commands in the batch
+ * have been received.
+ */
+static bool
+ReceiveTaskBatchResults(CronTask *task)
+{
+	PGconn *connection = task->connection;
+	bool previousWasNull = false;
+
+	while (task->run.batchResultIndex <= task->run.batchSize)
+	{
+		PGresult *result = NULL;
+		CronTask *resultTask = task;
+
+		if (PQisBusy(connection))
+		{
+			return false;
+		}
+
+		result = PQgetResult(connection);
+		if (result == NULL)
+		{
+			/* end of the results of one command, or nothing more received yet */
+			if (previousWasNull)
+				return false;
+
+			previousWasNull = true;
+			continue;
+		}
+
+		previousWasNull = false;
+
+		if (PQresultStatus(result) == PGRES_PIPELINE_SYNC)
+		{
+			/* move on to the next job in the batch */
+			PQclear(result);
+			task->run.batchResultIndex++;
+			continue;
+		}
+
+		if (task->run.batchResultIndex > 0)
+		{
+			resultTask = FindCronTask(task->run.batchJobIds[task->run.batchResultIndex - 1]);
+		}
+
+		if (resultTask == task)
+		{
+			GetTaskFeedback(result, task);
+
+			if (task->state == CRON_TASK_ERROR)
+			{
+				/*
+				 * The results of the followers are still to come on this
+				 * connection, so the leader keeps running until the end of
+				 * the batch and only fails then.
+				 */
+				task->run.batchLeaderFailed = true;
+				task->run.pollingStatus = PGRES_POLLING_READING;
+				task->state = CRON_TASK_RUNNING;
+			}
+		}
+		else if (resultTask != NULL && resultTask->isActive)
+		{
+			GetTaskFeedback(result, resultTask);
+			RequeueTask(resultTask);
+		}
+		else
+			PQclear(result);
+	}
+
+	return true;
+}
+#endif
+
+/*
+ * FinishTaskBatch hands the followers of a batch back to their own state
+ * machines. Followers whose results were received are done, or in the error
+ * state if their command failed. When the batch leader failed, errorMessage
+ * is given and followers that did not get a result fail with it.
+ */
+static void
+FinishTaskBatch(CronTask *task, char *errorMessage)
+{
+	int batchIndex = 0;
+
+	for (batchIndex = 0; batchIndex < task->run.batchSize; batchIndex++)
+	{
+		CronTask *follower = FindCronTask(task->run.batchJobIds[batchIndex]);
+		bool resultReceived = (batchIndex + 1) < task->run.batchResultIndex;
+
+		if (follower == NULL || follower->state != CRON_TASK_BATCHED)
+		{
+			/* failed with its own error, which its state machine reports */
+			continue;
+		}
+
+		if (!follower->isActive)
+		{
+			follower->run.errorMessage = "job canceled";
+			follower->state = CRON_TASK_ERROR;
+		}
+		else if (!resultReceived && errorMessage != NULL)
+		{
+			follower->run.errorMessage = strdup(errorMessage);
+			follower->run.freeErrorMessage = true;
+			follower->state = CRON_TASK_ERROR;
+		}
+		else
+		{
+			follower->state = CRON_TASK_DONE;
+			RunningTaskCount--;
+		}
+
+		RequeueTask(follower);
+	}
+
+	if (task->run.batchJobIds != NULL)
+	{
+		pfree(task->run.batchJobIds);
+	}
+
+	task->run.batchJobIds = NULL;
+	task->run.batchSize = 0;
+	task->run.batchResultIndex = 0;
+}
+
+/*
+ * IsBgwRetryQueueHead returns whether the run may try to get a background
+ * worker slot, which is the case when no other run is waiting for one or the
+ * run has been waiting the longest.
+ */
+static bool
+IsBgwRetryQueueHead(int64 runId)
+{
+	if (BgwRetryQueue == NIL)
+		return true;
+
+	return *((int64 *) linitial(BgwRetryQueue)) == runId;
+}
+
+/*
+ * EnterBgwRetryQueue appends a run that asks for a background worker slot to
+ * the retry queue, unless it is already waiting.
+ */
+static void
+EnterBgwRetryQueue(int64 runId)
+{
+	ListCell *runCell = NULL;
+	int64 *queuedRunId = NULL;
+	MemoryContext oldContext = NULL;
+
+	foreach(runCell, BgwRetryQueue)
+	{
+		if (*((int64 *) lfirst(runCell)) == runId)
+			return;
+	}
+
+	oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+	queuedRunId = palloc(sizeof(int64));
+	*queuedRunId = runId;
+
+	BgwRetryQueue = lappend(BgwRetryQueue, queuedRunId);
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+/*
+ * LeaveBgwRetryQueue removes a run from the retry queue, if it is waiting.
+ */
+static void
+LeaveBgwRetryQueue(int64 runId)
+{
+	ListCell *runCell = NULL;
+
+	foreach(runCell, BgwRetryQueue)
+	{
+		int64 *queuedRunId = (int64 *) lfirst(runCell);
+
+		if (*queuedRunId == runId)
+		{
+			BgwRetryQueue = list_delete_ptr(BgwRetryQueue, queuedRunId);
+			pfree(queuedRunId);
+			return;
+		}
+	}
+}
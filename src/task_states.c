@@ -16,6 +16,7 @@
 #include "cron.h"
 #include "pg_cron.h"
 #include "task_states.h"
+#include "lt_shared_state.h"
 
 #include "access/hash.h"
 #include "utils/hsearch.h"
@@ -25,10 +26,16 @@
 /* forward declarations */
 static HTAB * CreateCronTaskHash(void);
 static CronTask * GetCronTask(int64 jobId);
+static CronTaskQueue TaskStateQueue(CronTask *task);
 
 /* global variables */
 static MemoryContext CronTaskContext = NULL;
 static HTAB *CronTaskHash = NULL;
+static dlist_head CronTaskQueues[CRON_TASK_QUEUE_COUNT];
+
+/* tasks whose connection is kept open between runs, longest idle first */
+static dlist_head KeptConnections;
+static int KeptConnectionCount = 0;
 
 
 /*
@@ -37,6 +44,8 @@ static HTAB *CronTaskHash = NULL;
 void
 InitializeTaskStateHash(void)
 {
+	int queue = 0;
+
 	CronTaskContext = AllocSetContextCreate(CurrentMemoryContext,
 											  "pg_cron task context",
 											  ALLOCSET_DEFAULT_MINSIZE,
@@ -44,6 +53,13 @@ InitializeTaskStateHash(void)
 											  ALLOCSET_DEFAULT_MAXSIZE);
 
 	CronTaskHash = CreateCronTaskHash();
+
+	for (queue = 0; queue < CRON_TASK_QUEUE_COUNT; queue++)
+	{
+		dlist_init(&CronTaskQueues[queue]);
+	}
+
+	dlist_init(&KeptConnections);
 }
 
 
@@ -111,6 +127,14 @@ RefreshTaskHash(void)
 			task->mode = CRON_MODE_FIXED;
 		else if (!strcmp(value, MODE_SINGLE))
 			task->mode = CRON_MODE_SINGLE;
+		else if (!strcmp(value, MODE_DAEMON))
+			task->mode = CRON_MODE_DAEMON;
+		else if (!strcmp(value, MODE_CONSUMER))
+			task->mode = CRON_MODE_CONSUMER;
+		else if (!strcmp(value, MODE_CHUNKED))
+			task->mode = CRON_MODE_CHUNKED;
+		else if (!strcmp(value, MODE_FANOUT))
+			task->mode = CRON_MODE_FANOUT;
 		else
 			task->mode = CRON_MODE_NEXT;
 
@@ -120,6 +144,23 @@ RefreshTaskHash(void)
 			task->commandtype = CRON_COMMAND_TYPE_LINUX;
 		else
 			task->commandtype = CRON_COMMAND_TYPE_SQL;
+
+		/*
+		 * Fixed interval runs never reuse the connection of the job, so drop
+		 * one that was kept open before the job switched to fixed mode.
+		 */
+		if (task->mode == CRON_MODE_FIXED && task->isConnectionKept)
+		{
+			CloseKeptConnection(task);
+		}
+	}
+
+	/* tasks of removed jobs need to be visited to be removed */
+	hash_seq_init(&status, CronTaskHash);
+
+	while ((task = hash_seq_search(&status)) != NULL)
+	{
+		RequeueTask(task);
 	}
 
 	CronJobCacheValid = true;
@@ -140,29 +181,96 @@ GetCronTask(int64 jobId)
 	if (!isPresent)
 	{
 		InitializeCronTask(task, jobId);
+		EnqueueTask(task);
 	}
 
 	return task;
 }
 
 
+/*
+ * FindCronTask returns the task with the given job ID, or NULL if there
+ * is none.
+ */
+CronTask *
+FindCronTask(int64 jobId)
+{
+	int64 hashKey = jobId;
+	bool isPresent = false;
+
+	return hash_search(CronTaskHash, &hashKey, HASH_FIND, &isPresent);
+}
+
+
 /*
  * InitializeCronTask intializes a CronTask struct.
  */
 void
 InitializeCronTask(CronTask *task, int64 jobId)
 {
-	task->runId = 0;
 	task->jobId = jobId;
 	task->state = CRON_TASK_WAITING;
 	task->pendingRunCount = 0;
 	task->connection = NULL;
-	task->pollingStatus = 0;
-	task->startDeadline = 0;
-	task->isSocketReady = false;
 	task->isActive = true;
-	task->errorMessage = NULL;
-	task->freeErrorMessage = false;
+	task->commandKey = NULL;
+	task->isPrepared = false;
+	task->connectionIdleSince = 0;
+	task->isConnectionKept = false;
+	task->daemonBackoff = 0;
+	task->daemonRestartTime = 0;
+	task->fanoutTargets = NIL;
+	task->fanoutRunId = 0;
+	task->fanoutSucceeded = 0;
+	task->fanoutFailed = 0;
+	task->isRunInstance = false;
+
+	InitializeCronTaskRun(&task->run);
+}
+
+
+/*
+ * InitializeCronTaskRun intializes the run of a task, which happens again
+ * every time a run is over.
+ */
+void
+InitializeCronTaskRun(CronTaskRun *run)
+{
+	run->runId = 0;
+	run->pollingStatus = 0;
+	run->startDeadline = 0;
+	run->isSocketReady = false;
+	run->errorMessage = NULL;
+	run->freeErrorMessage = false;
+	run->seg = NULL;
+	run->batchLeaderJobId = 0;
+	run->batchJobIds = NULL;
+	run->batchSize = 0;
+	run->batchResultIndex = 0;
+	run->batchLeaderFailed = false;
+	run->poolWorker = NULL;
+	run->runSlot = -1;
+	run->responseq = NULL;
+	run->bgwHasResult = false;
+	run->bgwFailed = false;
+	run->bgwMessage[0] = '\0';
+	run->rowsProcessed = 0;
+	run->rowsReported = 0;
+	run->lastProgressTime = 0;
+	run->executor = CRON_EXECUTOR_AUTO;
+	run->cancelRequested = false;
+	run->runMode = CRON_MODE_NEXT;
+	run->runStartTime = 0;
+#ifdef LIBPQ_HAS_ASYNC_CANCEL
+	run->cancelConn = NULL;
+	run->cancelPollingStatus = 0;
+#endif
+	run->command = NULL;
+	run->database = NULL;
+	run->nodeName = NULL;
+	run->nodePort = 0;
+	run->parentRunId = 0;
+	run->target = NULL;
 }
 
 
@@ -188,13 +296,237 @@ CurrentTaskList(void)
 }
 
 
+/*
+ * AddKeptConnection files the connection of a task that stays open after its
+ * run under the connections kept open, which are in the order in which they
+ * became idle.
+ */
+void
+AddKeptConnection(CronTask *task, TimestampTz idleSince)
+{
+	Assert(!task->isConnectionKept && task->connection != NULL);
+
+	task->connectionIdleSince = idleSince;
+	task->isConnectionKept = true;
+	dlist_push_tail(&KeptConnections, &task->keptNode);
+	KeptConnectionCount++;
+}
+
+
+/*
+ * TakeKeptConnection takes the connection of a task off the connections kept
+ * open, as its next run is about to use or close it.
+ */
+void
+TakeKeptConnection(CronTask *task)
+{
+	if (!task->isConnectionKept)
+		return;
+
+	dlist_delete(&task->keptNode);
+	task->isConnectionKept = false;
+	KeptConnectionCount--;
+}
+
+
+/*
+ * CloseKeptConnection closes a connection kept open between runs.
+ */
+void
+CloseKeptConnection(CronTask *task)
+{
+	TakeKeptConnection(task);
+
+	PQfinish(task->connection);
+	task->connection = NULL;
+	task->isPrepared = false;
+}
+
+
+/*
+ * OldestKeptConnection returns the task whose kept connection has been idle
+ * the longest, or NULL if no connection is kept open.
+ */
+CronTask *
+OldestKeptConnection(void)
+{
+	if (dlist_is_empty(&KeptConnections))
+		return NULL;
+
+	return dlist_head_element(CronTask, keptNode, &KeptConnections);
+}
+
+
+/*
+ * KeptConnectionTotal returns the number of connections kept open.
+ */
+int
+KeptConnectionTotal(void)
+{
+	return KeptConnectionCount;
+}
+
+
 /*
  * RemoveTask remove the task for the given job ID.
  */
 void
 RemoveTask(int64 jobId)
 {
+	CronTask *task = NULL;
 	bool isPresent = false;
 
+	task = hash_search(CronTaskHash, &jobId, HASH_FIND, &isPresent);
+	if (!isPresent)
+	{
+		return;
+	}
+
+	DequeueTask(task);
+	DropRequestedRuns(jobId);
+
+	if (task->isConnectionKept)
+		CloseKeptConnection(task);
+
+	if (task->commandKey != NULL)
+		pfree(task->commandKey);
+
 	hash_search(CronTaskHash, &jobId, HASH_REMOVE, &isPresent);
 }
+
+
+/*
+ * EnqueueTask adds a new task to the queue of its state and gives it a slot
+ * in cron.running_jobs().
+ */
+void
+EnqueueTask(CronTask *task)
+{
+	task->queue = TaskStateQueue(task);
+	dlist_push_tail(&CronTaskQueues[task->queue], &task->queueNode);
+
+	AcquireSharedTaskSlot(task);
+}
+
+
+/*
+ * RequeueTask moves a task to the queue of its state, after its state or
+ * pending runs changed, and publishes the new state.
+ */
+void
+RequeueTask(CronTask *task)
+{
+	CronTaskQueue queue = TaskStateQueue(task);
+
+	PublishTaskState(task);
+
+	if (queue == task->queue)
+	{
+		return;
+	}
+
+	dlist_delete(&task->queueNode);
+
+	task->queue = queue;
+	dlist_push_tail(&CronTaskQueues[queue], &task->queueNode);
+}
+
+
+/*
+ * DequeueTask removes a task from its queue before it is removed.
+ */
+void
+DequeueTask(CronTask *task)
+{
+	dlist_delete(&task->queueNode);
+
+	ReleaseSharedTaskSlot(task);
+}
+
+
+/*
+ * QueuedTaskList returns the tasks in the given queue.
+ */
+List *
+QueuedTaskList(CronTaskQueue queue)
+{
+	List *taskList = NIL;
+	dlist_iter iter;
+
+	dlist_foreach(iter, &CronTaskQueues[queue])
+	{
+		taskList = lappend(taskList, dlist_container(CronTask, queueNode, iter.cur));
+	}
+
+	return taskList;
+}
+
+
+/*
+ * ActiveTaskList returns the tasks that are not idle. Finished runs come
+ * first and runs that are ready to start last, so that the runs that end
+ * make room for the ones that start.
+ */
+List *
+ActiveTaskList(void)
+{
+	List *taskList = NIL;
+
+	taskList = list_concat(taskList, QueuedTaskList(CRON_TASK_QUEUE_FINISHED));
+	taskList = list_concat(taskList, QueuedTaskList(CRON_TASK_QUEUE_RUNNING));
+	taskList = list_concat(taskList, QueuedTaskList(CRON_TASK_QUEUE_STARTING));
+	taskList = list_concat(taskList, QueuedTaskList(CRON_TASK_QUEUE_READY));
+
+	return taskList;
+}
+
+
+/*
+ * TaskStateQueue returns the queue that a task belongs in. Waiting tasks of
+ * removed jobs are ready, since they still need to be removed, and so are
+ * the ones of fan-out jobs that still have targets to hand out.
+ */
+static CronTaskQueue
+TaskStateQueue(CronTask *task)
+{
+	switch (task->state)
+	{
+		case CRON_TASK_WAITING:
+		{
+			if (task->pendingRunCount > 0 || task->fanoutTargets != NIL ||
+				!task->isActive)
+			{
+				return CRON_TASK_QUEUE_READY;
+			}
+
+			return CRON_TASK_QUEUE_IDLE;
+		}
+
+		case CRON_TASK_START:
+		case CRON_TASK_CONNECTING:
+		case CRON_TASK_SENDING:
+		case CRON_TASK_PREPARING:
+		case CRON_TASK_BGW_START:
+		case CRON_TASK_BGW_STARTING:
+		{
+			return CRON_TASK_QUEUE_STARTING;
+		}
+
+		case CRON_TASK_RUNNING:
+		case CRON_TASK_RECEIVING:
+		case CRON_TASK_BGW_RUNNING:
+		case CRON_TASK_CANCELING:
+		case CRON_TASK_BATCHED:
+		{
+			return CRON_TASK_QUEUE_RUNNING;
+		}
+
+		case CRON_TASK_DONE:
+		case CRON_TASK_ERROR:
+		{
+			return CRON_TASK_QUEUE_FINISHED;
+		}
+	}
+
+	return CRON_TASK_QUEUE_READY;
+}